@@ -244,7 +244,7 @@ namespace arch::paging {
                 if (allow_large_page_mapping && large_page_supported) {
                     if (is_aligned(phys_addr, level_page_size) &&
                         is_aligned(virt_addr, level_page_size) &&
-                        context->phys_cursor().remaining_size() >= level_page_size)
+                        context->phys_cursor().contiguous_size(level_page_size) >= level_page_size)
                     {
                         // The current address range supports a large mapping.
                         update_entry(entry, level, phys_addr, virt_addr, mmuflags, synchroniser, true);
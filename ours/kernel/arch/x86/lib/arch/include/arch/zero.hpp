@@ -0,0 +1,60 @@
+/// Copyright(C) 2024 smallhuazi
+///
+/// This program is free software; you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published
+/// by the Free Software Foundation; either version 2 of the License, or
+/// (at your option) any later version.
+///
+/// For additional information, please refer to the following website:
+/// https://opensource.org/license/gpl-2-0
+///
+#ifndef ARCH_X86_ZERO_HPP
+#define ARCH_X86_ZERO_HPP 1
+
+#include <arch/types.hpp>
+#include <arch/cache.hpp>
+
+namespace arch {
+    /// Public Interface.
+    /// Requires CPUID.(EAX=07H, ECX=0H):EBX.ERMS to be 1 to reach the best throughput.
+    FORCE_INLINE
+    static auto zero_rep_stosb(void *dst, usize size) -> void {
+        asm volatile("rep stosb" : "+D"(dst), "+c"(size) : "a"(0) : "memory");
+    }
+
+    /// Public Interface. |size| must be aligned to 8 bytes.
+    FORCE_INLINE
+    static auto zero_rep_stosq(void *dst, usize size) -> void {
+        size >>= 3;
+        asm volatile("rep stosq" : "+D"(dst), "+c"(size) : "a"(0) : "memory");
+    }
+
+    /// Public Interface. |dst| and |size| must be aligned to `kCacheSize`.
+    ///
+    /// Write zero with non-temporal stores which bypass caches, so that zeroing a large block
+    /// does not evict the working set. The data may stay in write-combining buffers until the
+    /// trailing `sfence`.
+    FORCE_INLINE
+    static auto zero_nontemporal(void *dst, usize size) -> void {
+        auto cursor = static_cast<u64 *>(dst);
+        auto const end = cursor + (size >> 3);
+        for (; cursor != end; cursor += kCacheSize >> 3) {
+            asm volatile(
+                "movnti %1, 0x00(%0)\n"
+                "movnti %1, 0x08(%0)\n"
+                "movnti %1, 0x10(%0)\n"
+                "movnti %1, 0x18(%0)\n"
+                "movnti %1, 0x20(%0)\n"
+                "movnti %1, 0x28(%0)\n"
+                "movnti %1, 0x30(%0)\n"
+                "movnti %1, 0x38(%0)\n"
+                :: "r"(cursor), "r"(u64(0)) : "memory"
+            );
+        }
+        asm volatile("sfence" ::: "memory");
+    }
+    static_assert(kCacheSize == 64, "`zero_nontemporal` assumes a line of 64 bytes");
+
+} // namespace arch
+
+#endif // #ifndef ARCH_X86_ZERO_HPP
\ No newline at end of file
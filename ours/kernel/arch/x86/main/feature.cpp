@@ -15,6 +15,8 @@ namespace ours {
     }
 
     bool g_feature_has_fsgsbase = false;
+    bool g_feature_has_erms = false;
+    bool g_feature_has_sse2 = false;
 
     INIT_CODE
     auto x86_init_feature_percpu(CpuNum cpunum) -> void {
@@ -22,6 +24,8 @@ namespace ours {
         cpuinfo->init();
 
         g_feature_has_fsgsbase = x86_has_feature(CpuFeatureType::FsGsBase);
+        g_feature_has_erms = x86_has_feature(CpuFeatureType::Erms);
+        g_feature_has_sse2 = x86_has_feature(CpuFeatureType::Xmm2);
     }
 
     INIT_CODE
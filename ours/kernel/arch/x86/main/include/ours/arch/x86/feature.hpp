@@ -20,6 +20,12 @@ namespace ours {
 
     extern bool g_feature_has_fsgsbase;
 
+    /// Enhanced REP MOVSB/STOSB.
+    extern bool g_feature_has_erms;
+
+    /// Required by non-temporal stores `movnti`.
+    extern bool g_feature_has_sse2;
+
 } // namespace ours
 
 #endif // #ifndef OURS_ARCH_X86_FEATURES_HPP
\ No newline at end of file
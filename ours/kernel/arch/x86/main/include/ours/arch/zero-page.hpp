@@ -0,0 +1,30 @@
+/// Copyright(C) 2024 smallhuazi
+///
+/// This program is free software; you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published
+/// by the Free Software Foundation; either version 2 of the License, or
+/// (at your option) any later version.
+///
+/// For additional information, please refer to the following website:
+/// https://opensource.org/license/gpl-2-0
+///
+#ifndef OURS_ARCH_ZERO_PAGE_HPP
+#define OURS_ARCH_ZERO_PAGE_HPP 1
+
+#include <ours/types.hpp>
+#include <ours/mem/cfg.hpp>
+
+namespace ours {
+    /// Blocks not smaller than it are zeroed with non-temporal stores.
+    CXX11_CONSTEXPR
+    static usize const kArchNonTemporalZeroThreshold = PAGE_SIZE << 4;
+
+    /// Zero |size| bytes of pages at |va|, both must be aligned to `PAGE_SIZE`.
+    ///
+    /// The kernel is chosen by CPU features and |size|. Large blocks are written with 
+    /// non-temporal stores, so that a huge page does not flush the whole L2.
+    auto arch_zero_pages(VirtAddr va, usize size) -> void;
+
+} // namespace ours
+
+#endif // #ifndef OURS_ARCH_ZERO_PAGE_HPP
\ No newline at end of file
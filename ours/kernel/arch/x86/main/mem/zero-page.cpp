@@ -0,0 +1,23 @@
+#include <ours/arch/zero-page.hpp>
+#include <ours/arch/x86/feature.hpp>
+#include <ours/assert.hpp>
+
+#include <arch/zero.hpp>
+#include <ustl/mem/align.hpp>
+
+namespace ours {
+    auto arch_zero_pages(VirtAddr va, usize size) -> void {
+        DEBUG_ASSERT(ustl::mem::is_aligned(va, PAGE_SIZE));
+        DEBUG_ASSERT(ustl::mem::is_aligned(size, PAGE_SIZE));
+
+        auto const dst = reinterpret_cast<void *>(va);
+        if (size >= kArchNonTemporalZeroThreshold && g_feature_has_sse2) {
+            arch::zero_nontemporal(dst, size);
+        } else if (g_feature_has_erms) {
+            arch::zero_rep_stosb(dst, size);
+        } else {
+            arch::zero_rep_stosq(dst, size);
+        }
+    }
+
+} // namespace ours
\ No newline at end of file
@@ -79,14 +79,15 @@ namespace arch::paging {
             return (*addrs_) + consumed_;
         }
 
+        /// |page_size| may span several addresses if they are contiguous, see `contiguous_size`.
         FORCE_INLINE CXX11_CONSTEXPR 
         auto consume(usize page_size) -> void {
             DEBUG_ASSERT(consumed_ <= page_size_, "Consume");
             DEBUG_ASSERT(count_ > 0, "Consume");
 
             consumed_ += page_size;
-            if (consumed_ == page_size_) {
-                consumed_ = 0;
+            while (count_ && consumed_ >= page_size_) {
+                consumed_ -= page_size_;
                 count_ -= 1;
                 addrs_ += 1;
             }
@@ -100,6 +101,20 @@ namespace arch::paging {
             return page_size_ - consumed_;
         }
 
+        /// The size of the physically contiguous range from the cursor, it goes across the
+        /// following addresses until one breaks the range or |limit| is reached.
+        CXX11_CONSTEXPR
+        auto contiguous_size(usize limit) const -> usize {
+            auto size = remaining_size();
+            for (usize i = 1; i < count_ && size < limit; ++i) {
+                if (addrs_[i] != addrs_[i - 1] + page_size_) {
+                    break;
+                }
+                size += page_size_;
+            }
+            return size;
+        }
+
         usize page_size_;
         usize consumed_;
         usize count_;
@@ -22,6 +22,9 @@ namespace ktl {
 
     auto kfree(void *object) -> void;
 
+    /// Log counters of each size class.
+    auto dump_kmalloc_stats() -> void;
+
 } // namespace ktl
 
 #endif // #ifndef KTL_KMALLOC_HPP
\ No newline at end of file
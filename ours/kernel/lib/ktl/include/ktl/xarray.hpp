@@ -11,19 +11,15 @@
 #ifndef KTL_XARRAY_HPP
 #define KTL_XARRAY_HPP 1
 
-#include <ours/types.hpp>
+#include <ktl/types.hpp>
 #include <ours/config.hpp>
 
-#include <ustl/array.hpp>
-#include <ustl/bitset.hpp>
+#include <ustl/bit.hpp>
 #include <ustl/option.hpp>
-#include <ustl/bitfields.hpp>
 
 #include <ktl/result.hpp>
 
 namespace ktl {
-    namespace ubf = ustl::bitfields;
-
     struct XarryDefaultConfig {
         CXX11_CONSTEXPR
         static auto const kSlotsBits = 6;
@@ -32,222 +28,235 @@ namespace ktl {
         static auto const kNumBitTags = 4;
     };
 
+    /// A sparse array of pointers indexed by `usize`, organized as a radix tree of nodes
+    /// with `kMaxSlots` slots each.
+    ///
+    /// An entry of order N covers 2^N consecutive indices aligned to 2^N. It takes one
+    /// canonical slot and sibling slots pointing back to it in the node at the level of N,
+    /// so looking up any index in it costs the same as a single one.
+    ///
+    /// Each entry has `kNumBitTags` marks. A mark set on an entry is also set on all of the
+    /// slots leading to it, so marked entries are found without visiting unmarked subtrees.
     template <typename A, typename Config = XarryDefaultConfig>
-    struct Xarray {
+    class Xarray {
         typedef Xarray   Self;
-
+      public:
         CXX11_CONSTEXPR
-        static auto const kNumBitTags = Config::kNumBitTags;
+        static usize const kNumBitTags = Config::kNumBitTags;
 
         CXX11_CONSTEXPR
-        static auto const kSlotsBits = Config::kSlotsBits;
+        static usize const kSlotsBits = Config::kSlotsBits;
 
         CXX11_CONSTEXPR
-        static auto const kSlotsMask = (1 << kSlotsBits) - 1;
+        static usize const kMaxSlots = usize(1) << kSlotsBits;
 
         CXX11_CONSTEXPR
-        static auto const kMaxSlots = (1 << kSlotsBits);
+        static usize const kSlotsMask = kMaxSlots - 1;
+
+        static_assert(kMaxSlots <= 64, "Marks of a node are kept in a word");
 
         struct Node;
+
+        /// An entry is a word whose lowest two bits tell what it is:
+        ///
+        ///     00: a pointer to an object, which must be aligned to 4 at least.
+        ///     x1: an integer value shifted left by one.
+        ///     10: internal. A node if greater than `kMaxSlots << 2`, otherwise a sibling
+        ///         holding the offset of the canonical slot.
         struct Entry {
             typedef Entry   Self;
-            typedef usize   Value;
-
-            enum class Type {
-                Pointer,
-                Internal,
-                ValueTagged,
-                MaxNumType,
-            };
-
-            template <usize Id, typename Type, usize Bits>
-            using Field = ustl::Field<ubf::Id<Id>, ubf::Type<Type>, ubf::Bits<Bits>>;
-
-            CXX11_CONSTEXPR
-            static auto kTypeBits = ustl::bit_width(usize(Type::MaxNumType));
-
-            CXX11_CONSTEXPR
-            static auto kValueBits = ustl::NumericLimits<usize>::DIGITS - kTypeBits;
-
-            typedef ustl::BitFields<Field<0, Type, kTypeBits>, Field<1, usize, kValueBits>> Inner;
-
-            FORCE_INLINE CXX11_CONSTEXPR
-            auto max_index() const -> usize {
-                if (is_node()) {
-                    return value<Node>().max_index();
-                }
-                return 0;
-            }
 
             FORCE_INLINE CXX11_CONSTEXPR
-            auto type() const -> Type {
-                return inner.template get<0>();
+            auto is_null() const -> bool {
+                return raw == 0;
             }
 
             FORCE_INLINE CXX11_CONSTEXPR
-            auto set_type(Type type) -> Self & {
-                inner.template set<0>(type);
-                return *this;
+            auto is_pointer() const -> bool {
+                return raw && (raw & 3) == 0;
             }
 
             FORCE_INLINE CXX11_CONSTEXPR
             auto is_value() const -> bool {
-                return type() == Type::ValueTagged;
+                return raw & 1;
             }
 
             FORCE_INLINE CXX11_CONSTEXPR
-            auto is_node() const -> bool {
-                return type() == Type::Internal;
+            auto is_internal() const -> bool {
+                return (raw & 3) == 2;
             }
 
             FORCE_INLINE CXX11_CONSTEXPR
-            auto is_null() const -> bool {
-                return reinterpret_cast<usize>(inner) == 0;
+            auto is_sibling() const -> bool {
+                return is_internal() && raw < (kMaxSlots << 2);
             }
 
-            template <typename T>
             FORCE_INLINE CXX11_CONSTEXPR
-            auto value() -> T & {
-                static_assert(sizeof(T) == sizeof(usize), "");
-                return reinterpret_cast<T &>(inner.template get<1>());
+            auto is_node() const -> bool {
+                return is_internal() && raw >= (kMaxSlots << 2);
             }
 
             template <typename T>
-            FORCE_INLINE CXX11_CONSTEXPR
-            auto cast_to() -> ustl::Option<T> {
-                static_assert(sizeof(T) == sizeof(usize), "");
-                if (!is_value()) {
-                    return ustl::none();
-                }
-                return *reinterpret_cast<T *>(
-                    reinterpret_cast<usize>(inner.template get<1>())
-                );
+            FORCE_INLINE
+            auto pointer() const -> T * {
+                return is_pointer() ? reinterpret_cast<T *>(raw) : nullptr;
             }
 
             FORCE_INLINE CXX11_CONSTEXPR
-            auto node() -> Node * {
-                return value<Node>();
+            auto value() const -> usize {
+                return raw >> 1;
             }
 
-            FORCE_INLINE CXX11_CONSTEXPR
-            auto value() const -> Value {
-                return inner.template get<1>();
+            FORCE_INLINE
+            auto node() const -> Node * {
+                return reinterpret_cast<Node *>(raw - 2);
             }
 
             FORCE_INLINE CXX11_CONSTEXPR
-            auto set_value(Value value) -> Self & {
-                inner.template set<1>(value);
-                return *this;
+            auto sibling() const -> usize {
+                return raw >> 2;
             }
 
             template <typename T>
             FORCE_INLINE
-            static auto make(Type type, T *object) -> Entry {
-                return Entry().set_type(type).set_value(object);
+            static auto from_pointer(T *object) -> Self {
+                return Self{reinterpret_cast<usize>(object)};
             }
 
-            template <typename T>
-            FORCE_INLINE
-            static auto make_node(T *object) -> Entry {
-                return make(Type::Internal, object);
+            FORCE_INLINE CXX11_CONSTEXPR
+            static auto from_value(usize value) -> Self {
+                return Self{(value << 1) | 1};
             }
-            
-            Inner inner;
-        };
-        typedef ustl::Array<Entry, kMaxSlots>   Slots;
 
-        struct Node {
-            auto get_offset(usize index) const -> usize {
-                return (index >> shift) & kSlotsMask;
+            FORCE_INLINE
+            static auto from_node(Node *node) -> Self {
+                return Self{reinterpret_cast<usize>(node) + 2};
             }
 
-            auto get_entry(usize index) const -> Entry {
-                return slots[get_offset(index)];
+            FORCE_INLINE CXX11_CONSTEXPR
+            static auto make_sibling(usize offset) -> Self {
+                return Self{(offset << 2) | 2};
             }
 
-            auto set_entry(usize index, Entry entry) const -> Self & {
-                slots[get_offset(index)] = entry;
-                return *this;
-            }
+            usize raw;
+        };
 
-            auto max_index() const -> usize {
-                return (kMaxSlots << shift) - 1;
+        struct Node {
+            FORCE_INLINE
+            auto get_offset(usize index) const -> usize {
+                return (index >> shift) & kSlotsMask;
             }
 
-            u8 shift;   // The order of number of slots, if zero the slot is a leaf node.
-            u8 offset;  // Slot offfset in parent.
-            u8 nr_inuses;
-            u8 nr_values;
+            u8 shift;       // Bits of index below this node, zero if a leaf.
+            u8 offset;      // Slot offset in parent.
+            u8 count;       // Slots in use, siblings included.
             Node *parent;
-            Xarray *owner;
-            Slots slots;
+            Entry slots[kMaxSlots];
+            u64 marks[kNumBitTags];
         };
-        typedef Node *          NodePtrMut;
-        typedef Node const *    NodePtr;
         typedef typename A::template RebindT<Node>  Allocator;
 
-        struct Cursor {
-            /// This dummy pointer was used to act as a tag which indicates that this cursor
-            /// is at the front of Xarray.
-            CXX11_CONSTEXPR
-            static auto const kRootTag = NodePtrMut(3);
+        Xarray() = default;
+        Xarray(Xarray const &) = delete;
+        auto operator=(Xarray const &) -> Xarray & = delete;
+
+        ~Xarray() {
+            clear();
+        }
 
-            auto load() -> Entry;
+        /// Return the entry covering |index|, or a null one.
+        auto load(usize index) const -> Entry;
 
-            auto store(Entry entry) -> ustl::Result<Entry, ours::Status>;
+        /// Store |entry| of |order| at |index| aligned down to the order. An existing entry
+        /// of the same position and order is replaced and returned, marks are kept. Other
+        /// entries within the range make it fail with `AlreadyExists`.
+        auto store(usize index, Entry entry, usize order = 0) -> ktl::Result<Entry>;
 
-            auto erase() -> Entry;
+        /// Remove the entry covering |index| with its marks, and return it.
+        auto erase(usize index) -> Entry;
 
-          private:
-            auto create_slots() -> ustl::Option<Entry>;
+        /// Return the first index and the order of the entry covering it.
+        auto lookup(usize index, usize *first, usize *order) const -> Entry;
 
-            /// Adds nodes to the head of the tree until it has reached
-            /// sufficient height to be able to contain `index_`
-            auto expand(Entry head) -> ustl::Option<usize>;
+        /// Return false if there is no entry covering |index|.
+        auto set_mark(usize index, usize mark) -> bool;
 
-            auto descend(NodePtrMut node) -> Entry;
+        auto clear_mark(usize index, usize mark) -> void;
 
-            // True if current `node_` is the root of owner, otherwise False.
-            FORCE_INLINE
-            auto at_root() const -> bool {
-                return node_ == kRootTag;
-            }
+        auto get_mark(usize index, usize mark) const -> bool;
 
-            Xarray *owner_;
-	        usize index_;
-	        usize shift_;
-	        usize offset_;
-	        NodePtrMut node_;   // Node we are operating on.
-            ustl::BitSet<kMaxSlots * kNumBitTags> tags_;
-        };
+        /// Return the first index of the first entry marked with |mark| which covers |index|
+        /// or lies after it.
+        auto find_mark(usize index, usize mark) const -> ustl::Option<usize>;
 
-        auto make_cursor(usize index, usize shift) -> Cursor {
-            return Cursor(this, index, shift, 0, 0, Cursor::kRootTag, 0);
+        /// Call |f(index, entry, order)| for every entry in increasing order of index.
+        template <typename F>
+        auto for_each(F &&f) const -> void {
+            if (head_.is_node()) {
+                for_each_in(head_.node(), 0, f);
+            }
         }
 
-        auto load(usize index) -> Entry;
-
-        auto store(usize index, Entry entry) -> ktl::Result<ustl::Option<Entry>>;
+        /// Free all nodes. Entries are left to their owner.
+        auto clear() -> void;
 
-        auto erase(usize index) -> Entry;
+        FORCE_INLINE
+        auto is_empty() const -> bool {
+            return head_.is_null();
+        }
 
         template <typename T>
-        static auto make_entry(T *object) -> Entry;
+        FORCE_INLINE
+        static auto make_entry(T *object) -> Entry {
+            return Entry::from_pointer(object);
+        }
+
       private:
+        /// Number of slots taken by the entry at |offset|, itself and its siblings.
+        static auto nr_slots_of(Node const *node, usize offset) -> usize;
 
-        auto alloc_node() -> NodePtrMut {
-            return payload_.get_allocator().allocate();
-        }
+        /// Find the leaf-most node holding |index| and the canonical offset in it.
+        auto locate(usize index, usize *offset) const -> Node *;
+
+        /// Grow the tree until the root covers |index| at a level of |shift| at least.
+        auto expand(usize index, usize shift) -> Status;
+
+        auto alloc_node(u8 shift, Node *parent, u8 offset) -> Node *;
+
+        auto free_nodes(Node *node) -> void;
+
+        /// Free |node| and then its ancestors as long as they are empty.
+        auto prune(Node *node) -> void;
+
+        /// Clear |mark| of the slots leading to |node| if none of its slots has it.
+        static auto propagate_clear(Node *node, usize mark) -> void;
 
-        struct Payload: public Allocator {
-            auto get_allocator() -> Allocator & {
-                return *this;
+        template <typename F>
+        static auto for_each_in(Node const *node, usize base, F &f) -> void {
+            for (usize i = 0; i < kMaxSlots; ++i) {
+                auto const entry = node->slots[i];
+                if (entry.is_null() || entry.is_sibling()) {
+                    continue;
+                }
+
+                auto const index = base + (i << node->shift);
+                if (entry.is_node()) {
+                    for_each_in(entry.node(), index, f);
+                    continue;
+                }
+
+                auto const nr_slots = nr_slots_of(node, i);
+                f(index, entry, node->shift + ustl::bit_width(nr_slots) - 1);
             }
+        }
+
+        auto find_mark_in(Node const *node, usize base, usize index, usize mark) const -> ustl::Option<usize>;
 
-            Entry entry;
-        } payload_;
+        Entry head_ = {};
     };
 
 } // namespace ktl
 
-#endif // #ifndef KTL_XARRAY_HPP
\ No newline at end of file
+#include <ktl/xarray.tcc>
+
+#endif // #ifndef KTL_XARRAY_HPP
@@ -1,145 +1,350 @@
 #include <ktl/xarray.hpp>
 
 #define TEMPLATE \
-    template <typename Allocator, typename Config>
-#define XARRAY_CURSOR \
-    Xarray<Allocator, Config>::Cursor
+    template <typename A, typename Config>
+#define XARRAY \
+    Xarray<A, Config>
 
 namespace ktl {
-    TEMPLATE 
-    auto XARRAY_CURSOR::expand(Entry head) -> ustl::Option<usize> {
-        // Represent the shift of upper-level, by default
-        usize shift = 0;
-        usize max_idx = index_;
-
-        if (head.is_null()) {
-            // If given a null entry, just return the shift which is sufficient to
-            // current index.
-            while ((max_idx >> shift) >= kMaxSlots) {
-                shift += kSlotsBits;
+    TEMPLATE
+    auto XARRAY::alloc_node(u8 shift, Node *parent, u8 offset) -> Node * {
+        // Slots, counts and marks are zeroed by the allocator.
+        auto node = Self::Allocator::allocate(1);
+        if (!node) {
+            return nullptr;
+        }
+
+        node->shift = shift;
+        node->parent = parent;
+        node->offset = offset;
+        return node;
+    }
+
+    TEMPLATE
+    auto XARRAY::free_nodes(Node *node) -> void {
+        for (auto entry : node->slots) {
+            if (entry.is_node()) {
+                free_nodes(entry.node());
             }
-            return ustl::some(shift);
         }
+        Self::Allocator::deallocate(node, 1);
+    }
+
+    TEMPLATE
+    auto XARRAY::clear() -> void {
+        if (head_.is_node()) {
+            free_nodes(head_.node());
+        }
+        head_ = {};
+    }
+
+    TEMPLATE
+    auto XARRAY::nr_slots_of(Node const *node, usize offset) -> usize {
+        auto i = offset + 1;
+        while (i < kMaxSlots && node->slots[i].is_sibling() && node->slots[i].sibling() == offset) {
+            i += 1;
+        }
+        return i - offset;
+    }
 
-        NodePtrMut node = nullptr;
-        if (head.is_node()) {
-            // If a node, the shift of upper-level is shift of this node plus kSlotsBit.
-            node = head.node();
-            shift = node->shift + kSlotsBits;
+    TEMPLATE
+    auto XARRAY::expand(usize index, usize shift) -> Status {
+        if (head_.is_null()) {
+            while ((index >> shift) >= kMaxSlots) {
+                shift += kSlotsBits;
+            }
+            auto const node = alloc_node(shift, nullptr, 0);
+            if (!node) {
+                return Status::OutOfMem;
+            }
+            head_ = Entry::from_node(node);
+            return Status::Ok;
         }
 
-        // Bottom -> Up 
-        while (max_idx > head.max_index()) {
-            // Attempt to allocate parent node.
-            node = owner_->alloc_node(shift);
+        // Bottom -> Up, the old root becomes the first slot of the new one.
+        auto root = head_.node();
+        while (root->shift < shift || (index >> root->shift) >= kMaxSlots) {
+            auto const node = alloc_node(root->shift + kSlotsBits, nullptr, 0);
             if (!node) {
-                return ustl::none(); // Status::OutOfMem
-            }
-            if (head.is_value()) {
-                node->nr_values += 1;
-            }
-
-            // Install this entry.
-            node->set_entry(0, head);
-
-            // Update for next iteration.
-            head = Entry::make_node(node);
-
-            // Update Xarray for correctly recording the root.
-            owner_->payload_.entry = head;
-            shift += kSlotsBits;
-        }
-
-        // Update cursor.
-        node_ = node;
-        return ustl::some(shift);
-    }
-
-    TEMPLATE 
-    auto XARRAY_CURSOR::create_slots() -> ustl::Option<Entry> {
-        Entry entry, *slot;
-        usize shift, order = shift_;
-        NodePtrMut node = node_;
-        if (at_root()) {
-            // If create slots from root of tree, we first have to attempt expanding the
-            // height of teh current tree.
-            entry = owner_->payload_.entry;
-            shift = expand(entry);
-            if (!shift) {
-                return ustl::none();
-            }
-            // Because `expand` operation has changed the value of entry owner held possibly,
-            // we have to update it.
-            entry = owner_->payload_.entry;
-            slot = &owner_->payload_.entry;
-        } else if (node)  {
-            shift = node->shift;
-            entry = node->get_entry(index_);
-            slot = &node_->slots[offset_];
-        } else {
-            shift = 0;
-            entry = owner_->payload_.entry;
-            slot = &owner_->payload_.entry;
-        }
-
-        // Top -> Down
-        while (shift > order) {
-            shift -= kSlotsBits;
-            if (entry.is_null()) {
-                node = owner_->alloc_node(shift);
-                if (!node) {
-                    break;
+                return Status::OutOfMem;
+            }
+
+            node->slots[0] = head_;
+            node->count = 1;
+            for (usize mark = 0; mark < kNumBitTags; ++mark) {
+                if (root->marks[mark]) {
+                    node->marks[mark] = 1;
                 }
-                // Make lower level.
-                *slot = Entry::make_node(node);
-            } else if (entry.is_node()) {
+            }
+            root->parent = node;
+            root->offset = 0;
+
+            root = node;
+            head_ = Entry::from_node(node);
+        }
+
+        return Status::Ok;
+    }
+
+    TEMPLATE
+    auto XARRAY::locate(usize index, usize *offset) const -> Node * {
+        if (!head_.is_node()) {
+            return nullptr;
+        }
+
+        auto node = head_.node();
+        if ((index >> node->shift) >= kMaxSlots) {
+            return nullptr;
+        }
+
+        while (1) {
+            auto i = node->get_offset(index);
+            auto entry = node->slots[i];
+            if (entry.is_sibling()) {
+                i = entry.sibling();
+                entry = node->slots[i];
+            }
+
+            if (entry.is_node()) {
                 node = entry.node();
-            } else {
-                break;
+                continue;
+            }
+            if (entry.is_null()) {
+                return nullptr;
             }
 
-		    // Let's go for next layer.
-            entry = descend(node);
-            slot = &node->slots[offset_];
+            *offset = i;
+            return node;
         }
+    }
 
-        return entry;
+    TEMPLATE
+    auto XARRAY::load(usize index) const -> Entry {
+        usize offset;
+        auto const node = locate(index, &offset);
+        if (!node) {
+            return {};
+        }
+        return node->slots[offset];
     }
 
-    TEMPLATE 
-    auto XARRAY_CURSOR::store(Entry value) -> ktl::Result<Entry> {
-        if (!value.is_null()) {
-            create_slots();
+    TEMPLATE
+    auto XARRAY::lookup(usize index, usize *first, usize *order) const -> Entry {
+        usize offset;
+        auto const node = locate(index, &offset);
+        if (!node) {
+            return {};
+        }
+
+        auto const nr_slots = nr_slots_of(node, offset);
+        *order = node->shift + ustl::bit_width(nr_slots) - 1;
+        *first = index & ~((usize(1) << *order) - 1);
+        return node->slots[offset];
+    }
+
+    TEMPLATE
+    auto XARRAY::store(usize index, Entry entry, usize order) -> ktl::Result<Entry> {
+        if (entry.is_null()) {
+            return ktl::ok(erase(index));
+        }
+        if (entry.is_internal()) {
+            return ktl::err(Status::InvalidArguments);
+        }
+
+        // An entry lives in the node whose level is the order rounded down to `kSlotsBits`,
+        // spanning 2^(order - shift) slots there.
+        auto const shift = order - order % kSlotsBits;
+        auto const nr_slots = usize(1) << (order - shift);
+        index &= ~((usize(1) << order) - 1);
+
+        auto status = expand(index, shift);
+        if (Status::Ok != status) {
+            return ktl::err(status);
+        }
+
+        // Top -> Down, creating the missing nodes.
+        auto node = head_.node();
+        while (node->shift > shift) {
+            auto const i = node->get_offset(index);
+            auto const slot = node->slots[i];
+            if (slot.is_node()) {
+                node = slot.node();
+                continue;
+            }
+            if (!slot.is_null()) {
+                // A larger entry covers the range.
+                return ktl::err(Status::AlreadyExists);
+            }
+
+            auto const child = alloc_node(node->shift - kSlotsBits, node, i);
+            if (!child) {
+                // Nodes just made above are empty yet.
+                prune(node);
+                return ktl::err(Status::OutOfMem);
+            }
+            node->slots[i] = Entry::from_node(child);
+            node->count += 1;
+            node = child;
+        }
+
+        auto const offset = node->get_offset(index);
+        auto const old = node->slots[offset];
+        if (!old.is_null()) {
+            if (old.is_node() || old.is_sibling() || nr_slots_of(node, offset) != nr_slots) {
+                return ktl::err(Status::AlreadyExists);
+            }
+            node->slots[offset] = entry;
+            return ktl::ok(old);
+        }
+
+        for (usize i = offset; i < offset + nr_slots; ++i) {
+            if (!node->slots[i].is_null()) {
+                return ktl::err(Status::AlreadyExists);
+            }
+        }
+
+        node->slots[offset] = entry;
+        for (usize i = offset + 1; i < offset + nr_slots; ++i) {
+            node->slots[i] = Entry::make_sibling(offset);
         }
+        node->count += nr_slots;
+        return ktl::ok(Entry{});
     }
 
-    TEMPLATE FORCE_INLINE 
-    auto XARRAY_CURSOR::descend(NodePtrMut node) -> Entry {
-        offset_ = node->get_offset(index_);
-        return node->get_entry(index_);
+    TEMPLATE
+    auto XARRAY::erase(usize index) -> Entry {
+        usize offset;
+        auto node = locate(index, &offset);
+        if (!node) {
+            return {};
+        }
+
+        auto const old = node->slots[offset];
+        auto const nr_slots = nr_slots_of(node, offset);
+        for (usize i = offset; i < offset + nr_slots; ++i) {
+            node->slots[i] = {};
+        }
+        node->count -= nr_slots;
+        for (usize mark = 0; mark < kNumBitTags; ++mark) {
+            if (node->marks[mark] & (u64(1) << offset)) {
+                node->marks[mark] &= ~(u64(1) << offset);
+                propagate_clear(node, mark);
+            }
+        }
+
+        prune(node);
+        return old;
     }
 
-    TEMPLATE 
-    auto XARRAY_CURSOR::load() -> Entry {
-        Entry entry = owner_->payload_.entry;
-        while (entry.is_node()) {
-            NodePtrMut node = entry.node();
-            // 
-            if (shift_ > node->shift) {
+    TEMPLATE
+    auto XARRAY::prune(Node *node) -> void {
+        while (!node->count) {
+            auto const parent = node->parent;
+            auto const offset = node->offset;
+            Self::Allocator::deallocate(node, 1);
+            if (!parent) {
+                head_ = {};
                 break;
             }
 
-            entry = node->get_entry(index_);
-            if (!node->shift) {
-                // Leaf node.
+            parent->slots[offset] = {};
+            parent->count -= 1;
+            node = parent;
+        }
+    }
+
+    TEMPLATE
+    auto XARRAY::propagate_clear(Node *node, usize mark) -> void {
+        while (!node->marks[mark] && node->parent) {
+            auto const parent = node->parent;
+            parent->marks[mark] &= ~(u64(1) << node->offset);
+            node = parent;
+        }
+    }
+
+    TEMPLATE
+    auto XARRAY::set_mark(usize index, usize mark) -> bool {
+        usize offset;
+        auto node = locate(index, &offset);
+        if (!node) {
+            return false;
+        }
+
+        node->marks[mark] |= (u64(1) << offset);
+        for (; node->parent; node = node->parent) {
+            auto &marks = node->parent->marks[mark];
+            if (marks & (u64(1) << node->offset)) {
                 break;
             }
+            marks |= (u64(1) << node->offset);
+        }
+        return true;
+    }
+
+    TEMPLATE
+    auto XARRAY::clear_mark(usize index, usize mark) -> void {
+        usize offset;
+        auto node = locate(index, &offset);
+        if (!node || !(node->marks[mark] & (u64(1) << offset))) {
+            return;
+        }
+
+        node->marks[mark] &= ~(u64(1) << offset);
+        propagate_clear(node, mark);
+    }
+
+    TEMPLATE
+    auto XARRAY::get_mark(usize index, usize mark) const -> bool {
+        usize offset;
+        auto node = locate(index, &offset);
+        return node && (node->marks[mark] & (u64(1) << offset));
+    }
+
+    TEMPLATE
+    auto XARRAY::find_mark_in(Node const *node, usize base, usize index, usize mark) const -> ustl::Option<usize> {
+        // Slots wholly below |index| are skipped, except the one covering it.
+        usize i = 0;
+        if (index > base) {
+            i = (index - base) >> node->shift;
+            if (node->slots[i].is_sibling()) {
+                i = node->slots[i].sibling();
+            }
         }
 
-        return entry;
+        for (; i < kMaxSlots; ++i) {
+            if (!(node->marks[mark] & (u64(1) << i))) {
+                continue;
+            }
+
+            auto const first = base + (i << node->shift);
+            auto const entry = node->slots[i];
+            if (entry.is_node()) {
+                if (auto found = find_mark_in(entry.node(), first, index, mark)) {
+                    return found;
+                }
+                continue;
+            }
+
+            return ustl::some(first);
+        }
+
+        return ustl::none();
+    }
+
+    TEMPLATE
+    auto XARRAY::find_mark(usize index, usize mark) const -> ustl::Option<usize> {
+        if (!head_.is_node()) {
+            return ustl::none();
+        }
+
+        auto const root = head_.node();
+        if ((index >> root->shift) >= kMaxSlots) {
+            return ustl::none();
+        }
+        return find_mark_in(root, 0, index, mark);
     }
 
 } // namespace ktl
 
 #undef TEMPLATE
-#undef XARRAY_CURSOR
\ No newline at end of file
+#undef XARRAY
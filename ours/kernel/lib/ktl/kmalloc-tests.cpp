@@ -0,0 +1,39 @@
+#include <ktl/kmalloc.hpp>
+
+#include <ours/mem/pmm.hpp>
+#include <ours/mem/memory_model.hpp>
+#include <ours/tests/test.hpp>
+#include <ours/assert.hpp>
+
+#include <gktl/init_hook.hpp>
+
+namespace ours::test {
+    /// A large request is served by a folio, whose head and order must be found from any
+    /// address in it, so `kfree` is able to take an interior pointer.
+    OTEST_ABI
+    static auto free_large_from_interior() -> void {
+        // 5 pages are rounded up to a folio of order 3.
+        CXX11_CONSTEXPR
+        static usize const kSize = PAGE_SIZE * 5;
+
+        CXX11_CONSTEXPR
+        static usize const kOrder = 3;
+
+        auto const object = static_cast<u8 *>(ktl::kmalloc(kSize, mem::kGafKernel));
+        DEBUG_ASSERT(object, "Out of memory");
+
+        auto const head = mem::virt_to_folio(object);
+        DEBUG_ASSERT(head->is_role(mem::PfRole::Heap), "Not a large allocation");
+        DEBUG_ASSERT(head->order() == kOrder, "Wrong order of a large allocation");
+
+        for (usize i = 1; i < BIT(kOrder); ++i) {
+            auto const folio = mem::virt_to_folio(object + i * PAGE_SIZE + sizeof(usize));
+            DEBUG_ASSERT(folio == head, "A tail frame does not lead to the head");
+            DEBUG_ASSERT(folio->order() == kOrder, "Wrong order read from a tail frame");
+        }
+
+        ktl::kfree(object + kSize - 1);
+    }
+    GKTL_INIT_HOOK(KmallocLargeInteriorTest, free_large_from_interior, gktl::InitLevel::Platform);
+
+} // namespace ours::test
@@ -2,77 +2,205 @@
 
 #include <ours/mem/pmm.hpp>
 #include <ours/assert.hpp>
+#include <ours/cpu-local.hpp>
 #include <ours/mem/object-cache.hpp>
 
 #include <ours/platform/init.hpp>
 
 #include <ustl/bit.hpp>
+#include <ustl/mem/object.hpp>
+#include <ustl/util/move.hpp>
+#include <logz4/log.hpp>
+
+#include <iterator>
 
 using namespace ours::mem;
 
 namespace ktl {
+    /// Size classes are powers of two and 1.5x between them, so that internal waste of a
+    /// request is less than a third of the object.
     CXX11_CONSTEXPR
-    static auto const kNumMallocCaches = 10;
+    static usize const kMallocSizes[] = {
+        16,   24,   32,   48,   64,   96,   128,  192,   256,  384,
+        512,  768,  1024, 1536, 2048, 3072, 4096, 6144, 8192,
+    };
 
     CXX11_CONSTEXPR
-    static auto const kMallocMinOrder = 3;
+    static char const *const kMallocNames[] = {
+        "kmalloc-16",   "kmalloc-24",   "kmalloc-32",   "kmalloc-48",   "kmalloc-64",
+        "kmalloc-96",   "kmalloc-128",  "kmalloc-192",  "kmalloc-256",  "kmalloc-384",
+        "kmalloc-512",  "kmalloc-768",  "kmalloc-1k",   "kmalloc-1.5k", "kmalloc-2k",
+        "kmalloc-3k",   "kmalloc-4k",   "kmalloc-6k",   "kmalloc-8k",
+    };
 
     CXX11_CONSTEXPR
-    static auto const kMinMallocSize= sizeof(usize);
+    static auto const kNumMallocCaches = std::size(kMallocSizes);
+    static_assert(std::size(kMallocNames) == kNumMallocCaches);
 
     CXX11_CONSTEXPR
-    static auto const kMaxMallocSize= BIT(kNumMallocCaches + kMallocMinOrder);
+    static auto const kMaxMallocSize = kMallocSizes[kNumMallocCaches - 1];
 
-    static auto get_allocation_index(usize size) -> usize {
-        if (!size) {
-            return 0;
-        }
-    
-        if (size <= kMaxMallocSize) {
-            return ustl::bit_width<usize>(size - 1) - kMallocMinOrder;
+    /// Every size class is a multiple of it.
+    CXX11_CONSTEXPR
+    static auto const kMallocGranularity = 8;
+
+    /// Map a size rounded up to |kMallocGranularity| to its class, one byte per entry.
+    CXX11_CONSTEXPR
+    static auto const kSizeIndex = [] () {
+        ustl::Array<u8, kMaxMallocSize / kMallocGranularity + 1> table{};
+        usize index = 0;
+        for (usize i = 0; i < table.size(); ++i) {
+            while (i * kMallocGranularity > kMallocSizes[index]) {
+                index += 1;
+            }
+            table[i] = u8(index);
         }
+        return table;
+    }();
 
-        DEBUG_ASSERT(false, "Unreachable");
+    FORCE_INLINE CXX11_CONSTEXPR
+    static auto get_allocation_index(usize size) -> usize {
+        return kSizeIndex[(size + kMallocGranularity - 1) / kMallocGranularity];
     }
+    static_assert(get_allocation_index(0) == 0);
+    static_assert(get_allocation_index(17) == 1);
+    static_assert(get_allocation_index(1025) == 13);
+    static_assert(get_allocation_index(kMaxMallocSize) == kNumMallocCaches - 1);
+
+    /// Counters of each class, requests beyond `kMaxMallocSize` are counted in the last.
+    /// They are kept on each cpu and not updated atomically, a few missing counts on
+    /// racing with interrupts are tolerable.
+    struct MallocStats {
+        usize nr_allocs[kNumMallocCaches + 1];
+        usize nr_frees[kNumMallocCaches + 1];
+        usize nr_fails[kNumMallocCaches + 1];
+        /// Sum of sizes requested, compared with `nr_allocs` it tells the internal waste.
+        usize nr_requested[kNumMallocCaches + 1];
+    };
+
+    CXX11_CONSTEXPR
+    static auto const kLargeIndex = kNumMallocCaches;
 
     static ustl::Array<ObjectCache, kNumMallocCaches>  s_kmalloc_cache;
+    static ours::PerCpu<MallocStats> s_kmalloc_stats;
 
-    auto kmalloc(usize size, Gaf gaf, NodeId nid) -> void * {
-        if (size > kMaxMallocSize) {
-            // Now we do not support to allocate frames from kmalloc
+    FORCE_INLINE
+    static auto account(usize index, usize size, bool ok) -> void {
+        if (!s_kmalloc_stats) {
+            return;
+        }
+
+        s_kmalloc_stats.with_current([index, size, ok] (MallocStats &stats) {
+            if (!ok) {
+                stats.nr_fails[index] += 1;
+                return;
+            }
+            stats.nr_allocs[index] += 1;
+            stats.nr_requested[index] += size;
+        });
+    }
+
+    /// Serve a request from PMM directly, the order is kept in the frame descriptor.
+    static auto kmalloc_large(usize size, Gaf gaf, NodeId nid) -> void * {
+        auto const order = ustl::bit_width<usize>((size - 1) >> PAGE_SHIFT);
+        if (order > MAX_FRAME_ORDER) {
             return nullptr;
         }
+
+        // A folio lets `kfree` find the head from any address in it.
+        auto const frame = alloc_frame(nid, gaf | Gaf::Folio, order);
+        if (!frame) {
+            return nullptr;
+        }
+        frame->set_order(order);
+        frame->set_role(PfRole::Heap);
+
+        return frame_to_virt<void>(frame);
+    }
+
+    auto kmalloc(usize size, Gaf gaf, NodeId nid) -> void * {
         if (nid == MAX_NODE) {
             nid = current_node();
         }
 
+        if (size > kMaxMallocSize) {
+            auto const object = kmalloc_large(size, gaf, nid);
+            account(kLargeIndex, size, object != nullptr);
+            return object;
+        }
+
         auto const index = get_allocation_index(size);
-        return s_kmalloc_cache[index].do_allocate(gaf, nid);
+        auto const object = s_kmalloc_cache[index].do_allocate(gaf, nid);
+        account(index, size, object != nullptr);
+        return object;
     }
 
     auto kmalloc(usize size, Gaf gaf) -> void * {
-        if (size > kMaxMallocSize) {
-            // Now we do not support to allocate frames from kmalloc
-            return nullptr;
+        return kmalloc(size, gaf, current_node());
+    }
+
+    auto kfree(void *object) -> void {
+        if (!object) {
+            return;
         }
 
-        auto const index = get_allocation_index(size);
-        return s_kmalloc_cache[index].do_allocate(gaf, current_node());
+        auto folio = virt_to_folio(object);
+        usize index;
+        if (folio->is_role(PfRole::Heap)) {
+            index = kLargeIndex;
+            free_frame(folio, folio->order());
+        } else {
+            auto slab = ours::mem::role_cast<PfRole::Slab>(folio);
+            DEBUG_ASSERT(slab && slab->object_cache);
+            index = get_allocation_index(slab->object_cache->object_size());
+            slab->object_cache->do_deallocate(slab, object);
+        }
+
+        if (s_kmalloc_stats) {
+            s_kmalloc_stats.with_current([index] (MallocStats &stats) {
+                stats.nr_frees[index] += 1;
+            });
+        }
     }
 
-    auto kfree(void *object) -> void {
-        auto slab = ours::mem::role_cast<PfRole::Slab>(virt_to_folio(object));
-        DEBUG_ASSERT(slab && slab->object_cache);
-        slab->object_cache->do_deallocate(slab, object);
+    auto dump_kmalloc_stats() -> void {
+        MallocStats total{};
+        s_kmalloc_stats.for_each([&total] (MallocStats &stats, ours::CpuNum) {
+            for (usize i = 0; i <= kNumMallocCaches; ++i) {
+                total.nr_allocs[i] += stats.nr_allocs[i];
+                total.nr_frees[i] += stats.nr_frees[i];
+                total.nr_fails[i] += stats.nr_fails[i];
+                total.nr_requested[i] += stats.nr_requested[i];
+            }
+        });
+
+        for (usize i = 0; i <= kNumMallocCaches; ++i) {
+            auto const name = i == kLargeIndex ? "kmalloc-large" : kMallocNames[i];
+            auto const nr_allocs = total.nr_allocs[i];
+            // Pages of large requests are not counted, they are rounded to an order.
+            auto const nr_wasted = i == kLargeIndex ? 0 : nr_allocs * kMallocSizes[i] - total.nr_requested[i];
+            log::info("{}: allocs={}, frees={}, fails={}, requested={}, wasted={}",
+                name, nr_allocs, total.nr_frees[i], total.nr_fails[i], total.nr_requested[i], nr_wasted
+            );
+        }
     }
 
     INIT_CODE
     auto init_kmalloc() -> void {
-        char name[16];
         for (auto i = 0; i < s_kmalloc_cache.size(); ++i) {
-            auto status = s_kmalloc_cache[i].init(name, BIT(i + kMallocMinOrder), alignof(usize), {});
+            auto status = s_kmalloc_cache[i].init(kMallocNames[i], kMallocSizes[i], alignof(usize), {});
             DEBUG_ASSERT(Status::Ok == status);
         }
+
+        auto stats = ours::CpuLocal::allocate<MallocStats>();
+        if (!stats) {
+            log::warn("Failed to allocate statistics of kmalloc");
+            return;
+        }
+        stats.for_each([] (MallocStats &local, ours::CpuNum) {
+            ustl::mem::construct_at(&local);
+        });
+        s_kmalloc_stats = ustl::move(stats);
     }
 
-} // namespace ours::mem
+} // namespace ktl
@@ -0,0 +1,186 @@
+#include <ktl/xarray.hpp>
+
+#include <gtest/gtest.h>
+
+#include <tuple>
+#include <vector>
+
+using namespace ours;
+
+/// Nodes come from the host heap, the number of live ones tells whether empty nodes are
+/// given back.
+template <typename T>
+struct HostAllocator {
+    template <typename U>
+    using RebindT = HostAllocator<U>;
+
+    static auto allocate(usize n) -> T * {
+        nr_live += n;
+        return new T[n]();
+    }
+
+    static auto deallocate(T *ptr, usize n) -> void {
+        nr_live -= n;
+        delete[] ptr;
+    }
+
+    static inline isize nr_live = 0;
+};
+
+struct XarrayTestFixture
+    : public testing::Test {
+    typedef ktl::Xarray<HostAllocator<char>>   Xarray;
+    typedef Xarray::Entry                      Entry;
+    typedef HostAllocator<Xarray::Node>        NodeAllocator;
+
+    static constexpr usize kMark = 1;
+
+    auto SetUp() -> void override {
+        NodeAllocator::nr_live = 0;
+    }
+
+    auto TearDown() -> void override {
+        xarray.clear();
+        ASSERT_EQ(NodeAllocator::nr_live, 0);
+    }
+
+    static auto value(usize n) -> Entry {
+        return Entry::from_value(n);
+    }
+
+    auto store(usize index, usize n, usize order = 0) -> void {
+        auto const result = xarray.store(index, value(n), order);
+        ASSERT_TRUE(result);
+        ASSERT_TRUE(result.unwrap().is_null());
+    }
+
+    /// Every index in [first, first + 2^order) must see entry |n| of |order| starting at
+    /// |first|, and the indices around must not.
+    auto expect_covered(usize first, usize order, usize n) -> void {
+        for (usize i = first; i < first + BIT(order); ++i) {
+            usize found_first, found_order;
+            auto const entry = xarray.lookup(i, &found_first, &found_order);
+            ASSERT_EQ(entry.raw, value(n).raw) << "index " << i;
+            ASSERT_EQ(found_first, first) << "index " << i;
+            ASSERT_EQ(found_order, order) << "index " << i;
+        }
+        if (first) {
+            ASSERT_NE(xarray.load(first - 1).raw, value(n).raw);
+        }
+        ASSERT_NE(xarray.load(first + BIT(order)).raw, value(n).raw);
+    }
+
+    Xarray xarray;
+};
+
+TEST_F(XarrayTestFixture, MultiOrderStoreErase) {
+    // Within a leaf, across a whole leaf, and spanning several leaves.
+    store(5, 1);
+    store(17, 2, 3);
+    store(64 * 3, 3, 6);
+    store(300, 4, 8);
+
+    expect_covered(5, 0, 1);
+    expect_covered(16, 3, 2);
+    expect_covered(64 * 3, 6, 3);
+    expect_covered(256, 8, 4);
+
+    // Anything overlapping an entry of another order is refused.
+    EXPECT_FALSE(xarray.store(20, value(5)));
+    EXPECT_FALSE(xarray.store(8, value(5), 4));
+    EXPECT_FALSE(xarray.store(260, value(5)));
+    EXPECT_FALSE(xarray.store(320, value(5), 6));
+    EXPECT_FALSE(xarray.store(0, value(5), 9));
+
+    // The same position and order is replaced in place.
+    auto const replaced = xarray.store(18, value(6), 3);
+    ASSERT_TRUE(replaced);
+    EXPECT_EQ(replaced.unwrap().raw, value(2).raw);
+    expect_covered(16, 3, 6);
+
+    // Erasing through any index of an entry removes all of it.
+    EXPECT_EQ(xarray.erase(23).raw, value(6).raw);
+    EXPECT_EQ(xarray.erase(400).raw, value(4).raw);
+    for (usize i = 16; i < 24; ++i) {
+        EXPECT_TRUE(xarray.load(i).is_null());
+    }
+    for (usize i = 256; i < 512; ++i) {
+        EXPECT_TRUE(xarray.load(i).is_null());
+    }
+    EXPECT_TRUE(xarray.erase(400).is_null());
+
+    // The space freed takes entries of other orders.
+    store(16, 7, 2);
+    store(20, 8, 2);
+    store(384, 9, 7);
+    expect_covered(16, 2, 7);
+    expect_covered(20, 2, 8);
+    expect_covered(384, 7, 9);
+
+    for (auto index : {5, 16, 20, 64 * 3, 384}) {
+        EXPECT_FALSE(xarray.erase(index).is_null());
+    }
+    EXPECT_TRUE(xarray.is_empty());
+    EXPECT_EQ(NodeAllocator::nr_live, 0);
+}
+
+TEST_F(XarrayTestFixture, SiblingLookup) {
+    store(8, 1, 2);
+    store(BIT(20) + 64, 2, 5);
+    store(BIT(20) + 4096, 3, 12);
+
+    // Every slot of a multi-order entry leads to the canonical one.
+    expect_covered(8, 2, 1);
+    expect_covered(BIT(20) + 64, 5, 2);
+    expect_covered(BIT(20) + 4096, 12, 3);
+
+    std::vector<std::tuple<usize, usize, usize>> seen;
+    xarray.for_each([&seen] (usize index, Entry entry, usize order) {
+        seen.emplace_back(index, entry.value(), order);
+    });
+
+    std::vector<std::tuple<usize, usize, usize>> const expected = {
+        {8, 1, 2},
+        {BIT(20) + 64, 2, 5},
+        {BIT(20) + 4096, 3, 12},
+    };
+    EXPECT_EQ(seen, expected);
+}
+
+TEST_F(XarrayTestFixture, MarkPropagation) {
+    store(3, 1);
+    store(64, 2, 3);
+    store(BIT(14) + 3, 3);
+
+    EXPECT_FALSE(xarray.find_mark(0, kMark));
+    EXPECT_FALSE(xarray.set_mark(1000, kMark));
+
+    // A deep entry is found from the root through the marks on the way.
+    ASSERT_TRUE(xarray.set_mark(BIT(14) + 3, kMark));
+    EXPECT_TRUE(xarray.get_mark(BIT(14) + 3, kMark));
+    EXPECT_FALSE(xarray.get_mark(BIT(14) + 3, kMark + 1));
+    EXPECT_EQ(xarray.find_mark(0, kMark), ustl::some(usize(BIT(14) + 3)));
+
+    // A mark set through any index of a multi-order entry is on the entry.
+    ASSERT_TRUE(xarray.set_mark(66, kMark));
+    EXPECT_TRUE(xarray.get_mark(71, kMark));
+    EXPECT_EQ(xarray.find_mark(0, kMark), ustl::some(usize(64)));
+    EXPECT_EQ(xarray.find_mark(67, kMark), ustl::some(usize(64)));
+    EXPECT_EQ(xarray.find_mark(72, kMark), ustl::some(usize(BIT(14) + 3)));
+
+    // Growing the tree keeps the marks reachable from the new root.
+    store(BIT(24), 4);
+    EXPECT_EQ(xarray.find_mark(0, kMark), ustl::some(usize(64)));
+
+    // Clearing the last mark below a node clears the way to it.
+    xarray.clear_mark(64, kMark);
+    EXPECT_FALSE(xarray.get_mark(64, kMark));
+    EXPECT_EQ(xarray.find_mark(0, kMark), ustl::some(usize(BIT(14) + 3)));
+
+    // Erasing an entry takes its marks along.
+    EXPECT_FALSE(xarray.erase(BIT(14) + 3).is_null());
+    EXPECT_FALSE(xarray.find_mark(0, kMark));
+    store(BIT(14) + 3, 3);
+    EXPECT_FALSE(xarray.get_mark(BIT(14) + 3, kMark));
+    EXPECT_FALSE(xarray.find_mark(0, kMark));
+}
@@ -267,6 +267,13 @@ namespace ours {
             return ustl::function::invoke(f, *CpuLocal::access(object));
         }
 
+        /// Visit the object on each possible cpu, |f| is invoked with (T &, CpuNum).
+        template <typename F>
+        FORCE_INLINE
+        auto for_each(F &&f) -> void {
+            CpuLocal::for_each(object, f);
+        }
+
         FORCE_INLINE CXX11_CONSTEXPR
         operator bool() {
             return object != nullptr;
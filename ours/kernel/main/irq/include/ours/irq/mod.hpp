@@ -59,6 +59,9 @@ namespace ours::irq {
 
     auto handle_irq_generic(VIrqNum irqnum) -> IrqReturn;
 
+    /// How deep the cpu |cpu| is in interrupt handlers, zero if it is in none.
+    auto irq_nesting(CpuNum cpu) -> usize;
+
     auto start_handling_irq() -> void;
 
     auto finish_handling_irq() -> bool;
@@ -7,7 +7,12 @@
 
 #include <ktl/new.hpp>
 
+#include <ustl/sync/atomic.hpp>
+
 namespace ours::irq {
+    CPU_LOCAL
+    static ustl::sync::AtomicUsize s_irq_nesting;
+
     FORCE_INLINE
     static auto get_irq_dispatcher() -> IrqDispatcher * {
         static IrqDispatcher g_irq_dispatcher;
@@ -34,11 +39,17 @@ namespace ours::irq {
         return get_irq_dispatcher()->handle_irq(virqnum);
     }
 
+    auto irq_nesting(CpuNum cpu) -> usize {
+        return CpuLocal::access(&s_irq_nesting, cpu)->load(ustl::sync::MemoryOrder::Acquire);
+    }
+
     auto start_handling_irq() -> void {
         task::Thread::Current::preemption_state().disable_preemption();
+        CpuLocal::access(&s_irq_nesting)->fetch_add(1, ustl::sync::MemoryOrder::AcqRel);
     }
 
     auto finish_handling_irq() -> bool {
+        CpuLocal::access(&s_irq_nesting)->fetch_sub(1, ustl::sync::MemoryOrder::Release);
         task::Thread::Current::preemption_state().enable_preemption();
         return task::Thread::Current::preemption_state().is_preemptible();
     }
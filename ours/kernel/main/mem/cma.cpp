@@ -0,0 +1,252 @@
+#include <ours/mem/cma.hpp>
+#include <ours/mem/early-mem.hpp>
+#include <ours/mem/pm_node.hpp>
+#include <ours/mem/reclaim.hpp>
+#include <ours/mem/physmap.hpp>
+#include <ours/mem/pmm.hpp>
+
+#include <ours/cpu-local.hpp>
+#include <ours/task/thread.hpp>
+
+#include <ustl/bit.hpp>
+#include <ustl/mem/align.hpp>
+#include <ustl/mem/object.hpp>
+#include <ustl/sync/lockguard.hpp>
+#include <ustl/algorithms/minmax.hpp>
+#include <ustl/algorithms/generation.hpp>
+
+#include <logz4/log.hpp>
+
+namespace ours::mem {
+    CXX11_CONSTEXPR
+    static usize const kBitsPerWord = sizeof(usize) << 3;
+
+    /// How long a contiguous request sleeps once to wait for borrowers.
+    CXX11_CONSTEXPR
+    static auto const kCmaWaitTime = ustl::chrono::Milliseconds(10);
+
+    INIT_CODE
+    auto CmaArea::create(NodeId nid, usize size) -> Self * {
+        auto const [node_start_pfn, node_end_pfn] = EarlyMem::get_pfn_range_node(nid);
+        // Never take more than an eighth of the node.
+        auto const nr_frames = ustl::mem::align_down(
+            ustl::algorithms::min<usize>(size >> PAGE_SHIFT, (node_end_pfn - node_start_pfn) >> 3),
+            BIT(MAX_FRAME_ORDER)
+        );
+        if (!nr_frames) {
+            return nullptr;
+        }
+
+        // Aligned to the largest block, so frames lent out never straddle the boundary. It
+        // must lie in the part initialized at boot since frames are lent out at once.
+        auto const base = EarlyMem::allocate<u8>(
+            nr_frames << PAGE_SHIFT,
+            AlignVal(PAGE_SIZE << MAX_FRAME_ORDER),
+            EarlyMem::min_address(),
+            pfn_to_phys(PmNode::node(nid)->deferred_frames().start_pfn()),
+            nid
+        );
+        if (!base) {
+            return nullptr;
+        }
+
+        auto const nr_words = (nr_frames + kBitsPerWord - 1) / kBitsPerWord;
+        auto const bitmap = EarlyMem::allocate<usize>(nr_words, nid);
+        auto const self = EarlyMem::allocate<Self>(1, nid);
+        if (!bitmap || !self) {
+            log::error("Node[{}]: No memory for the descriptor of CMA", nid);
+            return nullptr;
+        }
+        ustl::algorithms::fill_n(bitmap, nr_words, 0);
+
+        auto const base_pfn = phys_to_pfn(PhysMap::virt_to_phys(base));
+        return ustl::mem::construct_at(self, nid, base_pfn, nr_frames, bitmap);
+    }
+
+    CmaArea::CmaArea(NodeId nid, Pfn base_pfn, usize nr_frames, usize *bitmap)
+        : nid_(nid),
+          base_pfn_(base_pfn),
+          nr_frames_(nr_frames),
+          nr_lent_(),
+          nr_allocated_(),
+          lend_hint_(nr_frames >> 1),
+          bitmap_(bitmap),
+          mutex_()
+    {}
+
+    FORCE_INLINE
+    auto CmaArea::test_bit(usize i) const -> bool {
+        return bitmap_[i / kBitsPerWord] & BIT(i % kBitsPerWord);
+    }
+
+    auto CmaArea::set_range(usize start, usize n, bool value) -> void {
+        for (auto i = start; i < start + n; ++i) {
+            if (value) {
+                bitmap_[i / kBitsPerWord] |= BIT(i % kBitsPerWord);
+            } else {
+                bitmap_[i / kBitsPerWord] &= ~usize(BIT(i % kBitsPerWord));
+            }
+        }
+    }
+
+    auto CmaArea::find_free_run(usize from, usize to, usize n, usize align) const -> usize {
+        // Alignment is of physical address, not of the index.
+        auto start = ustl::mem::align_up(base_pfn_ + from, align) - base_pfn_;
+        while (start + n <= to) {
+            auto i = start;
+            while (i < start + n && !test_bit(i)) {
+                ++i;
+            }
+            if (i == start + n) {
+                return start;
+            }
+            // Skip the frame in use, nothing before it could be the start.
+            start = ustl::mem::align_up(base_pfn_ + i + 1, align) - base_pfn_;
+        }
+
+        return nr_frames_;
+    }
+
+    auto CmaArea::lend(usize order) -> PmFrame * {
+        ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+
+        auto const n = BIT(order);
+        auto i = find_free_run(lend_hint_, nr_frames_, n, n);
+        if (i >= nr_frames_) {
+            i = find_free_run(0, nr_frames_, n, n);
+            if (i >= nr_frames_) {
+                return nullptr;
+            }
+        }
+
+        set_range(i, n, true);
+        nr_lent_ += n;
+        lend_hint_ = i + n;
+
+        auto frame = pfn_to_frame(base_pfn_ + i);
+        frame->set_order(order);
+        return frame;
+    }
+
+    auto CmaArea::give_back(PmFrame *frame, usize order) -> void {
+        DEBUG_ASSERT(contains(frame), "");
+        ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+
+        auto const i = frame_to_pfn(frame) - base_pfn_;
+        set_range(i, BIT(order), false);
+        nr_lent_ -= BIT(order);
+        frame->set_role(PfRole::None);
+    }
+
+    auto CmaArea::alloc_contiguous(usize nr_frames, usize align_frames) -> PmFrame * {
+        ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+
+        auto const i = find_free_run(0, nr_frames_, nr_frames, align_frames);
+        if (i >= nr_frames_) {
+            return nullptr;
+        }
+
+        set_range(i, nr_frames, true);
+        nr_allocated_ += nr_frames;
+        return pfn_to_frame(base_pfn_ + i);
+    }
+
+    auto CmaArea::free_contiguous(PmFrame *frame, usize nr_frames) -> void {
+        DEBUG_ASSERT(contains(frame), "");
+        ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+
+        auto const i = frame_to_pfn(frame) - base_pfn_;
+        set_range(i, nr_frames, false);
+        nr_allocated_ -= nr_frames;
+    }
+
+    auto CmaArea::dump() const -> void {
+        log::info("Node[{}] CMA: [0x{:X}, 0x{:X}), lent: {}, allocated: {}",
+            nid_,
+            pfn_to_phys(base_pfn_),
+            pfn_to_phys(base_pfn_ + nr_frames_),
+            nr_lent_,
+            nr_allocated_
+        );
+    }
+
+    /// Small requests are served by buddy if the block it gives out happens to be aligned.
+    static auto alloc_contiguous_buddy(usize nr_frames, usize align_frames, NodeId nid) -> PmFrame * {
+        auto const order = num_to_order(nr_frames);
+        if (order > MAX_FRAME_ORDER) {
+            return nullptr;
+        }
+
+        auto const frame = alloc_frame(nid, kGafKernel, order);
+        if (frame && frame_to_pfn(frame) % align_frames) {
+            free_frame(frame, order);
+            return nullptr;
+        }
+
+        return frame;
+    }
+
+    auto alloc_contiguous(usize size, usize align, NodeId nid) -> PmFrame * {
+        auto const nr_frames = ustl::mem::align_up(size, PAGE_SIZE) >> PAGE_SHIFT;
+        auto const align_frames = ustl::algorithms::max<usize>(align, PAGE_SIZE) >> PAGE_SHIFT;
+        if (!nr_frames || !ustl::has_single_bit(align_frames)) {
+            return nullptr;
+        }
+
+        if (auto frame = alloc_contiguous_buddy(nr_frames, align_frames, nid)) {
+            return frame;
+        }
+
+        auto const node = nid < MAX_NODE ? PmNode::node(nid) : CpuLocal::access<PmNode>();
+        auto const cma = node ? node->cma() : nullptr;
+        if (!cma || nr_frames > cma->nr_frames()) {
+            log::warn("Node[{}]: No CMA area could serve {} frames", nid, nr_frames);
+            return nullptr;
+        }
+
+        for (usize retries = 0; retries < CmaArea::kMaxRetries; ++retries) {
+            if (auto frame = cma->alloc_contiguous(nr_frames, align_frames)) {
+                return frame;
+            }
+
+            // Frames lent out are in the way. Ask their holders to give some back, then
+            // wait for borrowers to return them.
+            reclaim_frames(node->nid(), cma->nr_lent());
+            task::Thread::Current::sleep_for(kCmaWaitTime, false);
+        }
+
+        log::warn("Node[{}]: Failed to allocate {} contiguous frames", node->nid(), nr_frames);
+        return nullptr;
+    }
+
+    auto free_contiguous(PmFrame *frame, usize size) -> void {
+        DEBUG_ASSERT(frame, "");
+        auto const nr_frames = ustl::mem::align_up(size, PAGE_SIZE) >> PAGE_SHIFT;
+
+        auto const cma = PmNode::node(frame->nid())->cma();
+        if (cma && cma->contains(frame)) {
+            cma->free_contiguous(frame, nr_frames);
+        } else {
+            free_frame(frame, num_to_order(nr_frames));
+        }
+    }
+
+    INIT_CODE
+    auto init_cma() -> void {
+        if (!CMA_SIZE) {
+            return;
+        }
+
+        global_node_states().for_each_state(NodeStates::Memory, [] (NodeId nid) {
+            auto const cma = CmaArea::create(nid, CMA_SIZE);
+            if (!cma) {
+                log::warn("Node[{}]: Failed to reserve CMA area", nid);
+                return;
+            }
+
+            PmNode::node(nid)->set_cma(cma);
+            cma->dump();
+        });
+    }
+
+} // namespace ours::mem
@@ -0,0 +1,238 @@
+#include <ours/mem/deferred_frames.hpp>
+#include <ours/mem/early-mem.hpp>
+#include <ours/mem/memory_model.hpp>
+#include <ours/mem/pm_node.hpp>
+#include <ours/mem/pm_zone.hpp>
+
+#include <ours/task/thread.hpp>
+
+#include <ustl/limits.hpp>
+#include <ustl/mem/align.hpp>
+#include <ustl/sync/lockguard.hpp>
+#include <ustl/algorithms/minmax.hpp>
+
+#include <logz4/log.hpp>
+#include <gktl/init_hook.hpp>
+
+using ustl::algorithms::min;
+using ustl::algorithms::max;
+
+namespace ours::mem {
+    /// Collect the parts of regions of |type| on |nid| beyond |boundary|. |slack| entries
+    /// are reserved since the allocation of the array itself may split a region.
+    INIT_CODE
+    static auto collect_ranges(bootmem::RegionType type, NodeId nid, Pfn boundary, usize slack)
+        -> ustl::views::Span<gktl::Range<Pfn>> {
+        usize n = 0;
+        EarlyMem::IterationContext counter(type, nid);
+        while (auto region = EarlyMem::iterate(counter)) {
+            if (phys_to_pfn(region->end()) > boundary) {
+                n += 1;
+            }
+        }
+        if (!n) {
+            return {};
+        }
+
+        auto const ranges = EarlyMem::allocate<gktl::Range<Pfn>>(n + slack, nid);
+        if (!ranges) {
+            return {};
+        }
+
+        usize i = 0;
+        EarlyMem::IterationContext context(type, nid);
+        while (auto region = EarlyMem::iterate(context)) {
+            auto const start = max(phys_to_pfn(ustl::mem::align_up(region->base, PAGE_SIZE)), boundary);
+            auto const end = phys_to_pfn(region->end());
+            if (start < end && i < n + slack) {
+                ranges[i++] = { start, end };
+            }
+        }
+
+        return { ranges, i };
+    }
+
+    INIT_CODE
+    auto DeferredFrames::init(NodeId nid, Pfn start, Pfn end) -> void {
+        start_pfn_ = end_pfn_ = end;
+        next_pfn_.store(end, ustl::sync::MemoryOrder::Relaxed);
+        if (!DEFERRED_EARLY_SIZE) {
+            return;
+        }
+
+        // Move the boundary into the first region reaching beyond it.
+        auto boundary = ustl::mem::align_up(start + (DEFERRED_EARLY_SIZE >> PAGE_SHIFT), kFramesPerStep);
+        auto found = false;
+        EarlyMem::IterationContext context(bootmem::RegionType::Normal, nid);
+        while (auto region = EarlyMem::iterate(context)) {
+            auto const region_start = phys_to_pfn(region->base);
+            auto const region_end = phys_to_pfn(region->end());
+            if (boundary <= region_start) {
+                boundary = ustl::mem::align_up(region_start + 1, kFramesPerStep);
+            }
+            if (boundary < region_end) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            return;
+        }
+
+        present_ranges_ = collect_ranges(bootmem::RegionType::Normal, nid, boundary, 0);
+        if (present_ranges_.empty()) {
+            log::warn("Node[{}]: No memory to defer initialization of frames", nid);
+            return;
+        }
+
+        start_pfn_ = boundary;
+        next_pfn_.store(boundary, ustl::sync::MemoryOrder::Relaxed);
+        log::info("Node[{}]: Frames in [0x{:X}, 0x{:X}) are initialized later", nid, start_pfn_, end_pfn_);
+    }
+
+    INIT_CODE
+    auto DeferredFrames::collect_free_ranges(NodeId nid) -> void {
+        if (start_pfn_ == end_pfn_) {
+            return;
+        }
+
+        free_ranges_ = collect_ranges(bootmem::RegionType::Unused, nid, start_pfn_, 1);
+
+        // Of all frames beyond the boundary, buddy may only meet the first one as the buddy
+        // of a block freed below the boundary, before the worker comes.
+        pfn_to_frame(start_pfn_)->set_role(PfRole::None);
+    }
+
+    auto DeferredFrames::is_present(Pfn pfn) const -> bool {
+        for (auto const &range : present_ranges_) {
+            if (range.contains(pfn)) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    auto PmNode::init_deferred_step() -> usize {
+        auto &deferred = deferred_frames_;
+        auto const start = deferred.next_pfn_.load(ustl::sync::MemoryOrder::Relaxed);
+        if (start >= deferred.end_pfn_) {
+            return 0;
+        }
+        auto const end = min(start + DeferredFrames::kFramesPerStep, deferred.end_pfn_);
+
+        PmZone *zone = nullptr;
+        for (auto pfn = start; pfn < end; ++pfn) {
+            if (!global_memory_model().exist(pfn)) {
+                continue;
+            }
+
+            if (!zone || pfn >= zone->start_pfn() + zone->spanned_frames()) {
+                for (auto z : zone_queues_.get_queue(ZoneQueues::LocalContiguous)) {
+                    if (pfn >= z->start_pfn() && pfn < z->start_pfn() + z->spanned_frames()) {
+                        zone = z;
+                        break;
+                    }
+                }
+            }
+
+            auto frame = pfn_to_frame(pfn);
+            frame->init(zone ? zone->zone_type() : ZoneType::Normal, pfn_to_secnum(pfn), id_);
+            if (!deferred.is_present(pfn)) {
+                frame->mark_reserved();
+            }
+        }
+
+        // The same as above, keep buddy away from the next step.
+        if (end < deferred.end_pfn_ && global_memory_model().exist(end)) {
+            pfn_to_frame(end)->set_role(PfRole::None);
+        }
+
+        usize nr_freed = 0;
+        for (auto const &range : deferred.free_ranges_) {
+            auto pfn = max(range.start, start);
+            auto const last = min(range.end, end);
+            while (pfn < last) {
+                usize order = MAX_FRAME_ORDER;
+                while (pfn + BIT(order) > last || (pfn & (BIT(order) - 1))) {
+                    order -= 1;
+                }
+
+                free_frame(pfn_to_frame(pfn), order);
+                pfn += BIT(order);
+                nr_freed += BIT(order);
+            }
+        }
+
+        deferred.next_pfn_.store(end, ustl::sync::MemoryOrder::Release);
+        return nr_freed;
+    }
+
+    auto PmNode::grow_deferred_frames(usize nr_frames) -> usize {
+        if (!deferred_frames_.pending()) {
+            return 0;
+        }
+
+        ustl::sync::LockGuard<decltype(deferred_frames_.mutex_)> guard(deferred_frames_.mutex_);
+        usize nr_freed = 0;
+        while (nr_freed < nr_frames && deferred_frames_.pending()) {
+            nr_freed += init_deferred_step();
+        }
+
+        return nr_freed;
+    }
+
+    auto PmNode::deferred_init_routine() -> i32 {
+        log::trace("Node[{}]: frameinit is running", id_);
+        while (deferred_frames_.pending()) {
+            grow_deferred_frames(DeferredFrames::kFramesPerStep);
+        }
+
+        // Water marks were computed from the early part only.
+        for (auto zone : zone_queues_.get_queue(ZoneQueues::LocalContiguous)) {
+            zone->init_watermarks();
+        }
+
+        log::info("Node[{}]: All frames in [0x{:X}, 0x{:X}) are initialized",
+            id_,
+            deferred_frames_.start_pfn(),
+            deferred_frames_.end_pfn()
+        );
+        return 0;
+    }
+
+    auto PmNode::start_deferred_init() -> Status {
+        if (!deferred_frames_.pending()) {
+            return Status::Ok;
+        }
+
+        auto const thread = task::Thread::spawn("frameinit", 0, &Self::deferred_init_routine, this);
+        if (!thread) {
+            return Status::OutOfMem;
+        }
+        // Initialize frames on the CPUs close to them.
+        if (native_cpus_.any()) {
+            thread->set_cpu_affinity(native_cpus_);
+        }
+        thread->detach();
+        thread->resume();
+
+        return Status::Ok;
+    }
+
+    /// Workers of all nodes run in parallel, an allocation finding its node short of frames
+    /// grows the initialized part by itself before they finish.
+    INIT_CODE
+    static auto init_deferred_frames() -> void {
+        global_node_states().for_each_state(NodeStates::Memory, [] (NodeId nid) {
+            auto const status = PmNode::node(nid)->start_deferred_init();
+            if (Status::Ok != status) {
+                log::error("Node[{}]: Failed to start frameinit, reason: {}", nid, to_string(status));
+                // Nothing else would do it.
+                PmNode::node(nid)->grow_deferred_frames(ustl::NumericLimits<usize>::max());
+            }
+        });
+    }
+    GKTL_INIT_HOOK(DeferredFramesInit, init_deferred_frames, gktl::InitLevel::Arch);
+
+} // namespace ours::mem
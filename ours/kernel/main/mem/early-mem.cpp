@@ -2,6 +2,7 @@
 #include <ours/mem/pmm.hpp>
 #include <ours/mem/memory_model.hpp>
 #include <ours/mem/vmm.hpp>
+#include <ours/mem/pm_node.hpp>
 #include <ours/phys/handoff.hpp>
 
 #include <logz4/log.hpp>
@@ -54,8 +55,9 @@ namespace ours::mem {
     INIT_CODE
     static auto free_frames_pfn_range(Pfn start, Pfn end) -> void {
         while (start < end) {
+            // Blocks must be aligned to their order, or buddy could not find their buddies.
             usize order = MAX_FRAME_ORDER;
-            while (start + BIT(order) > end) {
+            while (start + BIT(order) > end || (start & (BIT(order) - 1))) {
                 order -= 1;
             }
 
@@ -75,9 +77,15 @@ namespace ours::mem {
 
     INIT_CODE
     static auto free_unused_memory() -> void {
+        // Unused memory in the deferred part of nodes is handed over by their workers.
+        global_node_states().for_each_state(NodeStates::Memory, [] (NodeId nid) {
+            PmNode::node(nid)->deferred_frames().collect_free_ranges(nid);
+        });
+
         EarlyMem::IterationContext context(bootmem::RegionType::Unused, MAX_NODE);
         while (auto region = EarlyMem::iterate(context)) {
-            free_frames_phys_range(region->base, region->end());
+            auto const end = PmNode::node(region->nid())->deferred_frames().clip_early(region->base, region->end());
+            free_frames_phys_range(region->base, end);
         }
     }
 
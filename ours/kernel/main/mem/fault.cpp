@@ -12,8 +12,6 @@ namespace ours::mem {
         // 3. Locate the VmRootArea that address belong to.
         // 4. If no VmRootArea found, checks if the stack overflows.
         VmAspace *aspace = task::Thread::Current::aspace();
-        aspace->fault(addr, cause);
-
-        return Status::Ok;
+        return aspace->fault(addr, cause);
     }
 }
\ No newline at end of file
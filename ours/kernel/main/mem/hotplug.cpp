@@ -0,0 +1,373 @@
+#include <ours/mem/hotplug.hpp>
+#include <ours/mem/memory_model.hpp>
+#include <ours/mem/pm_node.hpp>
+#include <ours/mem/pm_zone.hpp>
+#include <ours/mem/physmap.hpp>
+#include <ours/mem/reclaim.hpp>
+
+#include <ours/task/thread.hpp>
+
+#include <ustl/mem/align.hpp>
+#include <ustl/sync/mutex.hpp>
+#include <ustl/sync/lockguard.hpp>
+#include <ustl/algorithms/minmax.hpp>
+#include <ustl/algorithms/generation.hpp>
+
+#include <logz4/log.hpp>
+
+using ustl::algorithms::min;
+using ustl::algorithms::max;
+
+namespace ours::mem {
+    /// Bounds the time `offline_memory` spends waiting for frames in use.
+    CXX11_CONSTEXPR
+    static usize const kMaxOfflineRetries = 8;
+
+    CXX11_CONSTEXPR
+    static auto const kOfflineWaitTime = ustl::chrono::Milliseconds(10);
+
+    CXX11_CONSTEXPR
+    static usize const kFramesPerSection = MemoryModel::kFramesPerLevel[0];
+
+    /// Serializes adding, onlining, offlining and removing of memory.
+    static ustl::sync::Mutex s_hotplug_mutex;
+
+    /// Make |frame| look like it comes from a zeroed frame map.
+    FORCE_INLINE
+    static auto reset_frame(PmFrame *frame, ZoneType ztype, SecNum secnum, NodeId nid) -> void {
+        ustl::algorithms::fill_n(reinterpret_cast<u8 *>(frame), sizeof(PmFrame), 0);
+        frame->init(ztype, secnum, nid);
+    }
+
+    /// How many frames at the head of the section hold its own frame map.
+    FORCE_INLINE
+    static auto nr_map_frames(SecNum secnum) -> usize {
+        auto const section = global_memory_model().secnum_to_section(secnum);
+        auto const map = PhysMap::phys_to_virt<PmFrame>(secnum_to_phys(secnum));
+        return section->frame_map().data() == map ? MemoryModel::kHotMapFrames : 0;
+    }
+
+    template <typename Spanned>
+    FORCE_INLINE
+    static auto grow_span(Pfn &base, Spanned &spanned, Pfn start, Pfn end) -> void {
+        if (!spanned) {
+            base = start;
+            spanned = end - start;
+            return;
+        }
+
+        auto const new_start = min<Pfn>(base, start);
+        auto const new_end = max<Pfn>(base + spanned, end);
+        base = new_start;
+        spanned = new_end - new_start;
+    }
+
+    /// Holes in the middle of a span are left as they are.
+    template <typename Spanned>
+    FORCE_INLINE
+    static auto shrink_span(Pfn &base, Spanned &spanned, Pfn start, Pfn end) -> void {
+        auto const old_end = base + spanned;
+        if (start <= base && end >= old_end) {
+            spanned = 0;
+        } else if (start <= base) {
+            spanned = old_end - end;
+            base = end;
+        } else if (end >= old_end) {
+            spanned = start - base;
+        }
+    }
+
+    auto MemoryModel::hot_add_section(SecNum secnum, NodeId nid) -> Status {
+        // It may be covered by a section of higher level.
+        if (secnum_to_section(secnum)) {
+            return Status::AlreadyExists;
+        }
+
+        auto result = init_index(0, secnum, nid);
+        if (result.is_err()) {
+            return result.unwrap_err();
+        }
+        auto const section = result.unwrap();
+
+        auto const map = PhysMap::phys_to_virt<PmFrame>(secnum_to_phys(secnum));
+        for (usize i = 0; i < kFramesPerLevel[0]; ++i) {
+            reset_frame(&map[i], ZoneType::Normal, secnum, nid);
+            map[i].mark_reserved();
+        }
+        section->set_map(map);
+        section->mark_present();
+
+        return Status::Ok;
+    }
+
+    auto MemoryModel::hot_remove_section(SecNum secnum) -> Status {
+        auto const section = secnum_to_section(secnum);
+        if (!section) {
+            return Status::NotFound;
+        }
+        if (section->is_online()) {
+            return Status::BadState;
+        }
+
+        // Frame maps set up at boot live elsewhere and can not be given back.
+        if (section->level() || !nr_map_frames(secnum)) {
+            return Status::Unsupported;
+        }
+
+        section->set_map(nullptr);
+        section->set_state(PmSection::State::None);
+        return Status::Ok;
+    }
+
+    /// Free [pfn, end) to |zone| in the largest aligned blocks.
+    static auto free_pfn_range(PmZone *zone, Pfn pfn, Pfn end) -> void {
+        while (pfn < end) {
+            usize order = MAX_FRAME_ORDER;
+            while (pfn + BIT(order) > end || (pfn & (BIT(order) - 1))) {
+                order -= 1;
+            }
+
+            zone->free_frame(pfn_to_frame(pfn), order);
+            pfn += BIT(order);
+        }
+    }
+
+    auto PmNode::online_range(Pfn start, Pfn end) -> Status {
+        auto const zone = zone_queues_.get_local_zone(ZoneType::Normal);
+        if (!zone) {
+            return Status::Unsupported;
+        }
+
+        auto &model = global_memory_model();
+        for (auto pfn = start; pfn < end; pfn += kFramesPerSection) {
+            auto const section = model.pfn_to_section(pfn);
+            if (!section || section->is_online()) {
+                return Status::BadState;
+            }
+            if (pfn_to_frame(pfn)->nid() != id_) {
+                return Status::InvalidArguments;
+            }
+        }
+
+        // Reset frames are in movable pageblocks, since `MigrateType::Movable` is zero.
+        usize nr_frames = 0;
+        for (auto pfn = start; pfn < end; pfn += kFramesPerSection) {
+            auto const secnum = pfn_to_secnum(pfn);
+            for (auto i = pfn + nr_map_frames(secnum); i < pfn + kFramesPerSection; ++i) {
+                reset_frame(pfn_to_frame(i), zone->zone_type(), secnum, id_);
+                nr_frames += 1;
+            }
+        }
+
+        // Spans grow first, so frames are found within their zone once freed.
+        grow_span(zone->start_pfn_, zone->spanned_frames_, start, end);
+        grow_span(start_pfn_, spanned_frames_, start, end);
+        zone->present_frames_ += nr_frames;
+        present_frames_ += nr_frames;
+        model.mark_section(pfn_to_secnum(start), pfn_to_secnum(end), PmSection::State::Online);
+
+        for (auto pfn = start; pfn < end; pfn += kFramesPerSection) {
+            free_pfn_range(zone, pfn + nr_map_frames(pfn_to_secnum(pfn)), pfn + kFramesPerSection);
+        }
+        zone->init_watermarks();
+        set_node_state(id_, NodeStates::Memory, true);
+
+        return Status::Ok;
+    }
+
+    auto PmNode::offline_range(Pfn start, Pfn end) -> Status {
+        auto const zone = zone_queues_.get_local_zone(ZoneType::Normal);
+        if (!zone) {
+            return Status::Unsupported;
+        }
+
+        auto &model = global_memory_model();
+        for (auto pfn = start; pfn < end; pfn += kFramesPerSection) {
+            auto const section = model.pfn_to_section(pfn);
+            if (!section || !section->is_online()) {
+                return Status::BadState;
+            }
+        }
+
+        if (deferred_frames_.pending() && start < deferred_frames_.end_pfn() && end > deferred_frames_.start_pfn()) {
+            return Status::ShouldRetry;
+        }
+
+        // Reserved and pinned frames never go back to the allocator, give up at once.
+        usize nr_target = 0;
+        for (auto pfn = start; pfn < end; pfn += kFramesPerSection) {
+            for (auto i = pfn + nr_map_frames(pfn_to_secnum(pfn)); i < pfn + kFramesPerSection; ++i) {
+                auto const frame = pfn_to_frame(i);
+                if (frame->is_reserved() || frame->is_pinned()) {
+                    return Status::BadState;
+                }
+                if (frame->nid() != id_ || frame->zone() != zone->zone_type()) {
+                    return Status::InvalidArguments;
+                }
+                nr_target += 1;
+            }
+        }
+
+        FrameList<> isolated;
+        usize nr_isolated = 0;
+        for (usize retries = 0; ; ++retries) {
+            // Only the cache of this CPU can be drained from here, the others drain by
+            // themselves as frames are freed on them.
+            zone->drain_pcpu_cache();
+
+            auto const n = zone->fset_.isolate_range(start, end, isolated);
+            zone->managed_frames_ -= n;
+            nr_isolated += n;
+            if (nr_isolated == nr_target || retries == kMaxOfflineRetries) {
+                break;
+            }
+
+            reclaim_frames(id_, nr_target - nr_isolated);
+            task::Thread::Current::sleep_for(kOfflineWaitTime, false);
+        }
+
+        if (nr_isolated != nr_target) {
+            zone->fset_.release_frames(isolated);
+            zone->managed_frames_ += nr_isolated;
+            log::warn("Node[{}]: {} frames in [0x{:X}, 0x{:X}) are still in use",
+                id_, nr_target - nr_isolated, start, end
+            );
+            return Status::ShouldRetry;
+        }
+        isolated.clear();
+
+        model.mark_section(pfn_to_secnum(start), pfn_to_secnum(end), PmSection::State::Present);
+        for (auto pfn = start; pfn < end; pfn += kFramesPerSection) {
+            auto const secnum = pfn_to_secnum(pfn);
+            for (auto i = pfn + nr_map_frames(secnum); i < pfn + kFramesPerSection; ++i) {
+                auto const frame = pfn_to_frame(i);
+                reset_frame(frame, zone->zone_type(), secnum, id_);
+                frame->mark_reserved();
+            }
+        }
+
+        shrink_span(zone->start_pfn_, zone->spanned_frames_, start, end);
+        shrink_span(start_pfn_, spanned_frames_, start, end);
+        zone->present_frames_ -= nr_target;
+        present_frames_ -= nr_target;
+        zone->init_watermarks();
+
+        return Status::Ok;
+    }
+
+    FORCE_INLINE
+    static auto check_range(PhysAddr start, PhysAddr end) -> Status {
+        if (start >= end) {
+            return Status::InvalidArguments;
+        }
+        if (!ustl::mem::is_aligned(start, BIT(SECTION_SHIFT)) || !ustl::mem::is_aligned(end, BIT(SECTION_SHIFT))) {
+            return Status::MisAligned;
+        }
+        // Frame maps are reached through the physmap.
+        if (!PhysMap::is_valid_phys_addr(end - 1)) {
+            return Status::OutOfRange;
+        }
+
+        return Status::Ok;
+    }
+
+    auto add_memory(PhysAddr start, PhysAddr end, NodeId nid) -> Status {
+        if (auto status = check_range(start, end); Status::Ok != status) {
+            return status;
+        }
+        if (nid >= MAX_NODE || !PmNode::node(nid)) {
+            return Status::InvalidArguments;
+        }
+
+        ustl::sync::LockGuard<decltype(s_hotplug_mutex)> guard(s_hotplug_mutex);
+        auto &model = global_memory_model();
+        auto const first = phys_to_secnum(start);
+        for (auto secnum = first; secnum < phys_to_secnum(end); ++secnum) {
+            auto const status = model.hot_add_section(secnum, nid);
+            if (Status::Ok != status) {
+                while (secnum-- > first) {
+                    model.hot_remove_section(secnum);
+                }
+                return status;
+            }
+        }
+
+        log::info("Node[{}]: Memory [0x{:X}, 0x{:X}) is added", nid, start, end);
+        return Status::Ok;
+    }
+
+    auto online_memory(PhysAddr start, PhysAddr end) -> Status {
+        if (auto status = check_range(start, end); Status::Ok != status) {
+            return status;
+        }
+
+        ustl::sync::LockGuard<decltype(s_hotplug_mutex)> guard(s_hotplug_mutex);
+        auto const frame = phys_to_frame(start);
+        if (!frame) {
+            return Status::NotFound;
+        }
+
+        auto const nid = frame->nid();
+        auto const status = PmNode::node(nid)->online_range(phys_to_pfn(start), phys_to_pfn(end));
+        if (Status::Ok != status) {
+            log::error("Node[{}]: Failed to online memory [0x{:X}, 0x{:X}), reason: {}", nid, start, end, to_string(status));
+            return status;
+        }
+
+        log::info("Node[{}]: Memory [0x{:X}, 0x{:X}) is online", nid, start, end);
+        return Status::Ok;
+    }
+
+    auto offline_memory(PhysAddr start, PhysAddr end) -> Status {
+        if (auto status = check_range(start, end); Status::Ok != status) {
+            return status;
+        }
+
+        ustl::sync::LockGuard<decltype(s_hotplug_mutex)> guard(s_hotplug_mutex);
+        auto const frame = phys_to_frame(start);
+        if (!frame) {
+            return Status::NotFound;
+        }
+
+        auto const nid = frame->nid();
+        auto const status = PmNode::node(nid)->offline_range(phys_to_pfn(start), phys_to_pfn(end));
+        if (Status::Ok != status) {
+            log::error("Node[{}]: Failed to offline memory [0x{:X}, 0x{:X}), reason: {}", nid, start, end, to_string(status));
+            return status;
+        }
+
+        log::info("Node[{}]: Memory [0x{:X}, 0x{:X}) is offline", nid, start, end);
+        return Status::Ok;
+    }
+
+    auto remove_memory(PhysAddr start, PhysAddr end) -> Status {
+        if (auto status = check_range(start, end); Status::Ok != status) {
+            return status;
+        }
+
+        ustl::sync::LockGuard<decltype(s_hotplug_mutex)> guard(s_hotplug_mutex);
+        auto &model = global_memory_model();
+
+        // Either all sections go or none.
+        for (auto secnum = phys_to_secnum(start); secnum < phys_to_secnum(end); ++secnum) {
+            auto const section = model.secnum_to_section(secnum);
+            if (!section) {
+                return Status::NotFound;
+            }
+            if (section->is_online()) {
+                return Status::BadState;
+            }
+            if (section->level() || !nr_map_frames(secnum)) {
+                return Status::Unsupported;
+            }
+        }
+
+        for (auto secnum = phys_to_secnum(start); secnum < phys_to_secnum(end); ++secnum) {
+            model.hot_remove_section(secnum);
+        }
+
+        log::info("Memory [0x{:X}, 0x{:X}) is removed", start, end);
+        return Status::Ok;
+    }
+
+} // namespace ours::mem
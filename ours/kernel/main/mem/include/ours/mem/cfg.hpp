@@ -71,6 +71,29 @@
 #endif
 #define MAX_FRAME_ORDER (NR_FRAME_ORDERS - 1) 
 
+/// [Frame.PageblockOrder]
+/// Free frames are grouped by their migrate type in the unit of pageblock.
+#ifndef OURS_CONFIG_PAGEBLOCK_ORDER
+#   define PAGEBLOCK_ORDER  (MAX_FRAME_ORDER < 9 ? MAX_FRAME_ORDER : 9)
+#elif OURS_CONFIG_PAGEBLOCK_ORDER > MAX_FRAME_ORDER
+#   error "A pageblock can not be larger than the largest block of buddy"
+#else
+#   define PAGEBLOCK_ORDER  OURS_CONFIG_PAGEBLOCK_ORDER
+#endif
+#define PAGEBLOCK_NR_FRAMES BIT(PAGEBLOCK_ORDER)
+
+/// [Vmm.FolioOrder]
+/// Anonymous memory is backed by folios of this order where the range allows, so it can
+/// be mapped by large pages of the level above the last one. Zero disables it.
+#ifndef OURS_CONFIG_VMO_FOLIO_ORDER
+#   define VMO_FOLIO_ORDER  (MAX_FRAME_ORDER < 9 ? 0 : 9)
+#elif OURS_CONFIG_VMO_FOLIO_ORDER > MAX_FRAME_ORDER
+#   error "A folio can not be larger than the largest block of buddy"
+#else
+#   define VMO_FOLIO_ORDER  OURS_CONFIG_VMO_FOLIO_ORDER
+#endif
+#define VMO_FOLIO_NR_FRAMES BIT(VMO_FOLIO_ORDER)
+
 #ifndef OURS_CONFIG_KASLR
 #   define OURS_CONFIG_KASLR  0 
 #endif
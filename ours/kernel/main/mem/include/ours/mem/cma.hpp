@@ -0,0 +1,113 @@
+/// Copyright(C) 2024 smallhuazi
+///
+/// This program is free software; you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published
+/// by the Free Software Foundation; either version 2 of the License, or
+/// (at your option) any later version.
+///
+/// For additional information, please refer to the following website:
+/// https://opensource.org/license/gpl-2-0
+///
+#ifndef OURS_MEM_CMA_HPP
+#define OURS_MEM_CMA_HPP 1
+
+#include <ours/mem/gaf.hpp>
+#include <ours/mem/pm_frame.hpp>
+#include <ours/mem/memory_model.hpp>
+
+#include <ours/init.hpp>
+
+#include <ustl/sync/mutex.hpp>
+
+/// [Cma.Size]
+/// Bytes set aside on each node for contiguous allocations, zero disables it.
+#ifndef OURS_CONFIG_CMA_SIZE
+#   define CMA_SIZE  MB(64)
+#else
+#   define CMA_SIZE  OURS_CONFIG_CMA_SIZE
+#endif
+
+namespace ours::mem {
+    /// `CmaArea` is a range of physical memory carved out at boot for physically contiguous
+    /// requests larger than buddy can serve, e.g. ring buffers of devices and framebuffers.
+    ///
+    /// While no one demands contiguous memory, idle frames are lent to reclaimable
+    /// allocations which the zones of the node fail to serve. A contiguous request takes a
+    /// run free of lent frames; since pages can not be migrated yet, only holders which
+    /// reclaimers can make give frames back are lent to, and the caller waits for them.
+    class CmaArea {
+        typedef CmaArea     Self;
+    public:
+        /// Bounds the time a contiguous request spends waiting for lent frames.
+        CXX11_CONSTEXPR
+        static usize const kMaxRetries = 8;
+
+        /// Carve an area of |size| bytes out of the early memory of |nid|.
+        INIT_CODE
+        static auto create(NodeId nid, usize size) -> Self *;
+
+        CmaArea(NodeId nid, Pfn base_pfn, usize nr_frames, usize *bitmap);
+
+        /// Whether frames may be lent to an allocation of |gaf|. Movable frames are not
+        /// enough, nothing migrates them back out of the area.
+        FORCE_INLINE CXX11_CONSTEXPR
+        static auto can_lend(Gaf gaf) -> bool {
+            return gaf_migrate_type(gaf) == MigrateType::Reclaimable;
+        }
+
+        /// Lend a block of |order| to an allocation `can_lend` accepts. Blocks are taken
+        /// from the upper part first, leaving the lower part for contiguous requests as
+        /// long as possible.
+        auto lend(usize order) -> PmFrame *;
+
+        /// Take back a block lent by `lend`.
+        auto give_back(PmFrame *frame, usize order) -> void;
+
+        /// Allocate |nr_frames| contiguous frames starting at a multiple of |align_frames|.
+        auto alloc_contiguous(usize nr_frames, usize align_frames) -> PmFrame *;
+
+        auto free_contiguous(PmFrame *frame, usize nr_frames) -> void;
+
+        FORCE_INLINE
+        auto contains(PmFrame *frame) const -> bool {
+            auto const pfn = frame_to_pfn(frame);
+            return pfn >= base_pfn_ && pfn < base_pfn_ + nr_frames_;
+        }
+
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto nr_lent() const -> usize {
+            return nr_lent_;
+        }
+
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto nr_frames() const -> usize {
+            return nr_frames_;
+        }
+
+        auto dump() const -> void;
+    private:
+        /// Find |n| clear bits within [from, to) starting at a multiple of |align|.
+        /// Return `nr_frames_` if no one.
+        auto find_free_run(usize from, usize to, usize n, usize align) const -> usize;
+
+        auto test_bit(usize i) const -> bool;
+
+        auto set_range(usize start, usize n, bool value) -> void;
+
+        NodeId nid_;
+        Pfn base_pfn_;
+        usize nr_frames_;
+        usize nr_lent_;
+        usize nr_allocated_;
+
+        /// Where the next `lend` starts searching from.
+        usize lend_hint_;
+
+        /// The bit N is set iff the frame `base_pfn_ + N` is in use.
+        usize *bitmap_;
+        mutable ustl::sync::Mutex mutex_;
+    };
+
+} // namespace ours::mem
+
+#endif // #ifndef OURS_MEM_CMA_HPP
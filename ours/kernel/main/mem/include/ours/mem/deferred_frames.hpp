@@ -0,0 +1,115 @@
+/// Copyright(C) 2024 smallhuazi
+///
+/// This program is free software; you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published
+/// by the Free Software Foundation; either version 2 of the License, or
+/// (at your option) any later version.
+///
+/// For additional information, please refer to the following website:
+/// https://opensource.org/license/gpl-2-0
+///
+#ifndef OURS_MEM_DEFERRED_FRAMES_HPP
+#define OURS_MEM_DEFERRED_FRAMES_HPP 1
+
+#include <ours/mem/types.hpp>
+#include <ours/mem/cfg.hpp>
+
+#include <ours/init.hpp>
+
+#include <ustl/views/span.hpp>
+#include <ustl/sync/atomic.hpp>
+#include <ustl/sync/mutex.hpp>
+
+#include <gktl/range.hpp>
+
+/// [Frame.DeferredInit]
+/// Bytes of each node whose frame descriptors are initialized during early boot, the rest
+/// are initialized by a worker per node once threads are available. Zero disables it.
+#ifndef OURS_CONFIG_DEFERRED_EARLY_SIZE
+#   define DEFERRED_EARLY_SIZE  GB(1)
+#else
+#   define DEFERRED_EARLY_SIZE  OURS_CONFIG_DEFERRED_EARLY_SIZE
+#endif
+
+namespace ours::mem {
+    /// `DeferredFrames` records the part of a node whose frame descriptors have not been
+    /// initialized yet, namely [`start_pfn`, `end_pfn`).
+    ///
+    /// Only the first `DEFERRED_EARLY_SIZE` bytes of a node are initialized by the boot CPU.
+    /// The rest is initialized and handed over to buddy one section at a time, either by the
+    /// worker of the node or by an allocation which finds the node short of frames.
+    class DeferredFrames {
+        typedef DeferredFrames  Self;
+        typedef ustl::views::Span<gktl::Range<Pfn>>   Ranges;
+    public:
+        /// Frames initialized per step, the worker yields the lock between steps.
+        CXX11_CONSTEXPR
+        static usize const kFramesPerStep = BIT(PFN_SECTION_SHIFT);
+
+        DeferredFrames()
+            : start_pfn_(),
+              end_pfn_(),
+              next_pfn_(),
+              present_ranges_(),
+              free_ranges_(),
+              mutex_()
+        {}
+
+        /// Decide which part of the node [|start|, |end|) is deferred. The boundary always
+        /// lies within a memory region, so the hole before it is covered by the boot CPU.
+        INIT_CODE
+        auto init(NodeId nid, Pfn start, Pfn end) -> void;
+
+        /// Take a snapshot of unused regions in the deferred part, which are handed over to
+        /// buddy by the worker. Call it right before the early memory hands over.
+        INIT_CODE
+        auto collect_free_ranges(NodeId nid) -> void;
+
+        /// Clip the unused range [|start|, |end|) to the part initialized at boot.
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto clip_early(PhysAddr start, PhysAddr end) const -> PhysAddr {
+            auto const boundary = pfn_to_phys(start_pfn_);
+            return end < boundary ? end : boundary;
+        }
+
+        /// The first frame whose descriptor was not initialized at boot.
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto start_pfn() const -> Pfn {
+            return start_pfn_;
+        }
+
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto end_pfn() const -> Pfn {
+            return end_pfn_;
+        }
+
+        /// Whether there are frames not initialized yet.
+        FORCE_INLINE
+        auto pending() const -> bool {
+            return next_pfn_.load(ustl::sync::MemoryOrder::Acquire) < end_pfn_;
+        }
+
+    private:
+        friend class PmNode;
+
+        auto is_present(Pfn pfn) const -> bool;
+
+        Pfn start_pfn_;
+        Pfn end_pfn_;
+
+        /// Frames below it have been initialized.
+        ustl::sync::AtomicUsize next_pfn_;
+
+        /// Memory regions in the deferred part, frames out of them are holes.
+        Ranges present_ranges_;
+
+        /// Unused regions in the deferred part, they go to buddy after initialization.
+        Ranges free_ranges_;
+
+        /// Serializes the worker and allocations growing the initialized part.
+        ustl::sync::Mutex mutex_;
+    };
+
+} // namespace ours::mem
+
+#endif // #ifndef OURS_MEM_DEFERRED_FRAMES_HPP
@@ -28,6 +28,8 @@ namespace ours::mem {
         ReclaimBit,
         DirectlyReclaimBit,
         FolioBit,
+        MovableBit,
+        ReclaimableBit,
     };
 
     /// `Gaf` is a shordhand of getting available frame.
@@ -54,6 +56,13 @@ namespace ours::mem {
         DirectlyReclaim = BIT(usize(GafBit::DirectlyReclaimBit)),
 
         Folio           = BIT(usize(GafBit::FolioBit)),
+
+        /// The frame could be migrated elsewhere, e.g. pages of user space. Without
+        /// `Movable` and `Reclaimable`, a frame is regarded as unmovable.
+        Movable         = BIT(usize(GafBit::MovableBit)),
+
+        /// The frame could be given back through a `FrameReclaimer`.
+        Reclaimable     = BIT(usize(GafBit::ReclaimableBit)),
     };
     USTL_ENABLE_ENUM_BITMASK(Gaf);
 
@@ -81,6 +90,20 @@ namespace ours::mem {
     static_assert(gaf_zone_type(Gaf::ZoneDma32) == ZoneType::Dma32);
     static_assert(gaf_zone_type(Gaf::ZoneNormal) == ZoneType::Normal);
 
+    /// Which free lists of `FrameSet` serve the allocation.
+    FORCE_INLINE CXX11_CONSTEXPR
+    static auto gaf_migrate_type(Gaf gaf) -> MigrateType {
+        if (GafVal(gaf & Gaf::Movable)) {
+            return MigrateType::Movable;
+        } else if (GafVal(gaf & Gaf::Reclaimable)) {
+            return MigrateType::Reclaimable;
+        }
+        return MigrateType::Unmovable;
+    }
+    static_assert(gaf_migrate_type(Gaf::Movable) == MigrateType::Movable);
+    static_assert(gaf_migrate_type(Gaf::Reclaimable) == MigrateType::Reclaimable);
+    static_assert(gaf_migrate_type(Gaf::Zero) == MigrateType::Unmovable);
+
     CXX11_CONSTEXPR
     static auto const kGafBoot = Gaf::OnlyThisNode | Gaf::ZoneNormal | Gaf::Zero;
 
@@ -88,7 +111,7 @@ namespace ours::mem {
     static auto const kGafKernel = Gaf::OnlyThisNode | Gaf::Reclaim | Gaf::ZoneNormal;
 
     CXX11_CONSTEXPR
-    static auto const kGafUser= Gaf::OnlyThisNode;
+    static auto const kGafUser= Gaf::OnlyThisNode | Gaf::ZoneNormal | Gaf::Movable;
 
 } // namespace ours::mem
 
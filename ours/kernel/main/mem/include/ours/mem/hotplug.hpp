@@ -0,0 +1,47 @@
+/// Copyright(C) 2024 smallhuazi
+///
+/// This program is free software; you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published
+/// by the Free Software Foundation; either version 2 of the License, or
+/// (at your option) any later version.
+///
+/// For additional information, please refer to the following website:
+/// https://opensource.org/license/gpl-2-0
+///
+#ifndef OURS_MEM_HOTPLUG_HPP
+#define OURS_MEM_HOTPLUG_HPP 1
+
+#include <ours/mem/types.hpp>
+#include <ours/status.hpp>
+
+namespace ours::mem {
+    /// Physical memory is plugged and unplugged at runtime in the unit of section, so both
+    /// ends of a range must be aligned to `SECTION_SIZE_BITS`. A section goes through
+    ///
+    ///     (absent) --add_memory--> Present --online_memory--> Online
+    ///     Online --offline_memory--> Present --remove_memory--> (absent)
+    ///
+    /// Sections known at boot start as `Online`. Hot-added memory is handed to zones in
+    /// movable pageblocks, so unmovable allocations avoid it and it can go offline again.
+    ///
+    /// Frames can not be migrated yet, so going offline takes the free frames out of the
+    /// buddy allocator and asks reclaimers for the rest, until a few retries are spent.
+
+    /// Make the memory in [start, end) known on |nid| and leave it offline. The frame map of
+    /// each section is kept in the first frames of the section itself.
+    auto add_memory(PhysAddr start, PhysAddr end, NodeId nid) -> Status;
+
+    /// Give the frames of the added sections within [start, end) to the allocator.
+    auto online_memory(PhysAddr start, PhysAddr end) -> Status;
+
+    /// Take the frames within [start, end) back from the allocator. Return `BadState` if any
+    /// of them is reserved or pinned, and `ShouldRetry` if some are still in use after all
+    /// retries. In both cases the range stays online.
+    auto offline_memory(PhysAddr start, PhysAddr end) -> Status;
+
+    /// Forget the offline sections within [start, end). After that the memory may go away.
+    auto remove_memory(PhysAddr start, PhysAddr end) -> Status;
+
+} // namespace ours::mem
+
+#endif // #ifndef OURS_MEM_HOTPLUG_HPP
@@ -92,9 +92,10 @@ namespace ours::mem {
             value_.set<StateId>(State::Present);
         }
 
+        /// An online section is present as well.
         FORCE_INLINE CXX11_CONSTEXPR
         auto is_present() const -> bool {
-            return state() == State::Present;
+            return state() >= State::Present;
         }
 
         FORCE_INLINE CXX11_CONSTEXPR
@@ -213,6 +214,10 @@ namespace ours::mem {
             return array;
         } (ustl::MakeIndexSequenceT<kMappingLevel>());
 
+        /// How many frames at the head of a section plugged at runtime hold its frame map.
+        CXX11_CONSTEXPR
+        static usize const kHotMapFrames = (kFramesPerLevel[0] * sizeof(PmFrame) + PAGE_SIZE - 1) >> PAGE_SHIFT;
+
         CXX11_CONSTEXPR
         static usize const kIndexBits = {
             (ustl::NumericLimits<usize>::DIGITS - SECTION_SIZE_BITS + kMappingLevel) / kMappingLevel
@@ -283,6 +288,16 @@ namespace ours::mem {
 
         auto remove_range(PhysAddr start, PhysAddr end, NodeId nid) -> Status;
 
+        /// Set up the section |secnum| plugged at runtime. Its frame map is placed at the head
+        /// of the section itself, so nothing is allocated for it. All frames are left reserved
+        /// until the section goes online. See `hotplug.hpp`.
+        auto hot_add_section(SecNum secnum, NodeId nid) -> Status;
+
+        /// Forget the section |secnum| set up by `hot_add_section`, it must be offline.
+        auto hot_remove_section(SecNum secnum) -> Status;
+
+        auto mark_section(SecNum begin, SecNum end, PmSection::State) -> void;
+
         INIT_CODE
         auto init_framemap() -> void;
 
@@ -322,8 +337,6 @@ namespace ours::mem {
 
         auto depopulate(Pfn start, usize nr_frames, NodeId nid) -> Status;
 
-        auto mark_section(SecNum begin, SecNum end, PmSection::State) -> void;
-
         FORCE_INLINE CXX11_CONSTEXPR
         static auto secnum_to_index(usize level, SecNum secnum) -> usize {
             CXX11_CONSTEXPR
@@ -0,0 +1,108 @@
+/// Copyright(C) 2024 smallhuazi
+///
+/// This program is free software; you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published
+/// by the Free Software Foundation; either version 2 of the License, or
+/// (at your option) any later version.
+///
+/// For additional information, please refer to the following website:
+/// https://opensource.org/license/gpl-2-0
+///
+#ifndef OURS_MEM_MEMPOLICY_HPP
+#define OURS_MEM_MEMPOLICY_HPP 1
+
+#include <ours/mem/gaf.hpp>
+#include <ours/mem/node-mask.hpp>
+
+namespace ours::mem {
+    enum class MemPolicyMode {
+        /// Frames come from the node of the running CPU.
+        Local,
+        /// Frames come from the given node first, then from others by distance.
+        Preferred,
+        /// Frames come only from the given nodes.
+        Bind,
+        /// Pages are spread over the given nodes by their index in a VMO.
+        Interleave,
+        MaxNumModes,
+    };
+
+    FORCE_INLINE CXX11_CONSTEXPR
+    static auto to_string(MemPolicyMode mode) -> char const * {
+        switch (mode) {
+            case MemPolicyMode::Local:      return "Local";
+            case MemPolicyMode::Preferred:  return "Preferred";
+            case MemPolicyMode::Bind:       return "Bind";
+            case MemPolicyMode::Interleave: return "Interleave";
+        }
+        return "Anonymous";
+    }
+
+    /// `MemPolicy` decides which nodes frames are allocated from. It is carried by threads
+    /// and `VmObjectPaged`, the latter takes precedence if both are given.
+    class MemPolicy {
+        typedef MemPolicy   Self;
+    public:
+        FORCE_INLINE
+        static auto local() -> Self {
+            return Self(MemPolicyMode::Local, NodeMask());
+        }
+
+        FORCE_INLINE
+        static auto preferred(NodeId nid) -> Self {
+            NodeMask nodes;
+            nodes.set(nid);
+            return Self(MemPolicyMode::Preferred, nodes);
+        }
+
+        /// An empty |nodes| degrades to `Local`.
+        FORCE_INLINE
+        static auto bind(NodeMask const &nodes) -> Self {
+            return Self(nodes.any() ? MemPolicyMode::Bind : MemPolicyMode::Local, nodes);
+        }
+
+        /// An empty |nodes| degrades to `Local`.
+        FORCE_INLINE
+        static auto interleave(NodeMask const &nodes) -> Self {
+            return Self(nodes.any() ? MemPolicyMode::Interleave : MemPolicyMode::Local, nodes);
+        }
+
+        /// The policy of the running thread, `Local` if there is no thread yet.
+        static auto current() -> Self;
+
+        MemPolicy()
+            : mode_(MemPolicyMode::Local),
+              nodes_()
+        {}
+
+        /// Which node the frame backing the page at |index| is allocated from first.
+        auto preferred_node(PgOff index = 0) const -> NodeId;
+
+        /// Which nodes frames could be allocated from.
+        auto allowed_nodes() const -> NodeMask;
+
+        /// Adjust |gaf| to the policy, e.g. allow falling back to other nodes.
+        auto apply(Gaf gaf) const -> Gaf;
+
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto mode() const -> MemPolicyMode {
+            return mode_;
+        }
+
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto nodes() const -> NodeMask const & {
+            return nodes_;
+        }
+    private:
+        MemPolicy(MemPolicyMode mode, NodeMask const &nodes)
+            : mode_(mode),
+              nodes_(nodes)
+        {}
+
+        MemPolicyMode mode_;
+        NodeMask nodes_;
+    };
+
+} // namespace ours::mem
+
+#endif // #ifndef OURS_MEM_MEMPOLICY_HPP
@@ -20,6 +20,7 @@
 #include <ours/cpu-local.hpp>
 
 #include <ustl/rc.hpp>
+#include <ustl/sync/atomic.hpp>
 #include <ustl/mem/object.hpp>
 #include <ustl/collections/intrusive/slist.hpp>
 #include <ustl/collections/intrusive/list.hpp>
@@ -30,9 +31,22 @@ namespace ours::mem {
     namespace uci = ustl::collections::intrusive;
 
     enum class OcFlags {
-        Folio,
-        Dma,
-        Dma32,
+        Folio           = BIT(0),
+        Dma             = BIT(1),
+        Dma32           = BIT(2),
+
+        /// Align objects to cache lines, so that no two of them share a line.
+        HwCacheAlign    = BIT(3),
+
+        /// Keep the list of free objects out of slabs, so that free objects are never
+        /// touched. Meant for large objects, it costs a `kmalloc` per slab.
+        OffSlab         = BIT(4),
+
+        /// Objects stay of the same type while lock-free readers may hold them: an object
+        /// can be reused at once after it is freed, but the memory of its slab goes back
+        /// to PMM only after a grace period, see `task::GracePeriod`. Readers must check
+        /// that an object is still the one they look for. It implies `OffSlab`.
+        TypeSafeByRcu   = BIT(5),
     };
     USTL_ENABLE_ENUM_BITMASK(OcFlags);
 
@@ -44,16 +58,12 @@ namespace ours::mem {
         struct Object: public uci::SlistBaseHook<uci::LinkMode<uci::LinkModeType::AutoUnlink>> {};
         using ObjectList = uci::Slist<Object, uci::ConstantTimeSize<false>>;
 
-        static auto create(ObjectCache *oc, Gaf gaf, usize order, usize obi_size, NodeId nid = MAX_NODE) -> Self *;
+        /// Objects are laid out from |offset| bytes, the colour of the slab.
+        static auto create(ObjectCache *oc, Gaf gaf, usize order, usize obi_size, usize offset, NodeId nid = MAX_NODE) -> Self *;
 
-        auto init(ObjectCache *oc, usize order, usize obi_size) -> Status;
+        auto init(ObjectCache *oc, usize order, usize obi_size, usize offset) -> Status;
 
-        FORCE_INLINE
-        auto destory() -> void {
-            DEBUG_ASSERT(num_inuse == 0);
-            unlink();
-            mem::free_frame(to_pmm(), order());
-        }
+        auto destory() -> void;
 
         auto get_object() -> Object *;
 
@@ -62,9 +72,14 @@ namespace ours::mem {
             return reinterpret_cast<T *>(get_object());
         }
 
-        FORCE_INLINE CXX11_CONSTEXPR
+        FORCE_INLINE
         auto put_object(Object *object) -> void {
-            free_list.push_front(*object);
+            if (free_index) {
+                auto const base = frame_to_virt<u8>(to_pmm());
+                free_index[num_objects - num_inuse] = u16(reinterpret_cast<u8 *>(object) - base);
+            } else {
+                free_list.push_front(*object);
+            }
             num_inuse -= 1;
         }
 
@@ -73,11 +88,19 @@ namespace ours::mem {
             return num_inuse != num_objects;
         }
 
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto is_empty() const -> bool {
+            return num_inuse == 0;
+        }
+
         /// Private on logic.
         ustl::sync::AtomicU16 num_inuse;
         ustl::sync::AtomicU16 num_objects;
         ObjectList free_list;
         ObjectCache *object_cache;
+        /// Stack of offsets of free objects from the start of the slab, used instead of
+        /// |free_list| if the cache keeps free lists off slab.
+        u16 *free_index;
     };
     USTL_DECLARE_LIST_TEMPLATE(Slab, SlabList, uci::ConstantTimeSize<false>);
     static_assert(sizeof(Slab) <= kFrameDescSize, "");
@@ -87,53 +110,216 @@ namespace ours::mem {
         typedef Slab   Type;
     };
 
+    /// `Magazine` is a stack of free objects. Each cpu holds a couple of them to serve
+    /// allocations and frees without touching slabs, and they move between cpus through
+    /// the depot of nodes.
+    struct Magazine: public uci::SlistBaseHook<> {
+        typedef Magazine   Self;
+
+        /// Makes a magazine fit in 256 bytes.
+        CXX11_CONSTEXPR
+        static usize const kCapacity = 30;
+
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto is_full() const -> bool {
+            return rounds == kCapacity;
+        }
+
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto is_empty() const -> bool {
+            return rounds == 0;
+        }
+
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto push(void *object) -> void {
+            DEBUG_ASSERT(!is_full());
+            objects[rounds++] = object;
+        }
+
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto pop() -> void * {
+            DEBUG_ASSERT(!is_empty());
+            return objects[--rounds];
+        }
+
+        usize rounds = 0;
+        void *objects[kCapacity];
+    };
+    USTL_DECLARE_SLIST(Magazine, MagazineList, uci::ConstantTimeSize<false>);
+
+    /// Events of a cache. They are counted on each cpu and summed on reading, so a few
+    /// counts may be lost to interrupts on the same cpu, which is tolerable.
+    struct ObjectCacheStats {
+        u64 nr_allocs;
+        u64 nr_frees;
+        u64 nr_alloc_fails;
+        u64 nr_slabs_created;
+        u64 nr_slabs_freed;
+        /// Frees pushed to the remote list of another node, counted in |nr_frees| too.
+        u64 nr_remote_frees;
+    };
+
+    /// Slabs of a cache on a node, a record of the snapshot.
+    struct ObjectCacheNodeInfo {
+        u32 nid;
+        u32 nr_slabs;
+        u32 nr_partial;
+        u32 nr_full;
+        u32 nr_empty;
+        /// Objects given out of slabs, including those sitting in magazines.
+        u32 nr_inuse;
+        /// Objects in full magazines of the depot.
+        u32 nr_cached;
+        u32 reserved;
+    };
+
+    /// A cache as seen by `ObjectCache::snapshot`, a record of the snapshot. Slab counts
+    /// are the sum over nodes.
+    struct ObjectCacheInfo {
+        char name[32];
+        u32 object_size;
+        u32 object_align;
+        u32 order;
+        u32 objects_per_slab;
+        u32 nr_colours;
+        /// How many `ObjectCacheNodeInfo` follow this record in a snapshot.
+        u32 nr_nodes;
+        u64 nr_slabs;
+        u64 nr_partial;
+        u64 nr_full;
+        u64 nr_empty;
+        u64 nr_inuse;
+        u64 nr_cached;
+        /// Memory held by slabs, and the part of it not taken by objects in use.
+        u64 nr_bytes;
+        u64 nr_wasted;
+        ObjectCacheStats stats;
+    };
+
+    /// A snapshot is laid out as the header, then each cache as an `ObjectCacheInfo`
+    /// followed by its `ObjectCacheNodeInfo`. Tools on the host should step by the sizes
+    /// given in the header, so that fields can be appended without breaking them.
+    struct ObjectCacheSnapshotHeader {
+        CXX11_CONSTEXPR
+        static u32 const kMagic = 0x5353434F; // "OCSS"
+
+        CXX11_CONSTEXPR
+        static u16 const kVersion = 1;
+
+        u32 magic;
+        u16 version;
+        u16 header_size;
+        u16 cache_size;
+        u16 node_size;
+        u32 nr_caches;
+    };
+    static_assert(sizeof(ObjectCacheSnapshotHeader) == 16);
+    static_assert(sizeof(ObjectCacheNodeInfo) == 32);
+    static_assert(sizeof(ObjectCacheInfo) == 168);
+
+    /// Slabs of a node are on one of three lists by how many objects are in use, all
+    /// transitions between them are made under |mutex_|.
+    ///
+    ///     Empty <--> Partial <--> Full
+    ///
+    /// A slab of only one object goes between `Empty` and `Full` directly. Empty slabs are
+    /// kept up to a target given by the cache, beyond that they go back to PMM at once.
     struct ObjectCachePerNode {
         typedef ObjectCachePerNode  Self;
+        typedef Slab::Object        Object;
 
         static auto create(NodeId nid) -> Self *;
 
         auto destory() -> void;
 
-        FORCE_INLINE
-        auto get_slab() -> Slab * {
-            if (!has_slab()) {
-                return nullptr;
-            }
-            return &slabs_partial.front(); 
-        }
+        /// Take an object from partial slabs first, then from empty ones. Return nullptr if
+        /// there is no free object on this node.
+        auto get_object() -> Object *;
 
-        FORCE_INLINE
-        auto add_slab(Slab *slab) -> void {
-            slabs_partial.push_back(*slab);
-            num_slabs += 1;
-            num_partial += 1;
-        }
+        /// Give |object| back to |slab|. If |slab| becomes empty while there have been
+        /// |max_empty| empty slabs, it is taken off and returned, the caller should destroy
+        /// it out of the lock.
+        auto put_object(Slab *slab, Object *object, usize max_empty) -> Slab *;
 
-        FORCE_INLINE
-        auto put_slab(Slab *slab) -> void {
-            DEBUG_ASSERT(!slab->has_object(), "Attempt to put a partial slab object");
-            num_partial -= 1;
-            slabs_full.push_back(*slab);
-        }
+        /// Take up to |n| objects into |out| with the lock taken once. A slab is drained
+        /// before moving to the next one, so objects handed out together are close.
+        auto get_objects(usize n, void **out) -> usize;
+
+        /// Give back |n| objects which all belong to slabs of this node, with the lock
+        /// taken once. Slabs beyond |max_empty| empty ones are moved to |victims|.
+        auto put_objects(usize n, void **objects, usize max_empty, SlabList<> &victims) -> void;
+
+        /// Add a slab which is just created.
+        auto add_slab(Slab *slab) -> void;
+
+        /// A free object on |remote_frees|, linked through its first word.
+        struct RemoteObject {
+            RemoteObject *next;
+        };
+
+        /// Push |object| freed on another node without taking the lock.
+        auto push_remote(void *object) -> void;
+
+        /// Give all objects on |remote_frees| back to their slabs, the same as `put_objects`
+        /// does. The whole list is taken off at once, so any cpu may drain it and there is
+        /// no ABA problem.
+        auto drain_remote(usize max_empty, SlabList<> &victims) -> usize;
+
+        /// Requires |mutex_| held. Return true if |slab| has been taken off as a victim.
+        auto put_object_locked(Slab *slab, Object *object, usize max_empty) -> bool;
+
+        /// Take off all empty slabs into |slabs|, return how many there are.
+        auto take_empty_slabs(SlabList<> &slabs) -> usize;
+
+        /// Move |slab| to the list matching its objects in use, which were |old_inuse|.
+        /// Requires |mutex_| held.
+        auto relink_slab(Slab *slab, usize old_inuse) -> void;
 
         FORCE_INLINE
         auto has_slab() const -> bool {
-            return num_partial != 0;
+            return num_partial != 0 || num_empty != 0;
         }
 
-        FORCE_INLINE
-        auto free_slab(Slab *slab) -> void {
-            slab->unlink();
-            num_slabs -= 1;
-        }
+        /// Return a full magazine from the depot, or nullptr if there is none.
+        auto get_full_magazine() -> Magazine *;
+
+        /// Return an empty magazine from the depot, or nullptr if there is none.
+        auto get_empty_magazine() -> Magazine *;
+
+        auto put_empty_magazine(Magazine *magazine) -> void;
+
+        /// Return false if the depot has had enough full magazines, the caller should
+        /// give the objects back to their slabs instead.
+        auto put_full_magazine(Magazine *magazine) -> bool;
+
+        /// Take off all magazines in the depot into |magazines|.
+        auto take_magazines(MagazineList &magazines) -> void;
+
+        /// Fill the slab and depot counts of |info|.
+        auto collect(ObjectCacheNodeInfo &info) -> void;
+
+        /// Most full magazines kept in the depot, objects beyond it go back to slabs.
+        CXX11_CONSTEXPR
+        static usize const kMaxFullMagazines = 16;
 
         /// Slabs which contains partial available objects.
         SlabList<> slabs_partial;
         /// Slabs which contains all objects inused.
         SlabList<> slabs_full;
+        /// Slabs which contains no objects inused.
+        SlabList<> slabs_empty;
+        /// Objects of this node freed on other nodes, drained lazily by allocations here.
+        ustl::sync::Atomic<RemoteObject *> remote_frees;
+        /// The depot of magazines shared by cpus on this node.
+        MagazineList full_magazines;
+        MagazineList empty_magazines;
         Mutex mutex_;
         usize num_slabs;
         usize num_partial;
+        usize num_full;
+        usize num_empty;
+        usize num_full_magazines;
+        usize num_empty_magazines;
     };
 
     class ObjectCache: public ustl::RefCounter<ObjectCache> {
@@ -181,6 +367,13 @@ namespace ours::mem {
 
         auto do_deallocate(Slab *slab, void *object) -> void;
 
+        /// Allocate |n| objects into |out|, all or nothing. Return |n| on success, 0 if
+        /// out of memory. Objects come from slabs directly, bypassing magazines.
+        auto allocate_bulk(usize n, Gaf gaf, NodeId nid, void **out) -> usize;
+
+        /// Give back |n| objects at once, no destructor is called.
+        auto deallocate_bulk(usize n, void **objects) -> void;
+
         template <typename T>
         auto deallocate(T *object) -> void {
             DEBUG_ASSERT(object, "Pass a invalid object");
@@ -193,6 +386,39 @@ namespace ours::mem {
             return object_size_;
         }
 
+        FORCE_INLINE
+        auto is_off_slab() const -> bool {
+            return !!(ocflags_ & OcFlags::OffSlab);
+        }
+
+        FORCE_INLINE
+        auto is_type_safe_by_rcu() const -> bool {
+            return !!(ocflags_ & OcFlags::TypeSafeByRcu);
+        }
+
+        /// Fill |info| with the geometry, slabs and counters of this cache, and |nodes| with
+        /// up to |max_nodes| records of the nodes. Return how many nodes the cache is on.
+        auto snapshot(ObjectCacheInfo &info, ObjectCacheNodeInfo *nodes = nullptr, usize max_nodes = 0) -> usize;
+
+        /// Log a row of the table printed by `dump_caches`.
+        auto dump() -> void;
+
+        /// Log all caches as a table in the manner of slabinfo.
+        static auto dump_caches() -> void;
+
+        /// Write a snapshot of all caches into |buffer|, see `ObjectCacheSnapshotHeader`.
+        /// Return the size of the snapshot, nothing is written if it exceeds |size|.
+        static auto export_snapshot(void *buffer, usize size) -> usize;
+
+        /// Give cached objects and empty slabs on |nid| back to PMM, or on all nodes if
+        /// |nid| is `MAX_NODE`. Return the number of frames freed.
+        ///
+        /// Magazines of other cpus are left alone, they can not be touched from here.
+        auto shrink(NodeId nid = MAX_NODE) -> usize;
+
+        /// Shrink caches in turn until |target| frames on |nid| have been freed.
+        static auto shrink_caches(NodeId nid, usize target) -> usize;
+
         // Do not use it.
         auto init(char const *name, usize object_size, AlignVal align, OcFlags flags) -> Status;
         auto init_top_half(char const *name, usize object_size, AlignVal align, OcFlags flags) -> Status;
@@ -201,23 +427,71 @@ namespace ours::mem {
         auto init_cache_cpu() -> Status;
         auto parse_ocflags(OcFlags flags) -> Status;
 
+        /// Pick the order of slabs, see the definition for details.
+        auto calculate_order() -> Status;
+
         INIT_CODE
         auto init_cache_node_boot() -> Status;
 
         auto free_cache_node() -> void;
 
-        auto get_slab(NodeId nid) -> Slab *;
+        /// Fast paths on the magazines of the current cpu.
+        auto alloc_from_magazine() -> Object *;
+        auto free_to_magazine(void *object) -> bool;
+
+        /// Give all objects in |magazine| back to their slabs.
+        auto flush_magazine(Magazine *magazine) -> void;
+
+        auto alloc_from_slab(Gaf gaf, NodeId nid) -> Object *;
+
+        /// Give objects freed on other nodes back to slabs of |nid|.
+        auto drain_remote_frees(NodeId nid) -> usize;
+        auto free_to_slab(Slab *slab, void *object) -> void;
+
+        /// The part of `deallocate_bulk` below counters.
+        auto free_bulk_to_slabs(usize n, void **objects) -> void;
+
+        /// Add |n| to |counter| of the current cpu.
+        auto account(u64 ObjectCacheStats::*counter, usize n = 1) -> void;
+
+        /// Get an object from slabs on |nid| firstly, then on any online nodes.
+        auto get_object(NodeId nid) -> Object *;
+
+        /// Destroy slabs taken off from nodes, or defer them if the cache is type-safe.
+        /// Return the number of frames freed.
+        auto release_slabs(SlabList<> &slabs) -> usize;
+
+        static auto destroy_slabs(SlabList<> &slabs) -> usize;
+
+        static auto defer_slabs(SlabList<> &slabs) -> void;
+
+        /// Destroy deferred slabs whose grace period has elapsed, and start the next one.
+        static auto poll_deferred_slabs() -> usize;
 
         FORCE_INLINE
         auto alloc_slab(NodeId nid, Gaf gaf = {}) -> Slab * {
-            return Slab::create(this, gaf_ | gaf, order_, object_size_, nid);
+            // A slab of multiple frames is a folio, then `virt_to_folio` finds it from any
+            // object within.
+            return Slab::create(this, gaf_ | gaf | Gaf::Folio, order_, object_size_, next_colour(), nid);
+        }
+
+        /// Slabs are coloured in turn, so that objects at the same index of them fall into
+        /// different cache sets. Racing creators may take the same colour, which only makes
+        /// it a bit less even.
+        FORCE_INLINE
+        auto next_colour() -> usize {
+            auto const colour = colour_next_;
+            colour_next_ = colour + 1 == nr_colours_ ? 0 : colour + 1;
+            return colour * colour_off_;
         }
 
         FORCE_INLINE
         auto create_slab(NodeId nid, Gaf gaf = {}) -> Slab * {
             auto slab = alloc_slab(nid, gaf);
             if (slab) {
-                cache_node_[nid]->add_slab(slab);
+                // |nid| may be `MAX_NODE`, the slab knows where it is in fact.
+                cache_node_[slab->nid()]->add_slab(slab);
+                account(&ObjectCacheStats::nr_slabs_created);
             }
 
             return slab;
@@ -230,8 +504,15 @@ namespace ours::mem {
         u16 objects_;
 	    u32 object_size_;
 	    u32 object_align_;
+        /// Leftover space of a slab is spread to |nr_colours_| offsets by |colour_off_|.
+        u32 colour_off_;
+        u16 nr_colours_;
+        u16 colour_next_;
 	    u32 inuse_;
-        u32 min_partial_;
+        /// How many empty slabs a node keeps for the next allocations.
+        u32 max_empty_;
+        /// Caches backing the magazine layer itself go without it.
+        bool has_magazines_;
 	    const char *name_;
 	    PerCpu<CacheOnCpu> cache_cpu_;
         ustl::Array<ObjectCachePerNode *, MAX_NODE> cache_node_;
@@ -85,6 +85,7 @@ namespace pfns {
         kZoneId,
         kNodeId,
         kOrderId,
+        kMigrateId,
         kSectionId,
     };
 
@@ -94,6 +95,7 @@ namespace pfns {
         Field<Id<kZoneId>, Name<"Zone">, Type<ZoneType>, Bits<BIT_WIDTH(usize(ZoneType::MaxNumZoneType))>>,
         Field<Id<kNodeId>, Name<"Nid">, Type<NodeId>, Bits<MAX_NODES_BITS>, Enable<OURS_CONFIG_NUMA>>,
         Field<Id<kOrderId>, Name<"Order">, Type<usize>, Bits<BIT_WIDTH(MAX_FRAME_ORDER)>>,
+        Field<Id<kMigrateId>, Name<"Migrate">, Type<MigrateType>, Bits<BIT_WIDTH(usize(MigrateType::MaxNumTypes))>>,
         Field<Id<kSectionId>, Name<"Sec">, Type<SecNum>, Bits<MAX_PHYSADDR_BITS - SECTION_SIZE_BITS>, Enable<1>>
     > FieldList;
 
@@ -153,6 +155,16 @@ namespace pfns {
             inner_.set<kOrderId>(order);
         }
 
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto migrate_type() const -> MigrateType {
+            return inner_.get<kMigrateId>();
+        }
+
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto set_migrate_type(MigrateType type) -> void {
+            inner_.set<kMigrateId>(type);
+        }
+
         FORCE_INLINE CXX11_CONSTEXPR
         auto state() const -> PfStates {
             return inner_.get<kStateId>();
@@ -163,6 +175,11 @@ namespace pfns {
             inner_.set<kStateId>(inner_.get<kStateId>() | states);
         }
 
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto clear_states(PfStates states) -> void {
+            inner_.set<kStateId>(inner_.get<kStateId>() & ~states);
+        }
+
         BitFields<FieldList>    inner_;
     };
     static_assert(sizeof(FrameFlags) <= sizeof(usize), "Never greater than the size target platform supports");
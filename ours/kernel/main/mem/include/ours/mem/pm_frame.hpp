@@ -75,16 +75,42 @@ namespace ours::mem {
             flags_.set_order(order);
         }
 
+        /// Only meaningful for the first frame of a pageblock, see `FrameSet`.
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto migrate_type() const -> MigrateType {
+            return flags_.migrate_type();
+        }
+
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto set_migrate_type(MigrateType type) -> void {
+            flags_.set_migrate_type(type);
+        }
+
         FORCE_INLINE CXX11_CONSTEXPR
         auto mark_pinned() -> void {
             flags_.set_states(PfStates::Pinned);
         }
 
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto clear_pinned() -> void {
+            flags_.clear_states(PfStates::Pinned);
+        }
+
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto is_pinned() const -> bool {
+            return !!(flags_.state() & PfStates::Pinned);
+        }
+
         FORCE_INLINE CXX11_CONSTEXPR
         auto mark_reserved() -> void {
             flags_.set_states(PfStates::Reserved);
         }
 
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto is_reserved() const -> bool {
+            return !!(flags_.state() & PfStates::Reserved);
+        }
+
         FORCE_INLINE CXX11_CONSTEXPR
         auto mark_active() -> void {
             flags_.set_states(PfStates::Active);
@@ -15,6 +15,10 @@
 #include <ours/mem/node-mask.hpp>
 #include <ours/mem/node-states.hpp>
 #include <ours/mem/page_queues.hpp>
+#include <ours/mem/zeroed_pool.hpp>
+#include <ours/mem/deferred_frames.hpp>
+
+#include <ours/task/wait-queue.hpp>
 
 #include <ours/assert.hpp>
 #include <ours/init.hpp>
@@ -167,6 +171,7 @@ namespace ours::mem {
     };
 
     struct AllocationContext;
+    class CmaArea;
 
     /// `PmNode` is a class that describes a NUMA domain.
     ///
@@ -194,8 +199,10 @@ namespace ours::mem {
         /// Allocate `|n|` of frames and do best to
         auto alloc_frames(Gaf flags, usize n, ai_out FrameList<> *out, NodeMask const &mask) -> Status;
 
-        /// Allocate `|n|` of frames and do best to
-        auto alloc_frames_bulk(Gaf flags, usize n, ai_out FrameList<> *out) -> Status;
+        /// Allocate `|n|` frames of order 0 in batch, each zone is locked at most once.
+        /// Either all of them are allocated or none.
+        auto alloc_frames_bulk(Gaf flags, usize n, ai_out FrameList<> *out, NodeMask const &nodes = node_online_mask()) 
+            -> Status;
 
         /// Free a frame, 
         static auto free_frame(PmFrame *frame, usize order) -> void;
@@ -205,6 +212,63 @@ namespace ours::mem {
 
         auto contains(usize order, ZoneType type) -> bool;
 
+        /// Reclaim at least |target| frames on this node synchronously, return the number
+        /// of frames freed.
+        auto reclaim(usize target) -> usize;
+
+        /// Notify the reclaim daemon of this node that a zone has dropped below `Sufficient`.
+        FORCE_INLINE
+        auto wakeup_reclaimd() -> void {
+            // Only the first notification since the daemon went to sleep touches the queue.
+            if (!reclaim_pending_.exchange(true, ustl::sync::MemoryOrder::AcqRel)) {
+                reclaimd_wait_.wake_one();
+            }
+        }
+
+        /// Whether any zone of this node is below `WaterMark::Sufficient`.
+        auto under_pressure() const -> bool;
+
+        /// Spawn the reclaim daemon of this node, it requires the task subsystem.
+        auto start_reclaimd() -> Status;
+
+        /// Spawn the idle worker that fills the pool of pre-zeroed frames.
+        auto start_zeroed() -> Status;
+
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto zeroed_pool() -> ZeroedPool & {
+            return zeroed_pool_;
+        }
+
+        /// Spawn the worker that initializes frames deferred at boot.
+        auto start_deferred_init() -> Status;
+
+        /// Initialize deferred frames section by section until at least |nr_frames| have
+        /// been handed over to zones or none is left, return the number handed over.
+        auto grow_deferred_frames(usize nr_frames) -> usize;
+
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto deferred_frames() -> DeferredFrames & {
+            return deferred_frames_;
+        }
+
+        /// Hand the frames of sections within [start, end) over to the zone for normal memory
+        /// of this node. The sections must have been added and be offline, see `hotplug.hpp`.
+        auto online_range(Pfn start, Pfn end) -> Status;
+
+        /// Take all frames of the online sections within [start, end) back from zones.
+        auto offline_range(Pfn start, Pfn end) -> Status;
+
+        /// The area reserved for contiguous allocations, null if there is not.
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto cma() const -> CmaArea * {
+            return cma_;
+        }
+
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto set_cma(CmaArea *cma) -> void {
+            cma_ = cma;
+        }
+
         auto dump() const -> void;
 
         FORCE_INLINE CXX11_CONSTEXPR
@@ -260,6 +324,26 @@ namespace ours::mem {
 
         auto alloc_frame_core(Gaf gaf, usize order, AllocationContext &context) -> PmFrame *;
 
+        /// Called when the first attempt failed. Depending on |gaf|, it either reclaims
+        /// frames directly or waits for the reclaim daemon, and then tries again.
+        auto alloc_frame_slow(Gaf gaf, usize order, NodeMask const &nodes) -> PmFrame *;
+
+        /// Balance zones of this node until all of them reach the high mark `Sufficient`
+        /// or no progress.
+        auto balance_zones() -> void;
+
+        auto reclaimd_routine() -> i32;
+
+        auto refill_zeroed_pool() -> void;
+
+        auto zeroed_routine() -> i32;
+
+        /// Initialize the next section of deferred frames, return the number of frames
+        /// handed over to zones. The lock of `deferred_frames_` must be held.
+        auto init_deferred_step() -> usize;
+
+        auto deferred_init_routine() -> i32;
+
         auto finish_allocation(PmFrame *frame, Gaf gaf, usize order, AllocationContext const &context) -> void;
 
         GKTL_CANARY(PmNode, canary_);
@@ -282,6 +366,24 @@ namespace ours::mem {
         ZoneQueues zone_queues_;
         PageQueues page_queues_;
 
+        ZeroedPool zeroed_pool_;
+
+        DeferredFrames deferred_frames_;
+
+        CmaArea *cma_;
+
+        ustl::sync::Atomic<bool> reclaim_pending_;
+        ustl::sync::Atomic<bool> reclaimd_running_;
+
+        /// Bumped by the reclaim daemon after each round of balancing.
+        ustl::sync::AtomicUsize reclaim_rounds_;
+
+        /// The reclaim daemon sleeps on it until `wakeup_reclaimd`.
+        task::WaitQueue reclaimd_wait_;
+
+        /// Applicants of the slow path sleep on it until a round of the daemon is over.
+        task::WaitQueue reclaim_wait_;
+
         using NodeList = ustl::Array<PmNode *, MAX_NODE>;
         static inline NodeList s_node_list;
 
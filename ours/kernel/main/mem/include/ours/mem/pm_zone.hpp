@@ -18,6 +18,7 @@
 #include <ustl/sync/atomic.hpp>
 #include <ustl/sync/mutex.hpp>
 #include <ustl/sync/lockguard.hpp>
+#include <ustl/algorithms/minmax.hpp>
 #include <ustl/collections/static-vec.hpp>
 #include <ustl/collections/intrusive/slist.hpp>
 
@@ -25,11 +26,124 @@
 #include <gktl/canary.hpp>
 
 namespace ours::mem {
+    /// `FramePcpuCache` holds frames of low orders for a CPU. It is touched by the owner
+    /// CPU with interrupts disabled, and by `PmZone::drain_pcpu_cache` from any CPU, so
+    /// `mutex_` must be held, which is contended only while draining.
+    ///
+    /// It refills from and drains to `FrameSet` in batch. Once `count_` exceeds `high_`,
+    /// the coldest frames will be given back until `count_` drops to `low_`.
+    ///
+    /// Frames are cached per migrate type as well, so a hit never breaks the grouping
+    /// done by `FrameSet`.
     template <usize MaxOrder>
     class FramePcpuCache {
-        ustl::Array<FrameList<>, MaxOrder> lists_;
+        typedef FramePcpuCache  Self;
+    public:
+        FramePcpuCache(usize high, usize batch)
+            : count_(),
+              lists_()
+        {  set_marks(high, batch);  }
+
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto set_marks(usize high, usize batch) -> void {
+            batch_ = ustl::algorithms::max<usize>(batch, 1);
+            high_ = ustl::algorithms::max(high, batch_);
+            low_ = high_ - batch_;
+        }
+
+        FORCE_INLINE
+        auto pop(usize order, MigrateType type) -> PmFrame * {
+            auto &list = lists_[order][usize(type)];
+            if (list.empty()) {
+                return nullptr;
+            }
+
+            auto frame = &list.front();
+            list.pop_front();
+            count_ -= BIT(order);
+            return frame;
+        }
+
+        /// The recently freed frame is the most likely to be hot in cache, so 
+        /// put it at the head.
+        FORCE_INLINE
+        auto push(PmFrame *frame, usize order, MigrateType type) -> void {
+            frame->set_order(order);
+            lists_[order][usize(type)].push_front(*frame);
+            count_ += BIT(order);
+        }
+
+        /// Take over all frames in |list|, they must be of |order| and |type|. 
+        FORCE_INLINE
+        auto refill(FrameList<> &list, usize n, usize order, MigrateType type) -> void {
+            auto &to = lists_[order][usize(type)];
+            to.splice(to.end(), list);
+            count_ += n << order;
+        }
+
+        /// Move the coldest frames into |out| until `count_` drops to |target|. 
+        /// Frames of higher order go first to reduce fragmentation of `FrameSet`.
+        ///
+        /// Return the number of frames moved.
+        auto drain(FrameList<> &out, usize target) -> usize {
+            auto const old_count = count_;
+            for (auto order = MaxOrder; order > 0 && count_ > target; --order) {
+                for (auto &list : lists_[order - 1]) {
+                    while (!list.empty() && count_ > target) {
+                        auto &frame = list.back();
+                        list.pop_back();
+                        out.push_back(frame);
+                        count_ -= BIT(order - 1);
+                    }
+                }
+            }
+
+            return old_count - count_;
+        }
+
+        FORCE_INLINE
+        auto drain(FrameList<> &out) -> usize {
+            return drain(out, low_);
+        }
+
+        /// How many frames of |order| to be refilled once on a miss.
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto refill_count(usize order) const -> usize {
+            return ustl::algorithms::max<usize>(batch_ >> order, 1);
+        }
+
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto should_drain() const -> bool {
+            return count_ > high_;
+        }
+
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto count() const -> usize {
+            return count_;
+        }
+
+        FORCE_INLINE
+        auto mutex() -> ustl::sync::Mutex & {
+            return mutex_;
+        }
+
+    private:
+        ustl::sync::Mutex mutex_;
+        usize count_;
+        usize high_;
+        usize low_;
+        usize batch_;
+        ustl::Array<ustl::Array<FrameList<>, kNumMigrateTypes>, MaxOrder> lists_;
     };
 
+    /// `FrameSet` is the buddy allocator of a zone. Free blocks of each order are
+    /// grouped by `MigrateType`, the type of each pageblock is recorded in its first
+    /// frame, and a free block always stays on the list of its pageblock's type.
+    ///
+    /// If the lists of the requested type run dry, blocks are stolen from other types,
+    /// the largest first. Stealing a large block, or stealing on behalf of a request
+    /// which is not movable, claims the whole pageblock, so that unmovable frames are
+    /// packed into as few pageblocks as possible.
     class FrameSet {
         typedef FrameSet   Self;
     public:
@@ -39,35 +153,116 @@ namespace ours::mem {
         CXX11_CONSTEXPR
         static usize const kMaxFrameOrder = MAX_FRAME_ORDER;
 
-        auto acquire_frame(usize order) -> PmFrame * {
+        CXX11_CONSTEXPR
+        static usize const kPageblockOrder = PAGEBLOCK_ORDER;
+
+        auto acquire_frame(usize order, MigrateType type) -> PmFrame * {
             ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
-            return acquire_frame_locked(order);
+            return acquire_frame_locked(order, type);
         }
 
         auto release_frame(PmFrame *frame, usize order) -> void {
             ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
             return release_frame_locked(frame, order);
         }
+
+        /// Acquire at most |n| frames of |order| with taking the lock only once.
+        /// Return the number of frames appended to |list|.
+        auto acquire_frames(usize order, MigrateType type, usize n, FrameList<> &list) -> usize;
+
+        /// Give back all frames in |list|, the order of each is recorded in itself.
+        auto release_frames(FrameList<> &list) -> void;
+
+        /// Take all free blocks lying in [start, end) out of free lists and append them to
+        /// |list|, so that `release_frames` can give them back. Both ends must be aligned to
+        /// the largest block. Return the number of frames taken.
+        auto isolate_range(Pfn start, Pfn end, FrameList<> &list) -> usize;
+
+        /// Check if there is a free block of |order| without touching the list heads.
+        /// The answer may be stale if the lock is not held.
+        FORCE_INLINE
+        auto has_order(usize order) const -> bool {
+            return order_bitmap() & BIT(order);
+        }
+
+        FORCE_INLINE
+        auto has_order(usize order, MigrateType type) const -> bool {
+            return order_bitmap(type) & BIT(order);
+        }
+
+        /// Check if a request of |order| can be satisfied, maybe by splitting or stealing.
+        FORCE_INLINE
+        auto can_acquire(usize order) const -> bool {
+            return order_bitmap() >> order;
+        }
+
+        /// Which migrate type the pageblock containing |frame| is of.
+        static auto pageblock_type(PmFrame *frame) -> MigrateType;
+
+        /// Call |f| with the head and the order of each free block. It is meant for
+        /// checkers and statistics, the lock is held throughout.
+        template <typename F>
+        auto for_each_free_block(F &&f) -> void {
+            ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+            for (usize order = 0; order < kNumOrders; ++order) {
+                for (auto &list : lists_[order]) {
+                    for (auto &frame : list) {
+                        f(&frame, order);
+                    }
+                }
+            }
+        }
     private:
-        auto acquire_frame_locked(usize order) -> PmFrame *;
+        FORCE_INLINE
+        auto order_bitmap(MigrateType type) const -> u32 {
+            return order_bitmaps_[usize(type)].load(ustl::sync::MemoryOrder::Relaxed);
+        }
+
+        FORCE_INLINE
+        auto order_bitmap() const -> u32 {
+            u32 bitmap = 0;
+            for (usize i = 0; i < kNumMigrateTypes; ++i) {
+                bitmap |= order_bitmap(MigrateType(i));
+            }
+            return bitmap;
+        }
 
-        auto acquire_frame_inner(PmFrame *frame, Pfn pfn, usize order) -> PmFrame *;
+        auto acquire_frame_locked(usize order, MigrateType type) -> PmFrame *;
+
+        auto acquire_frame_inner(PmFrame *frame, usize lower_order, usize upper_order, MigrateType type) -> PmFrame *;
+
+        /// Take a block from the lists of other types once those of |type| run dry.
+        auto steal_frame_locked(usize order, MigrateType type) -> PmFrame *;
+
+        /// Move the free blocks within the pageblock of |frame| from lists of |from| to
+        /// those of |to|, and change the type of the pageblock.
+        auto claim_pageblock(PmFrame *frame, MigrateType from, MigrateType to) -> void;
+
+        /// Change the type of all pageblocks overlapped by the block of |order|.
+        static auto set_pageblock_type(PmFrame *frame, usize order, MigrateType type) -> void;
 
         auto release_frame_locked(PmFrame *frame, usize order) -> void;
 
         auto release_frame_inner(PmFrame *frame, Pfn pfn, usize order) -> void;
 
-        auto remove_frame(PmFrame *frame, usize order) -> void;
+        auto remove_frame(PmFrame *frame, usize order, MigrateType type) -> void;
 
-        auto insert_frame(PmFrame *frame, usize order) -> void;
+        auto insert_frame(PmFrame *frame, usize order, MigrateType type) -> void;
 
-        auto has_frame(usize order) const -> bool;
+        auto get_frame(usize order, MigrateType type) -> PmFrame *;
 
-        auto get_frame(usize order) -> PmFrame *;
+        /// Find the smallest order not lesser than |order| with a free block of |type|,
+        /// return `kNumOrders` if no one.
+        auto find_order(usize order, MigrateType type) const -> usize;
 
         ustl::sync::Mutex mutex_;
-        ustl::sync::AtomicU8 nr_lists_;
-        ustl::Array<FrameList<>, NR_FRAME_ORDERS> lists_;
+
+        /// The bit N of `order_bitmaps_[T]` is set iff `lists_[N][T]` is not empty. It is
+        /// only modified with `mutex_` held, but can be read without it.
+        ustl::Array<ustl::sync::AtomicU32, kNumMigrateTypes> order_bitmaps_;
+        static_assert(NR_FRAME_ORDERS <= 32, "`order_bitmaps_` is too narrow");
+
+        ustl::Array<ustl::Array<FrameList<>, kNumMigrateTypes>, NR_FRAME_ORDERS> lists_;
     };
 
     // TODO(SmallHuaZi) Seprate the free list from `PmZone` and refactor it to `FrameLists`
@@ -76,14 +271,28 @@ namespace ours::mem {
     class PmZone {
         typedef PmZone     Self;
     public:
-        /// FIXME(SmallHuaZi) The cache per cpu has not been finished
+        /// Frames whose order is lesser than it are served by the cache per cpu. 
+        CXX11_CONSTEXPR
+        static usize const kMaxPcpuCacheOrder = 4;
+
+        /// Bounds of the number of frames moving between `FramePcpuCache` and `FrameSet` once.
+        CXX11_CONSTEXPR
+        static usize const kMinPcpuBatch = 4;
+
         CXX11_CONSTEXPR
-        static usize const kMaxPcpuCacheOrder = 0;
+        static usize const kMaxPcpuBatch = 64;
 
+        /// A cache per cpu holds at most `batch * kPcpuHighRatio` frames before draining.
+        CXX11_CONSTEXPR
+        static usize const kPcpuHighRatio = 6;
+
+        /// `watermark_[Mark]` holds the upper bound of free frames at the level `Mark`,
+        /// except `watermark_[Sufficient]` which is the high mark the reclaim daemon
+        /// refills a zone up to once it has dropped below `Sufficient`.
         enum class WaterMark {
             Critical,   // 0 - %10
             Moderate,   // %10 - %30
-            Sufficient, // %30 - %100
+            Sufficient, // %30 - %100, high mark at %50
             MaxNumMarks,
         };
 
@@ -101,6 +310,35 @@ namespace ours::mem {
 
         auto free_frame(PmFrame *frame, usize order = 0) -> void;
 
+        /// Allocate at most |n| frames of |order| and append them to |list|, the lock
+        /// of `FrameSet` is taken only once. High-order blocks are split as needed.
+        ///
+        /// Return the number of frames allocated, which may be lesser than |n|.
+        auto alloc_frames(Gaf gaf, usize order, usize n, ai_out FrameList<> *list) -> usize;
+
+        /// Create caches per cpu. It must be called after `CpuLocal::init`, because the
+        /// list heads are self-referential and can not survive the copy of cpu local area.
+        auto init_pcpu_cache() -> void;
+
+        /// Adjust the high mark and batch size of all caches per cpu.
+        auto set_pcpu_marks(usize high, usize batch) -> void;
+
+        /// Give all frames cached by every cpu back to `FrameSet`, so they could be
+        /// merged into higher orders. Return the number of frames drained.
+        auto drain_pcpu_cache() -> usize;
+
+        /// Compute water marks from the frames managed now. It should be called once all
+        /// free frames have been handed over to this zone.
+        auto init_watermarks() -> void;
+
+        /// Which level the free frames of this zone are at.
+        auto water_level() const -> WaterMark;
+
+        FORCE_INLINE CXX11_CONSTEXPR
+        auto watermark(WaterMark mark) const -> usize {
+            return watermark_[usize(mark)];
+        }
+
         auto find_frame(usize order) -> PmFrame *;
 
         FORCE_INLINE CXX11_CONSTEXPR
@@ -148,7 +386,15 @@ namespace ours::mem {
             return order < kMaxPcpuCacheOrder;
         }
 
+        auto alloc_frame_pcpu(usize order, MigrateType type) -> PmFrame *;
+
+        auto free_frame_pcpu(PmFrame *frame, usize order) -> void;
+
         auto finish_allocation(PmFrame *frame, Gaf gaf, usize order) -> void;
+
+        /// The part of `finish_allocation` not bound to the zone, frames handed out from
+        /// elsewhere than the buddy system go through it too.
+        static auto prepare_frames(PmFrame *frame, Gaf gaf, usize order) -> void;
     protected:
         friend class PmNode;
         GKTL_CANARY(PmZone, canary_);
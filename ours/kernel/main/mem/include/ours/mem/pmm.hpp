@@ -17,6 +17,7 @@
 #include <ours/mem/node-mask.hpp>
 #include <ours/mem/node-states.hpp>
 #include <ours/mem/physmap.hpp>
+#include <ours/mem/mempolicy.hpp>
 
 #include <ours/status.hpp>
 #include <ours/cpu-mask.hpp>
@@ -146,6 +147,25 @@ namespace ours::mem {
 
     auto free_frames(FrameList<> *list) -> void;
 
+    /// Allocate `n` frames of order 0 on the local node in batch. It is preferred when
+    /// a lot of single frames are demanded at once, e.g. committing a VMO.
+    auto alloc_frames_bulk(Gaf gaf, ai_out FrameList<> *list, usize n) -> Status;
+
+    /// Allocate |size| bytes of physically contiguous memory aligned to |align| on |nid|,
+    /// beyond the limit of `MAX_FRAME_ORDER`. Large requests are served by the CMA area of
+    /// the node, which may sleep to wait for frames lent out.
+    OM_API auto alloc_contiguous(usize size, usize align = PAGE_SIZE, NodeId nid = MAX_NODE) -> PmFrame *;
+
+    /// Free memory from `alloc_contiguous`, |size| must be the same as the request.
+    auto free_contiguous(PmFrame *frame, usize size) -> void;
+
+    /// Allocate a frame backing the page at |index| of a VMO following |policy|.
+    OM_API auto alloc_frame(MemPolicy const &policy, PgOff index, Gaf gaf, usize order = 0) -> PmFrame *;
+
+    /// Allocate `n` frames of order 0 in batch from the nodes |policy| allows. Under `Interleave`
+    /// they all start from one node, use `alloc_frame` by index to spread pages.
+    auto alloc_frames_bulk(MemPolicy const &policy, Gaf gaf, ai_out FrameList<> *list, usize n) -> Status;
+
     auto pin_frame(PmFrame *frame) -> Status;
 
     auto unpin_frame(PmFrame *frame) -> Status;
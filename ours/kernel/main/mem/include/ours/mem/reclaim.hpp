@@ -0,0 +1,66 @@
+/// Copyright(C) 2024 smallhuazi
+///
+/// This program is free software; you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published
+/// by the Free Software Foundation; either version 2 of the License, or
+/// (at your option) any later version.
+///
+/// For additional information, please refer to the following website:
+/// https://opensource.org/license/gpl-2-0
+///
+#ifndef OURS_MEM_RECLAIM_HPP
+#define OURS_MEM_RECLAIM_HPP 1
+
+#include <ours/mem/types.hpp>
+#include <ours/status.hpp>
+
+#include <ustl/function/fn.hpp>
+#include <ustl/collections/intrusive/list.hpp>
+
+namespace ours::mem {
+    /// Try to give back at least |target| frames on the node |nid|, return
+    /// how many frames have been freed.
+    using ReclaimHandler = ustl::function::Fn<auto (NodeId, usize) -> usize>;
+
+    /// `FrameReclaimer` is registered by whom holds frames that could be given back
+    /// to PMM under memory pressure, e.g. caches of objects or clean pages of files.
+    class FrameReclaimer {
+        typedef FrameReclaimer  Self;
+      public:
+        FrameReclaimer(char const *name, ReclaimHandler handler)
+            : name_(name), handler_(handler)
+        {}
+
+        FORCE_INLINE
+        auto reclaim(NodeId nid, usize target) -> usize {
+            if (handler_) {
+                return handler_(nid, target);
+            }
+            return 0;
+        }
+
+        FORCE_INLINE
+        auto name() const -> char const * {
+            return name_;
+        }
+
+      private:
+        char const *name_;
+        ReclaimHandler handler_;
+        ustl::collections::intrusive::ListMemberHook<> managed_hook_;
+      public:
+        USTL_DECLARE_HOOK_OPTION(Self, managed_hook_, ManagedOptions);
+    };
+    USTL_DECLARE_LIST(FrameReclaimer, FrameReclaimerList, FrameReclaimer::ManagedOptions);
+
+    auto register_frame_reclaimer(FrameReclaimer &reclaimer) -> void;
+
+    auto unregister_frame_reclaimer(FrameReclaimer &reclaimer) -> void;
+
+    /// Ask reclaimers in turn to free frames on |nid| until |target| frames have been
+    /// freed or no one can make progress. Return the number of frames freed.
+    auto reclaim_frames(NodeId nid, usize target) -> usize;
+
+} // namespace ours::mem
+
+#endif // #ifndef OURS_MEM_RECLAIM_HPP
\ No newline at end of file
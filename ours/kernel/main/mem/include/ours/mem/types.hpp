@@ -58,6 +58,30 @@ namespace ours::mem {
         OX_PANIC("Anonymous zone type is not allowed.");
     }
 
+    /// `MigrateType` tells how the owner of a frame uses it, free frames are grouped by
+    /// it to keep frames which could never be moved from scattering across a zone.
+    enum class MigrateType {
+        /// It must be zero, so pageblocks are movable once the frame map is zeroed.
+        Movable,
+        Unmovable,
+        Reclaimable,
+        MaxNumTypes,
+    };
+    typedef ustl::traits::UnderlyingTypeT<MigrateType> MigrateTypeVal;
+
+    CXX11_CONSTEXPR
+    static usize const kNumMigrateTypes = usize(MigrateType::MaxNumTypes);
+
+    FORCE_INLINE CXX11_CONSTEXPR 
+    static auto to_string(MigrateType type) -> char const * {
+        switch (type) {
+            case MigrateType::Movable:      return "Movable";
+            case MigrateType::Unmovable:    return "Unmovable";
+            case MigrateType::Reclaimable:  return "Reclaimable";
+        }
+        return "Anonymous";
+    }
+
     /// `SecNum` is a shordhand of section table entry
     /// 
     /// A address has been seen like the following layout:
@@ -162,6 +162,10 @@ namespace ours::mem {
         VmArea   *parent_;
         ustl::Rc<VmAspace> aspace_;
         ustl::collections::intrusive::SetMemberHook<>   children_hook_;
+        /// Free space between the previous sibling and this one, and the largest of such
+        /// gaps in the subtree of |children_hook_|. Both are kept by `VmaSet`.
+        usize gap_;
+        usize subtree_gap_;
       public:
         USTL_DECLARE_HOOK_OPTION(Self, children_hook_, ManagedOptions);
     };
@@ -186,8 +190,16 @@ namespace ours::mem {
         /// Return true if contains, otherwise false.
         auto has_range(VirtAddr base, usize size) const -> bool;
 
-        auto find_spot(usize size, AlignVal align, VirtAddr lower_bound, VirtAddr upper_bound)
-            const -> ustl::Result<VirtAddr, Status>;
+        /// Find a free range of |size| bytes aligned to |align| within [lower_bound, upper_bound).
+        /// The lowest one is taken, or the highest one if |top_down|.
+        ///
+        /// Every VMA caches the largest gap in its subtree, so subtrees without a large enough
+        /// gap are skipped and it takes O(log n). Gaps of at least |size| + |align| - PAGE_SIZE
+        /// fit at any alignment and are looked for first. Only if none of them is found, gaps
+        /// of at least |size| are checked exactly, which finds a smaller gap that happens to
+        /// be aligned when |align| > PAGE_SIZE, at the cost of visiting every such gap.
+        auto find_spot(usize size, AlignVal align, VirtAddr lower_bound, VirtAddr upper_bound,
+                       bool top_down = false) const -> ustl::Result<VirtAddr, Status>;
         
         // Now there are so many restrictions that we must manually manage those reference counters 
         // from instances of VmAom.
@@ -195,26 +207,29 @@ namespace ours::mem {
         FORCE_INLINE
         auto insert(Iter hint, RefMut value) -> IterMut {
             value.inc_strong_ref();
-            return Base::insert(hint, value);
+            auto iter = Base::insert(hint, value);
+            link_gaps(iter);
+            return iter;
         }
 
         FORCE_INLINE
         auto insert(RefMut value) -> IterMut {
             value.inc_strong_ref();
-            return Base::insert(value);
+            auto iter = Base::insert(value);
+            link_gaps(iter);
+            return iter;
         }
  
-        FORCE_INLINE
-        auto erase(Iter pos) -> IterMut {
-            pos.unconst()->dec_strong_ref();
-            return Base::erase(pos);
-        }       
+        auto erase(Iter pos) -> IterMut;
  
+        /// VMAs go one by one, so that gaps are kept along.
         FORCE_INLINE
         auto erase(Iter first, Iter last) -> IterMut {
-            return Base::erase_and_dispose(first, last, [] (PtrMut value) {
-                value->dec_strong_ref();
-            });
+            auto iter = first.unconst();
+            while (iter != last) {
+                iter = erase(iter);
+            }
+            return iter;
         }       
 
         /// Find the first existent VMA whose'end < addr.
@@ -238,6 +253,37 @@ namespace ours::mem {
         auto upper_bound(VirtAddr addr) const -> Iter {
             return Base::upper_bound(addr, [] (VirtAddr y, Ref x) { return y <= x.base_; });
         }
+
+      private:
+        typedef Base::node_traits           NodeTraits;
+        typedef Base::value_traits          ValueTraits;
+        typedef NodeTraits::node_ptr        NodePtr;
+
+        FORCE_INLINE
+        static auto to_vma(NodePtr node) -> PtrMut {
+            return ValueTraits::to_value_ptr(node);
+        }
+
+        FORCE_INLINE
+        auto header() const -> NodePtr {
+            return end().pointed_node();
+        }
+
+        /// Update gaps of a VMA just inserted at |iter| and of its successor.
+        auto link_gaps(IterMut iter) -> void;
+
+        /// Recompute the gap before |iter| and fix subtree gaps up to the root.
+        auto update_gap(IterMut iter) -> void;
+
+        /// Fix subtree gaps from |node| up to the root. Rebalancing only rotates nodes on
+        /// this path and their children, so both are recomputed at each level.
+        auto propagate_gaps(NodePtr node) -> void;
+
+        auto find_lowest(NodePtr node, usize length, usize size, usize align, VirtAddr lower, VirtAddr upper)
+            const -> ustl::Option<VirtAddr>;
+
+        auto find_highest(NodePtr node, usize length, usize size, usize align, VirtAddr lower, VirtAddr upper)
+            const -> ustl::Option<VirtAddr>;
     };
 
     class VmaSet::Enumerator {
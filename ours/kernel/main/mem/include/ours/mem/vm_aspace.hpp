@@ -37,7 +37,12 @@ namespace ours::mem {
         typedef VmAspace       Self;
         typedef ustl::RefCounter<VmAspace>  Base;
     public:
-        static auto clone(VmasFlags, ustl::Rc<VmAspace> *) -> Status;
+        /// Create an address space of |flags| with the same VMAs and mappings as this one. The
+        /// paged VMOs of private mappings are cloned copy-on-write, once per VMO, and shared
+        /// mappings keep their VMO. Nothing is copied or mapped in the new one, so it takes
+        /// time in the number of mappings rather than of pages. Pages of this one are
+        /// write-protected on the way.
+        auto clone(VmasFlags flags, ustl::Rc<VmAspace> *out) -> Status;
 
         static auto create(VmasFlags, char const *, ustl::Rc<VmAspace> *out) -> Status;
 
@@ -56,7 +61,7 @@ namespace ours::mem {
             return ustl::make_rc<VmAspace>(kernel_aspace_);
         }
 
-        auto fault(VirtAddr addr, VmfCause flags) -> void;
+        auto fault(VirtAddr addr, VmfCause flags) -> Status;
 
         FORCE_INLINE
         auto lock() -> Mutex * {
@@ -83,6 +88,15 @@ namespace ours::mem {
 
         auto init() -> Status;
 
+        /// The VMOs cloned so far by one `clone`.
+        class VmoCloneMap;
+
+        /// Decide which VMO the clone of |mapping| maps, cloning it at the first time.
+        auto clone_vmo_locked(VmMapping &mapping, VmoCloneMap &clones, ustl::Rc<VmObject> *out) -> Status;
+
+        /// Rebuild the children of |src| under |dst| for `clone`.
+        auto clone_area_locked(VmArea *src, VmArea *dst, VmoCloneMap &clones) -> Status;
+
         GKTL_CANARY(VmAspace, canary_);
         VirtAddr  base_;
         VirtAddr  size_;
@@ -14,10 +14,12 @@
 #include <ours/mutex.hpp>
 
 #include <ours/mem/gaf.hpp>
+#include <ours/mem/mempolicy.hpp>
 #include <ours/mem/vm_page_map.hpp>
 #include <ours/mem/page_request.hpp>
 
 #include <ustl/rc.hpp>
+#include <ustl/option.hpp>
 #include <ustl/sync/lockguard.hpp>
 
 namespace ours::mem {
@@ -31,19 +33,84 @@ namespace ours::mem {
 
         auto commit_range_locked(VirtAddr offset, usize size, ai_out usize *nr_commited) -> Status;
 
+        /// Pin the pages within [offset, offset + size), all of which must be committed.
+        /// Pins are kept per entry, so a folio touched by the range is pinned as a whole.
+        auto pin_range_locked(VirtAddr offset, usize size) -> Status;
+
+        auto unpin_range_locked(VirtAddr offset, usize size) -> void;
+
+        /// Mark the committed pages within [offset, offset + size) as dirty.
+        auto mark_dirty_locked(VirtAddr offset, usize size) -> void;
+
+        FORCE_INLINE
+        auto is_dirty_locked(PgOff index) const -> bool {
+            return pagemap_.test_mark(index, VmPageMap::Mark::Dirty);
+        }
+
         auto make_cursor(VirtAddr offset, usize size) -> ustl::Result<Cursor, Status>;
 
+        /// Create a snapshot of this object. Committed pages are shared with the clone rather
+        /// than copied, and either side copies a page only before it writes to it. Pinned
+        /// pages can not wait for that and are copied here.
+        ///
+        /// Mappings of this object still map the shared pages writable, the caller must
+        /// write-protect them.
+        auto clone_locked(ustl::Rc<VmCowPages> *out) -> Status;
+
+        /// Make the page at |index| exclusive to this object, so it can be written. A shared
+        /// entry is copied as a whole, unless the others have dropped it already. Return true
+        /// if pages moved. |first| and |order| tell the entry at |index|, a single page if
+        /// there is none.
+        auto break_cow_locked(PgOff index, ai_out PgOff *first, ai_out usize *order) -> ustl::Result<bool, Status>;
+
         FORCE_INLINE
         auto size_locked() const -> usize {
             return size_;
         }
+
+        FORCE_INLINE
+        auto set_mem_policy_locked(MemPolicy const &policy) -> void {
+            policy_ = policy;
+        }
+
+        /// The policy given to this object, or that of the running thread if none.
+        FORCE_INLINE
+        auto mem_policy_locked() const -> MemPolicy {
+            return policy_ ? *policy_ : MemPolicy::current();
+        }
+        /// All pages left are given back to PMM.
+        virtual ~VmCowPages() override;
     private:
         VmCowPages(Gaf gaf, usize num_pages);
 
-        auto alloc_pages(usize order, VmPage **page, PageRequest *page_request) -> Status;
+        auto alloc_pages(PgOff index, usize order, VmPage **page, PageRequest *page_request) -> Status;
+
+        /// Commit the folio of `VMO_FOLIO_ORDER` covering |index| if none of its pages is
+        /// present, so it can be mapped by a large page. Return the number of pages committed,
+        /// zero if the range is not fully inside this object or no folio is available.
+        auto commit_folio_locked(MemPolicy const &policy, PgOff index) -> usize;
+
+        /// Commit absent pages within [first, last) spreading them by `Interleave`.
+        auto commit_interleaved_locked(MemPolicy const &policy, PgOff first, PgOff last, ai_out usize *nr_commited) 
+            -> Status;
+
+        /// Allocate a folio of |order| and copy the pages of |head| into it.
+        auto copy_folio_locked(PgOff first, VmPage *head, usize order) -> PmFrame *;
+
+        /// Drop a reference to the entry headed by |head|, the last one frees it.
+        static auto release_folio(VmPage *head, usize order) -> void;
+
+        /// Insert a fresh folio of |order| at |first| and take the ownership of it.
+        auto insert_owned_page_locked(PgOff first, PmFrame *frame, usize order = 0) -> VmPage *;
+
+        /// Call |f(head, order)| on each entry touched by [offset, offset + size). Stop at
+        /// the first absent page and return `NotFound`.
+        template <typename F>
+        auto for_each_entry_locked(VirtAddr offset, usize size, F &&f) -> Status;
 
         /// When no page sources exists, it will be used in frame allocation request.
         Gaf gaf_;
+        ustl::Option<MemPolicy> policy_;
         /// Page map that operates within the virtual memory range of the VMO, from [0, N).
         VmPageMap pagemap_;
         ustl::Rc<PageSource> page_source_;
@@ -54,12 +121,29 @@ namespace ours::mem {
     public:
         Cursor(VmCowPages *owner, VirtAddr offset, usize size);
 
-        auto require_owned_page(usize nr_pages, PageRequest *page_request) -> ustl::Result<VmPage *, Status>;
+        /// Return the page at the cursor and advance it, the page is allocated if absent.
+        /// |shared| tells whether it is shared with a clone, which must not be written.
+        auto require_page(usize nr_pages, PageRequest *page_request, ai_out bool *shared) 
+            -> ustl::Result<VmPage *, Status>;
+
+        /// Make the page at the cursor exclusive without advancing, so it can be written.
+        /// Return true if it moved, along with the range of the VMO replaced. The old pages
+        /// may be still mapped, see `VmObject::unmap_mappings`.
+        auto break_cow(ai_out VirtAddr *offset, ai_out usize *size) -> ustl::Result<bool, Status>;
+
+        /// Populate |nr_pages| pages from the cursor in batch without advancing it.
+        auto commit_pages(usize nr_pages) -> Status;
+
+        /// Return the page at the cursor if it is present and advance the cursor, nothing
+        /// is allocated.
+        auto lookup_page(ai_out bool *shared = nullptr) -> VmPage *;
 
         auto create_read_request(usize nr_pages, PageRequest *page_request) -> Status;
         auto create_dirty_request(usize nr_pages, PageRequest *page_request) -> Status;
     private:
         VmCowPages *owner_;
+        VirtAddr offset_;
+        VirtAddr end_;
     };
 
 } // namespace ours::mem
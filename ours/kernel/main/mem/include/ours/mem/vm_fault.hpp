@@ -20,8 +20,8 @@ namespace ours::mem {
     enum class VmfCause {
         None,
         Write = BIT(0),
-        Absent = BIT(0),
-        User = BIT(0),
+        Absent = BIT(1),
+        User = BIT(2),
     };
     USTL_ENABLE_ENUM_BITMASK(VmfCause);
 
@@ -46,6 +46,9 @@ namespace ours::mem {
         auto make_enumerator(VirtAddr base, usize size)
             -> Enumerator;
 
+        /// Take the same regions as |other|, this set must be empty.
+        auto copy_from(MappingRegionSet const &other) -> Status;
+
         struct Region: public ustl::collections::intrusive::SetBaseHook<> {
             typedef Region  Self;
             typedef ustl::collections::intrusive::SetBaseHook<> Base;
@@ -139,24 +142,54 @@ namespace ours::mem {
 
         auto unmap(VirtAddr offset, usize, UnmapControl) -> Status;
 
-        auto fault(VmFault *vmf) -> void;
+        /// Map the page faulted at and, if the access looks sequential, up to
+        /// `kMaxFaultAround` pages after it in the same batch.
+        auto fault(VmFault *vmf) -> Status;
+
+        /// The most pages mapped by a fault.
+        CXX11_CONSTEXPR
+        static usize const kMaxFaultAround = 16;
 
         VmMapping(VmArea *, VirtAddr, usize, VmaFlags, ustl::Rc<VmObject>, usize, char const *);
         virtual ~VmMapping() = default;
       private:
         friend class VmArea;
         friend class VmObject;
+        friend class VmObjectPaged;
+        friend class VmAspace;
+
+        /// Create a mapping of the same range and MMU flags of |vmo| in |parent| for a clone
+        /// of the address space. Which VMO it maps is decided by `VmAspace::clone`.
+        auto clone_locked(VmArea *parent, ustl::Rc<VmObject> vmo, ustl::Rc<VmMapping> *out) -> Status;
+
+        /// Drop the write permission of the pages mapped, so the next write to each faults.
+        /// It takes one walk of page table per writable region, not per page.
+        auto write_protect_locked() -> void;
+
+        /// Unmap the part of [offset, offset + size) of the VMO which this mapping covers.
+        auto unmap_vmo_range(VirtAddr offset, usize size) -> void;
 
         auto map_paged(VmObjectPaged *vmo, VirtAddr base, usize size, bool commit, MapControl control) -> Status;
 
         auto map_physical(VmObjectPhysical *vmo, VirtAddr base, usize size, MapControl control) -> Status;
 
+        /// Map up to |nr_pages| pages from |base| for a fault, only the first one is required.
+        /// On |write| the first page is made exclusive to the VMO before it is mapped.
+        /// On success |nr_mapped| is set to the number of pages mapped.
+        auto fault_paged(VmObjectPaged *vmo, VirtAddr base, usize nr_pages, MmuFlags mmuf, bool write,
+                         usize *nr_mapped) -> Status;
+
         virtual auto activate() -> Status override;
         virtual auto destroy() -> Status override;
 
         ustl::Rc<VmObject> vmo_;
         usize vmo_off_;
         MappingRegionSet regions_;
+        /// Where the next fault lands if accesses go sequentially, that is, the end of the
+        /// pages mapped by the last one.
+        VirtAddr fault_next_;
+        /// Pages a fault tries to map. It doubles on sequential faults and halves on others.
+        usize fault_window_;
         ustl::collections::intrusive::ListMemberHook<> list_hook_;
       public:
         USTL_DECLARE_HOOK_OPTION(Self, list_hook_, VmoListHookOptions);
@@ -116,6 +116,10 @@ namespace ours::mem {
             mappings_.erase(mappings_.iterator_to(mapping));
         }
 
+        /// Unmap [offset, offset + size) of this object from all mappings of it, after the
+        /// pages there are replaced. They are mapped again on the next fault.
+        auto unmap_mappings(VirtAddr offset, usize size) -> void;
+
         USTL_NO_MOVEABLE_AND_COPYABLE(VmObject);
     protected:
         VmObject(Type type, VmoFLags vmoflags);
@@ -23,10 +23,17 @@ namespace ours::mem {
         typedef VmObject        Base;
         typedef VmObjectPaged   Self;
     public:
-        static auto create(Gaf gaf, usize size, VmoFLags vmof, ustl::Rc<VmObjectPaged> *out) -> Status;
+        /// If |policy| is not given, pages follow the policy of the thread committing them.
+        static auto create(Gaf gaf, usize size, VmoFLags vmof, ustl::Rc<VmObjectPaged> *out, 
+                           ustl::Option<MemPolicy> const &policy = ustl::NONE) -> Status;
 
         static auto create_contiguous(Gaf gaf, usize size, VmoFLags vmof, ustl::Rc<VmObjectPaged> *out) -> Status;
 
+        /// Create a snapshot of this VMO in constant time of the pages, which are shared
+        /// with it and copied on write by either side. Mappings of this VMO are write-protected,
+        /// the caller must hold the lock of |aspace|, those of other address spaces are taken.
+        auto create_clone(VmAspace *aspace, ustl::Rc<VmObjectPaged> *out) -> Status;
+
         /// 
         virtual auto commit_range(VirtAddr offset, usize size, CommitOptions option) -> Status override;
 
@@ -45,6 +52,11 @@ namespace ours::mem {
         ///
         virtual auto write(void *out, VirtAddr offset, usize size) -> Status override;
 
+        /// Only affects pages committed after it.
+        auto set_mem_policy(MemPolicy const &policy) -> void;
+
+        auto mem_policy() -> MemPolicy;
+
         FORCE_INLINE
         auto make_cursor(VirtAddr offset, usize size) -> ustl::Result<VmCowPages::Cursor, Status> {
             return cow_pages_->make_cursor(offset, size);
@@ -56,6 +68,9 @@ namespace ours::mem {
     private:
         auto commit_range_internal(PgOff offset, usize n, CommitOptions option) -> Status;
 
+        /// Make the committed pages within [offset, offset + size) exclusive to this VMO.
+        auto break_cow_range_locked(VirtAddr offset, usize size) -> Status;
+
         ustl::Rc<VmCowPages> cow_pages_;
         Mutex mutex_;
     };
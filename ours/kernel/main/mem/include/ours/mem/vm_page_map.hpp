@@ -12,40 +12,138 @@
 #define OURS_MEM_VM_PAGE_MAP_HPP 1
 
 #include <ours/const.hpp>
+#include <ours/status.hpp>
 #include <ours/mem/gaf.hpp>
 #include <ours/mem/vm_page.hpp>
 
 #include <ktl/new.hpp>
 #include <ktl/allocator.hpp>
 #include <ktl/xarray.hpp>
-#include <ustl/bitfields.hpp>
+#include <ustl/option.hpp>
 
 namespace ours::mem {
+    /// Pages of a VMO indexed by their page offset in it. A folio takes a single entry of
+    /// its order, the head page is stored and the others are found by their distance to it.
     class VmPageMap {
+        typedef ktl::Xarray<ktl::Allocator<char>>   PageArray;
     public:
-        enum class Tag {
-            Owned,
-            Borrowed = BIT(0),
+        /// Marks are kept per entry, so one on a folio applies to all pages of it.
+        enum class Mark {
+            /// Written since it was committed or cleaned.
+            Dirty,
+            /// Must stay where it is until unpinned, for DMA and the like.
+            Pinned,
+            /// Not owned by this map but lent by another object.
+            Borrowed,
+            /// Also held by a clone, so it is copied before written. The number of holders
+            /// is kept by `VmPage::num_users` of the head page.
+            Shared,
+            MaxNumMarks,
         };
+        static_assert(usize(Mark::MaxNumMarks) <= PageArray::kNumBitTags);
 
+        /// Return the page at |index|, which is a tail one if it lies in a folio.
         FORCE_INLINE
-        auto get_page(PgOff index) -> VmPage * {
-            auto option = pages_.load(index).cast_to<VmPage *>();
-            if (!option) {
+        auto get_page(PgOff index) const -> VmPage * {
+            PgOff first;
+            usize order;
+            auto const head = get_folio(index, &first, &order);
+            if (!head || first == index) {
+                return head;
+            }
+            return role_cast<PfRole::Vmm>(head->to_pmm() + (index - first));
+        }
+
+        /// Return the head page of the entry covering |index|, with its first index and order.
+        FORCE_INLINE
+        auto get_folio(PgOff index, PgOff *first, usize *order) const -> VmPage * {
+            return pages_.lookup(index, first, order).pointer<VmPage>();
+        }
+
+        FORCE_INLINE
+        auto insert_page(PgOff index, VmPage *page) -> Status {
+            return insert_folio(index, page, 0);
+        }
+
+        /// Insert the folio of 2^|order| pages headed by |head| at |first|, which must be
+        /// aligned to the order. Return `AlreadyExists` if any page in the range is present.
+        FORCE_INLINE
+        auto insert_folio(PgOff first, VmPage *head, usize order) -> Status {
+            // The store replaces an entry of the same place and order, which would leak it.
+            if (!pages_.load(first).is_null()) {
+                return Status::AlreadyExists;
+            }
+
+            auto result = pages_.store(first, PageArray::make_entry(head), order);
+            if (!result) {
+                return result.unwrap_err();
+            }
+            return Status::Ok;
+        }
+
+        /// Replace the head page of the entry at |first| of |order| with |head| and return the
+        /// old one. Marks are kept.
+        FORCE_INLINE
+        auto replace_folio(PgOff first, VmPage *head, usize order) -> VmPage * {
+            auto result = pages_.store(first, PageArray::make_entry(head), order);
+            if (!result) {
                 return nullptr;
             }
-            return *option;
+            return result.unwrap().pointer<VmPage>();
+        }
+
+        /// Remove the entry covering |index| and return its head page, the caller owns it then.
+        FORCE_INLINE
+        auto remove_folio(PgOff index) -> VmPage * {
+            return pages_.erase(index).pointer<VmPage>();
         }
 
+        /// Return false if no page is present at |index|.
         FORCE_INLINE
-        auto insert_page(PgOff index, VmPage *page, Tag tag = Tag::Owned) -> void {
-            pages_.store(index, pages_.make_entry(page));
+        auto set_mark(PgOff index, Mark mark) -> bool {
+            return pages_.set_mark(index, usize(mark));
         }
-    
+
+        FORCE_INLINE
+        auto clear_mark(PgOff index, Mark mark) -> void {
+            pages_.clear_mark(index, usize(mark));
+        }
+
+        FORCE_INLINE
+        auto test_mark(PgOff index, Mark mark) const -> bool {
+            return pages_.get_mark(index, usize(mark));
+        }
+
+        /// Return the first index of the first entry with |mark| at or after |index|.
+        FORCE_INLINE
+        auto find_mark(PgOff index, Mark mark) const -> ustl::Option<PgOff> {
+            return pages_.find_mark(index, usize(mark));
+        }
+
+        /// Call |f(first, head, order)| for each entry in increasing order of index.
+        template <typename F>
+        FORCE_INLINE
+        auto for_each(F &&f) const -> void {
+            pages_.for_each([&f] (usize index, PageArray::Entry entry, usize order) {
+                f(PgOff(index), entry.pointer<VmPage>(), order);
+            });
+        }
+
+        /// Drop all entries without touching the pages.
+        FORCE_INLINE
+        auto clear() -> void {
+            pages_.clear();
+        }
+
+        FORCE_INLINE
+        auto is_empty() const -> bool {
+            return pages_.is_empty();
+        }
+
     private:
-        ktl::Xarray<ktl::Allocator<char>>  pages_;
+        PageArray pages_;
     };
 
 } // namespace ours::mem
 
-#endif // #ifndef OURS_MEM_VM_PAGE_MAP_HPP
\ No newline at end of file
+#endif // #ifndef OURS_MEM_VM_PAGE_MAP_HPP
@@ -0,0 +1,114 @@
+/// Copyright(C) 2024 smallhuazi
+///
+/// This program is free software; you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published
+/// by the Free Software Foundation; either version 2 of the License, or
+/// (at your option) any later version.
+///
+/// For additional information, please refer to the following website:
+/// https://opensource.org/license/gpl-2-0
+///
+#ifndef OURS_MEM_ZEROED_POOL_HPP
+#define OURS_MEM_ZEROED_POOL_HPP 1
+
+#include <ours/mem/gaf.hpp>
+#include <ours/mem/pm_frame.hpp>
+#include <ours/mem/memory_model.hpp>
+#include <ours/arch/zero-page.hpp>
+
+#include <ustl/sync/atomic.hpp>
+#include <ustl/sync/mutex.hpp>
+#include <ustl/sync/lockguard.hpp>
+
+namespace ours::mem {
+    /// Zero the block of |order| at |frame| with the fastest kernel on this CPU.
+    FORCE_INLINE
+    auto zero_frames(PmFrame *frame, usize order) -> void {
+        arch_zero_pages(frame_to_virt(frame), BIT(order) << PAGE_SHIFT);
+    }
+
+    /// `ZeroedPool` holds frames of order 0 which have been zeroed ahead of time by an idle
+    /// worker, so that anonymous faults do not pay for zeroing on the critical path.
+    ///
+    /// Frames in the pool have been taken out of their zones, they are given back by the
+    /// reclaimer of the pool under memory pressure.
+    class ZeroedPool {
+        typedef ZeroedPool  Self;
+    public:
+        /// The worker starts refilling once the pool drops below it.
+        CXX11_CONSTEXPR
+        static usize const kLowMark = 64;
+
+        CXX11_CONSTEXPR
+        static usize const kHighMark = 512;
+
+        /// Frames are allocated as user ones, only requests of the same migrate type are
+        /// served from the pool so pageblocks do not get mixed.
+        CXX11_CONSTEXPR
+        static Gaf const kGaf = Gaf::OnlyThisNode | Gaf::ZoneNormal | Gaf::Movable;
+
+        FORCE_INLINE CXX11_CONSTEXPR
+        static auto can_serve(Gaf gaf, usize order) -> bool {
+            return !order && !!(gaf & Gaf::Zero) && gaf_zone_type(gaf) == ZoneType::Normal &&
+                   gaf_migrate_type(gaf) == gaf_migrate_type(kGaf);
+        }
+
+        FORCE_INLINE
+        auto take() -> PmFrame * {
+            // Avoid touching the lock if the pool is obviously empty.
+            if (!count()) {
+                return nullptr;
+            }
+
+            ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+            if (frames_.empty()) {
+                return nullptr;
+            }
+
+            auto frame = &frames_.front();
+            frames_.pop_front();
+            count_.fetch_sub(1, ustl::sync::MemoryOrder::Relaxed);
+            return frame;
+        }
+
+        /// Take over |n| frames zeroed just now in |list|.
+        FORCE_INLINE
+        auto put(FrameList<> &list, usize n) -> void {
+            ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+            frames_.splice(frames_.end(), list);
+            count_.fetch_add(n, ustl::sync::MemoryOrder::Relaxed);
+        }
+
+        /// Move at most |n| frames into |out|, return the number moved.
+        auto drain(usize n, FrameList<> &out) -> usize {
+            ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+
+            usize i = 0;
+            for (; i < n && !frames_.empty(); ++i) {
+                auto &frame = frames_.back();
+                frames_.pop_back();
+                out.push_back(frame);
+            }
+            count_.fetch_sub(i, ustl::sync::MemoryOrder::Relaxed);
+            return i;
+        }
+
+        FORCE_INLINE
+        auto count() const -> usize {
+            return count_.load(ustl::sync::MemoryOrder::Relaxed);
+        }
+
+        FORCE_INLINE
+        auto needs_refill() const -> bool {
+            return count() < kLowMark;
+        }
+
+    private:
+        ustl::sync::Mutex mutex_;
+        ustl::sync::AtomicUsize count_;
+        FrameList<> frames_;
+    };
+
+} // namespace ours::mem
+
+#endif // #ifndef OURS_MEM_ZEROED_POOL_HPP
\ No newline at end of file
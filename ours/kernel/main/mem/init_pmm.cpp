@@ -28,12 +28,15 @@
 
 #include <arch/cache.hpp>
 
+#include <gktl/init_hook.hpp>
+
 using ustl::algorithms::min;
 using ustl::algorithms::max;
 using ustl::algorithms::clamp;
 
 namespace ours::mem {
     auto init_object_cache() -> void;
+    auto init_cma() -> void;
 
     bool g_pmm_enabled = false;
 
@@ -181,8 +184,19 @@ namespace ours::mem {
         init_memory_model(true);
         global_memory_model().dump();
 
+        // CMA areas must be carved out before the rest of memory is handed over to buddy.
+        init_cma();
+
         EarlyMem::do_handoff();
 
+        // All free frames have been handed over to zones, so their water marks are settled.
+        global_node_states().for_each_online([] (NodeId nid) {
+            auto zq = PmNode::node(nid)->zone_queues();
+            for (auto zone : zq->get_queue(ZoneQueues::LocalContiguous)) {
+                zone->init_watermarks();
+            }
+        });
+
         init_object_cache();
         ktl::init_kmalloc();
 
@@ -194,6 +208,19 @@ namespace ours::mem {
         });
     }
 
+    /// The frame caches per cpu live in the dynamic cpu local area, which is not
+    /// available for all CPUs until `CpuLocal::init`.
+    INIT_CODE
+    static auto init_pcpu_frame_cache() -> void {
+        global_node_states().for_each_online([] (NodeId nid) {
+            auto zq = PmNode::node(nid)->zone_queues();
+            for (auto zone : zq->get_queue(ZoneQueues::LocalContiguous)) {
+                zone->init_pcpu_cache();
+            }
+        });
+    }
+    GKTL_INIT_HOOK(PcpuFrameCacheInit, init_pcpu_frame_cache, gktl::InitLevel::CpuLocal);
+
     INIT_CODE
     auto handoff_early_pmm(phys::MemoryHandoff &mh) -> Status {
         EarlyMem::s_bootmem = &mh.bootmem;
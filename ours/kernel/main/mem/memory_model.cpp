@@ -65,7 +65,10 @@ namespace ours::mem {
         global_node_states().for_each_possible([&] (NodeId nid) {
             EarlyMem::IterationContext context(bootmem::RegionType::Normal, nid);
             while (auto region = EarlyMem::iterate(context)) {
-                add_range(region->base, region->end(), nid);
+                if (Status::Ok == add_range(region->base, region->end(), nid)) {
+                    // Memory known at boot is in use from the beginning.
+                    mark_section(phys_to_secnum(region->base), phys_to_secnum(region->end()) + 1, PmSection::State::Online);
+                }
             }
         });
 
@@ -127,8 +130,10 @@ namespace ours::mem {
 
             start_pfn = phys_to_pfn(region->base);
             end_pfn = phys_to_pfn(region->end());
+            // Frames beyond the early part of the node are left to its worker.
+            auto const early_end_pfn = ustl::algorithms::min(end_pfn, node->deferred_frames().start_pfn());
             for (auto zone: node->zone_queues()->get_queue(ZoneQueues::LocalContiguous)) {
-                start_pfn = init_zone_framemap(*zone, start_pfn, end_pfn, hole_start_pfn);
+                start_pfn = init_zone_framemap(*zone, start_pfn, early_end_pfn, hole_start_pfn);
                 hole_start_pfn = end_pfn;
             }
         }
@@ -244,8 +249,12 @@ namespace ours::mem {
 
     auto MemoryModel::mark_section(SecNum begin, SecNum end, PmSection::State state) 
         -> void {
-        while (begin != end) {
+        while (begin < end) {
             auto section = secnum_to_section(begin);
+            if (!section) {
+                begin += 1;
+                continue;
+            }
             section->set_state(state);
             begin += kLeavesPerLevel[section->level()];
         }
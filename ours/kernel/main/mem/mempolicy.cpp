@@ -0,0 +1,91 @@
+#include <ours/mem/mempolicy.hpp>
+#include <ours/mem/node-states.hpp>
+#include <ours/mem/pm_node.hpp>
+#include <ours/mem/pmm.hpp>
+
+#include <ours/task/thread.hpp>
+
+namespace ours::mem {
+    FORCE_INLINE
+    static auto first_node(NodeMask const &nodes) -> NodeId {
+        for (NodeId nid = 0; nid < MAX_NODE; ++nid) {
+            if (nodes.test(nid)) {
+                return nid;
+            }
+        }
+        return current_node();
+    }
+
+    auto MemPolicy::current() -> Self {
+        if (auto const thread = task::Thread::Current::get()) {
+            return thread->mem_policy();
+        }
+        return local();
+    }
+
+    auto MemPolicy::preferred_node(PgOff index) const -> NodeId {
+        // Only online nodes are picked, `PmNode::node` has nothing for the others.
+        auto nodes = allowed_nodes();
+        switch (mode_) {
+            case MemPolicyMode::Preferred: {
+                nodes &= nodes_;
+                return first_node(nodes);
+            }
+            case MemPolicyMode::Bind: {
+                auto const nid = current_node();
+                return nodes.test(nid) ? nid : first_node(nodes);
+            }
+            case MemPolicyMode::Interleave: {
+                auto const nr_nodes = nodes.count();
+                if (!nr_nodes) {
+                    break;
+                }
+                auto nth = index % nr_nodes;
+                for (NodeId nid = 0; nid < MAX_NODE; ++nid) {
+                    if (nodes.test(nid) && !nth--) {
+                        return nid;
+                    }
+                }
+                break;
+            }
+            default: break;
+        }
+
+        return current_node();
+    }
+
+    auto MemPolicy::allowed_nodes() const -> NodeMask {
+        switch (mode_) {
+            case MemPolicyMode::Bind:
+            case MemPolicyMode::Interleave: {
+                NodeMask nodes = nodes_;
+                nodes &= node_online_mask();
+                return nodes;
+            }
+            default:
+                return node_online_mask();
+        }
+    }
+
+    auto MemPolicy::apply(Gaf gaf) const -> Gaf {
+        if (MemPolicyMode::Local == mode_) {
+            return gaf;
+        }
+
+        // Walk the zones of other nodes by distance, `allowed_nodes` filters them.
+        return gaf & ~Gaf::OnlyThisNode;
+    }
+
+    auto alloc_frame(MemPolicy const &policy, PgOff index, Gaf gaf, usize order) -> PmFrame * {
+        return alloc_frame(policy.preferred_node(index), policy.apply(gaf), order, policy.allowed_nodes());
+    }
+
+    auto alloc_frames_bulk(MemPolicy const &policy, Gaf gaf, ai_out FrameList<> *list, usize n) -> Status {
+        auto const node = PmNode::node(policy.preferred_node());
+        if (!node) {
+            return Status::InvalidArguments;
+        }
+        return node->alloc_frames_bulk(policy.apply(gaf), n, list, policy.allowed_nodes());
+    }
+
+} // namespace ours::mem
@@ -0,0 +1,48 @@
+#include <ours/mem/object-cache.hpp>
+#include <ours/mem/memory_model.hpp>
+#include <ours/mem/pmm.hpp>
+#include <ours/tests/test.hpp>
+#include <ours/assert.hpp>
+
+#include <gktl/init_hook.hpp>
+
+namespace ours::test {
+    /// Objects of 6 KiB live in slabs of order 3, most of them start in a tail frame. It
+    /// is freed through the folio found from the object, which must be the slab head.
+    OTEST_ABI
+    static auto free_object_in_tail_frame() -> void {
+        CXX11_CONSTEXPR
+        static usize const kObjectSize = 6144;
+
+        CXX11_CONSTEXPR
+        static usize const kMaxObjects = 8;
+
+        auto const cache = mem::ObjectCache::create("tail-frame-test", kObjectSize, alignof(usize), {});
+        DEBUG_ASSERT(cache, "Failed to create object cache");
+
+        void *objects[kMaxObjects];
+        void *in_tail = nullptr;
+        usize n = 0;
+        while (n < kMaxObjects && !in_tail) {
+            auto const object = cache->allocate(mem::kGafKernel, mem::current_node());
+            DEBUG_ASSERT(object, "Out of memory");
+            objects[n++] = object;
+
+            if (mem::virt_to_frame(object) != mem::virt_to_folio(object)) {
+                in_tail = object;
+            }
+        }
+        DEBUG_ASSERT(in_tail, "No object lives in a tail frame");
+
+        auto const folio = mem::virt_to_folio(in_tail);
+        DEBUG_ASSERT(folio->is_role(mem::PfRole::Slab), "The head of a slab is not found");
+        DEBUG_ASSERT(folio->order() > 0, "A slab of 6 KiB objects must be of a high order");
+
+        for (usize i = 0; i < n; ++i) {
+            cache->do_deallocate(objects[i]);
+        }
+        cache->shrink();
+    }
+    GKTL_INIT_HOOK(ObjectCacheTailFrameTest, free_object_in_tail_frame, gktl::InitLevel::Platform);
+
+} // namespace ours::test
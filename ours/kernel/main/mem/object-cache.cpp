@@ -2,14 +2,35 @@
 #include <ours/mem/pmm.hpp>
 #include <ours/mem/node-states.hpp>
 #include <ours/mem/early-mem.hpp>
+#include <ours/mem/reclaim.hpp>
+#include <ours/task/grace-period.hpp>
 
 #include <ustl/lazy_init.hpp>
+#include <ustl/sync/lockguard.hpp>
+#include <ustl/algorithms/minmax.hpp>
+#include <ustl/algorithms/copy.hpp>
+#include <ustl/mem/align.hpp>
+#include <ustl/limits.hpp>
+#include <ustl/bit.hpp>
 #include <logz4/log.hpp>
 #include <ktl/new.hpp>
+#include <ktl/kmalloc.hpp>
+
+#include <arch/cache.hpp>
+#include <arch/intr_disable_guard.hpp>
 
 namespace ours::mem {
     static ObjectCache *s_object_cache_self;
     static ObjectCache *s_object_cache_node;
+    static ObjectCache *s_magazine_cache;
+
+    /// Slabs of `TypeSafeByRcu` caches wait for a grace period before going back to PMM.
+    /// Those in |s_rcu_waiting| wait for |s_rcu_grace|, later ones gather in |s_rcu_next|
+    /// until it ends.
+    static Mutex s_rcu_mutex;
+    static SlabList<> s_rcu_waiting;
+    static SlabList<> s_rcu_next;
+    static task::GracePeriod s_rcu_grace;
 
     INIT_DATA
     static ustl::LazyInit<ObjectCache> s_bootstrap_object_cache;
@@ -23,22 +44,41 @@ namespace ours::mem {
             return nullptr;
         }
 
-        auto object = ustl::mem::address_of(free_list.front());
-        free_list.pop_front();
+        Object *object;
+        if (free_index) {
+            auto const base = frame_to_virt<u8>(to_pmm());
+            object = reinterpret_cast<Object *>(base + free_index[num_objects - num_inuse - 1]);
+        } else {
+            object = ustl::mem::address_of(free_list.front());
+            free_list.pop_front();
+        }
         num_inuse += 1;
         return object;
     }
 
-    auto Slab::init(ObjectCache *oc, usize order, usize obj_size) -> Status {
+    auto Slab::init(ObjectCache *oc, usize order, usize obj_size, usize offset) -> Status {
         num_inuse = 0;
-        num_objects = BIT(order) * PAGE_SIZE / obj_size;
+        num_objects = (BIT(order) * PAGE_SIZE - offset) / obj_size;
+        free_index = nullptr;
 
-        auto object = frame_to_virt<Object>(to_pmm());
-        for (auto i = 0; i < num_objects; ++i) {
-            free_list.push_front(*object);
-            object = reinterpret_cast<Object *>(
-                reinterpret_cast<u8 *>(object) + obj_size
-            );
+        if (oc->is_off_slab()) {
+            free_index = static_cast<u16 *>(ktl::kmalloc(sizeof(u16) * num_objects, kGafKernel));
+            if (!free_index) {
+                return Status::OutOfMem;
+            }
+
+            // Lower objects are on the top, so they are handed out first.
+            for (usize i = 0; i < num_objects; ++i) {
+                free_index[i] = u16(offset + (num_objects - i - 1) * obj_size);
+            }
+        } else {
+            auto object = reinterpret_cast<Object *>(frame_to_virt<u8>(to_pmm()) + offset);
+            for (auto i = 0; i < num_objects; ++i) {
+                free_list.push_front(*object);
+                object = reinterpret_cast<Object *>(
+                    reinterpret_cast<u8 *>(object) + obj_size
+                );
+            }
         }
 
         object_cache = oc;
@@ -46,13 +86,25 @@ namespace ours::mem {
         return Status::Ok;
     }
 
-    auto Slab::create(ObjectCache *oc, Gaf gaf, usize order, usize obi_size, NodeId nid) -> Slab * {
-        auto frame = mem::alloc_frame(nid, gaf, order);
+    auto Slab::destory() -> void {
+        DEBUG_ASSERT(num_inuse == 0);
+        unlink();
+        if (free_index) {
+            ktl::kfree(free_index);
+            free_index = nullptr;
+        }
+        mem::free_frame(to_pmm(), order());
+    }
+
+    auto Slab::create(ObjectCache *oc, Gaf gaf, usize order, usize obi_size, usize offset, NodeId nid) -> Slab * {
+        // Objects are referenced by raw pointers, so a slab can never be migrated.
+        auto frame = mem::alloc_frame(nid, gaf & ~Gaf::Movable, order);
         if (!frame) {
             return nullptr;
         }
+        frame->set_order(order);
         auto slab = role_cast<PfRole::Slab>(frame);
-        auto status = slab->init(oc, order, obi_size);
+        auto status = slab->init(oc, order, obi_size, offset);
         if (Status::Ok != status) {
             mem::free_frame(frame, order);
             return nullptr;
@@ -77,8 +129,272 @@ namespace ours::mem {
         s_object_cache_node->deallocate(this);
     }
 
+    auto ObjectCachePerNode::relink_slab(Slab *slab, usize old_inuse) -> void {
+        enum class State {
+            Empty,
+            Partial,
+            Full,
+        };
+        auto const state_of = [slab] (usize inuse) {
+            if (inuse == 0) {
+                return State::Empty;
+            } else if (inuse == slab->num_objects) {
+                return State::Full;
+            }
+            return State::Partial;
+        };
+
+        auto const old_state = state_of(old_inuse);
+        auto const new_state = state_of(slab->num_inuse);
+        if (old_state == new_state) {
+            return;
+        }
+
+        slab->unlink();
+        switch (old_state) {
+            case State::Empty: num_empty -= 1; break;
+            case State::Partial: num_partial -= 1; break;
+            case State::Full: num_full -= 1; break;
+        }
+        switch (new_state) {
+            case State::Empty: slabs_empty.push_back(*slab); num_empty += 1; break;
+            case State::Partial: slabs_partial.push_back(*slab); num_partial += 1; break;
+            case State::Full: slabs_full.push_back(*slab); num_full += 1; break;
+        }
+    }
+
+    auto ObjectCachePerNode::add_slab(Slab *slab) -> void {
+        ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+        if (slab->is_empty()) {
+            slabs_empty.push_back(*slab);
+            num_empty += 1;
+        } else if (slab->has_object()) {
+            slabs_partial.push_back(*slab);
+            num_partial += 1;
+        } else {
+            slabs_full.push_back(*slab);
+            num_full += 1;
+        }
+        num_slabs += 1;
+    }
+
+    auto ObjectCachePerNode::get_object() -> Object * {
+        ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+
+        // Partial slabs go first, so that empty ones stay as they are and can be freed.
+        Slab *slab = nullptr;
+        if (num_partial) {
+            slab = &slabs_partial.front();
+        } else if (num_empty) {
+            slab = &slabs_empty.front();
+        } else {
+            return nullptr;
+        }
+
+        usize const old_inuse = slab->num_inuse;
+        auto const object = slab->get_object();
+        relink_slab(slab, old_inuse);
+        return object;
+    }
+
+    auto ObjectCachePerNode::put_object_locked(Slab *slab, Object *object, usize max_empty) -> bool {
+        usize const old_inuse = slab->num_inuse;
+        slab->put_object(object);
+        relink_slab(slab, old_inuse);
+        if (!slab->is_empty() || num_empty <= max_empty) {
+            return false;
+        }
+
+        slab->unlink();
+        num_empty -= 1;
+        num_slabs -= 1;
+        return true;
+    }
+
+    auto ObjectCachePerNode::put_object(Slab *slab, Object *object, usize max_empty) -> Slab * {
+        ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+        if (put_object_locked(slab, object, max_empty)) {
+            return slab;
+        }
+        return nullptr;
+    }
+
+    auto ObjectCachePerNode::get_objects(usize n, void **out) -> usize {
+        ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+
+        usize nr_got = 0;
+        while (nr_got < n) {
+            Slab *slab = nullptr;
+            if (num_partial) {
+                slab = &slabs_partial.front();
+            } else if (num_empty) {
+                slab = &slabs_empty.front();
+            } else {
+                break;
+            }
+
+            usize const old_inuse = slab->num_inuse;
+            while (nr_got < n && slab->has_object()) {
+                out[nr_got++] = slab->get_object();
+            }
+            relink_slab(slab, old_inuse);
+        }
+
+        return nr_got;
+    }
+
+    auto ObjectCachePerNode::put_objects(usize n, void **objects, usize max_empty, SlabList<> &victims) -> void {
+        ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+
+        for (usize i = 0; i < n; ++i) {
+            auto const slab = role_cast<PfRole::Slab>(virt_to_folio(objects[i]));
+            if (put_object_locked(slab, static_cast<Object *>(objects[i]), max_empty)) {
+                victims.push_back(*slab);
+            }
+        }
+    }
+
+    auto ObjectCachePerNode::push_remote(void *object) -> void {
+        auto const remote = static_cast<RemoteObject *>(object);
+        auto head = remote_frees.load(ustl::sync::MemoryOrder::Relaxed);
+        do {
+            remote->next = head;
+        } while (!remote_frees.compare_exchange_weak(head, remote,
+            ustl::sync::MemoryOrder::Release, 
+            ustl::sync::MemoryOrder::Relaxed
+        ));
+    }
+
+    auto ObjectCachePerNode::drain_remote(usize max_empty, SlabList<> &victims) -> usize {
+        // Peek first, so that an empty list costs no write to the shared line.
+        if (!remote_frees.load(ustl::sync::MemoryOrder::Relaxed)) {
+            return 0;
+        }
+
+        auto remote = remote_frees.exchange(nullptr, ustl::sync::MemoryOrder::Acquire);
+
+        ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+        usize nr_drained = 0;
+        while (remote) {
+            auto const next = remote->next;
+            auto const slab = role_cast<PfRole::Slab>(virt_to_folio(remote));
+            if (put_object_locked(slab, reinterpret_cast<Object *>(remote), max_empty)) {
+                victims.push_back(*slab);
+            }
+            remote = next;
+            nr_drained += 1;
+        }
+
+        return nr_drained;
+    }
+
+    auto ObjectCachePerNode::take_empty_slabs(SlabList<> &slabs) -> usize {
+        ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+
+        auto const n = num_empty;
+        while (!slabs_empty.empty()) {
+            auto &slab = slabs_empty.front();
+            slabs_empty.pop_front();
+            slabs.push_back(slab);
+        }
+        num_empty = 0;
+        num_slabs -= n;
+        return n;
+    }
+
+    auto ObjectCachePerNode::get_full_magazine() -> Magazine * {
+        ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+        if (!num_full_magazines) {
+            return nullptr;
+        }
+
+        auto magazine = &full_magazines.front();
+        full_magazines.pop_front();
+        num_full_magazines -= 1;
+        return magazine;
+    }
+
+    auto ObjectCachePerNode::get_empty_magazine() -> Magazine * {
+        ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+        if (!num_empty_magazines) {
+            return nullptr;
+        }
+
+        auto magazine = &empty_magazines.front();
+        empty_magazines.pop_front();
+        num_empty_magazines -= 1;
+        return magazine;
+    }
+
+    auto ObjectCachePerNode::put_empty_magazine(Magazine *magazine) -> void {
+        DEBUG_ASSERT(magazine->is_empty());
+
+        ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+        empty_magazines.push_front(*magazine);
+        num_empty_magazines += 1;
+    }
+
+    auto ObjectCachePerNode::put_full_magazine(Magazine *magazine) -> bool {
+        DEBUG_ASSERT(magazine->is_full());
+
+        ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+        if (num_full_magazines >= kMaxFullMagazines) {
+            return false;
+        }
+        full_magazines.push_front(*magazine);
+        num_full_magazines += 1;
+        return true;
+    }
+
+    auto ObjectCachePerNode::take_magazines(MagazineList &magazines) -> void {
+        ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+
+        while (!full_magazines.empty()) {
+            auto &magazine = full_magazines.front();
+            full_magazines.pop_front();
+            magazines.push_front(magazine);
+        }
+        while (!empty_magazines.empty()) {
+            auto &magazine = empty_magazines.front();
+            empty_magazines.pop_front();
+            magazines.push_front(magazine);
+        }
+        num_full_magazines = 0;
+        num_empty_magazines = 0;
+    }
+
+    auto ObjectCachePerNode::collect(ObjectCacheNodeInfo &info) -> void {
+        ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+
+        info.nr_slabs = num_slabs;
+        info.nr_partial = num_partial;
+        info.nr_full = num_full;
+        info.nr_empty = num_empty;
+        for (auto &slab : slabs_partial) {
+            info.nr_inuse += slab.num_inuse;
+        }
+        for (auto &slab : slabs_full) {
+            info.nr_inuse += slab.num_inuse;
+        }
+        for (auto &magazine : full_magazines) {
+            info.nr_cached += magazine.rounds;
+        }
+    }
+
     struct ObjectCache::CacheOnCpu {
-        Slab *slab;
+        /// Allocations pop from |loaded| and frees push to it. |previous| is always either
+        /// full or empty, keeping it saves going to the depot when a cpu swings between
+        /// allocating and freeing around the boundary of a magazine.
+        Magazine *loaded = nullptr;
+        Magazine *previous = nullptr;
+        ObjectCacheStats stats = {};
+
+        FORCE_INLINE
+        auto swap() -> void {
+            auto const magazine = loaded;
+            loaded = previous;
+            previous = magazine;
+        }
     };
 
     auto ObjectCache::init_cache_cpu() -> Status {
@@ -87,9 +403,18 @@ namespace ours::mem {
             return Status::OutOfMem;
         }
 
+        cache_cpu_.for_each([] (CacheOnCpu &cache, CpuNum) {
+            ustl::mem::construct_at(&cache);
+        });
         return Status::Ok;
     }
 
+    auto ObjectCache::account(u64 ObjectCacheStats::*counter, usize n) -> void {
+        cache_cpu_.with_current([counter, n] (CacheOnCpu &cache) {
+            cache.stats.*counter += n;
+        });
+    }
+
     auto ObjectCache::free_cache_node() -> void {
         for (auto node : cache_node_) {
             node->destory();
@@ -140,18 +465,87 @@ namespace ours::mem {
         return Status::Ok;
     }
 
+    /// Take the lowest order whose leftover is no more than 1/|kMaxWasteRatio| of a slab,
+    /// up to |kMaxSlabOrder|. If none is, take the one wasting the least fraction. Objects
+    /// larger than that cap get slabs just fitting one of them.
+    auto ObjectCache::calculate_order() -> Status {
+        CXX11_CONSTEXPR
+        static usize const kMaxSlabOrder = 3;
+
+        CXX11_CONSTEXPR
+        static usize const kMaxWasteRatio = 8;
+
+        // Bound by the counters of slabs.
+        CXX11_CONSTEXPR
+        static usize const kMaxObjects = ustl::NumericLimits<u16>::max();
+
+        auto const min_order = ustl::bit_width<usize>((object_size_ - 1) >> PAGE_SHIFT);
+        if (min_order > MAX_FRAME_ORDER) {
+            return Status::InvalidArguments;
+        }
+        auto const max_order = ustl::algorithms::max(min_order, kMaxSlabOrder);
+
+        usize best_order = min_order;
+        usize best_leftover = 0;
+        for (auto order = min_order; order <= max_order; ++order) {
+            auto const slab_size = PAGE_SIZE << order;
+            auto const objects = ustl::algorithms::min(slab_size / object_size_, kMaxObjects);
+            auto const leftover = slab_size - objects * object_size_;
+
+            // Compare |leftover / slab_size| with the best one.
+            if (order == min_order || leftover * (PAGE_SIZE << best_order) < best_leftover * slab_size) {
+                best_order = order;
+                best_leftover = leftover;
+            }
+            if (leftover * kMaxWasteRatio <= slab_size) {
+                break;
+            }
+        }
+
+        order_ = best_order;
+        objects_ = ustl::algorithms::min((PAGE_SIZE << order_) / object_size_, kMaxObjects);
+        return Status::Ok;
+    }
+
     auto ObjectCache::init_top_half(char const *name, usize object_size, AlignVal align, OcFlags flags) -> Status {
         name_ = name;
-        object_size_ = ustl::mem::align_up(object_size, sizeof(usize));
-        order_ = 0;
-        objects_ = (BIT(order_) * PAGE_SIZE) / object_size_;
-        object_align_ = align;
         ocflags_ = flags;
+
+        // Free objects are left untouched, see `OcFlags::TypeSafeByRcu`.
+        if (!!(flags & OcFlags::TypeSafeByRcu)) {
+            ocflags_ |= OcFlags::OffSlab;
+        }
+
+        // Objects are linked through their first word when free.
+        auto min_align = sizeof(usize);
+        if (!!(flags & OcFlags::HwCacheAlign)) {
+            min_align = arch::kCacheSize;
+        }
+        object_align_ = ustl::algorithms::max(usize(align), min_align);
+        object_size_ = ustl::mem::align_up(object_size, object_align_);
+
+        auto status = calculate_order();
+        if (Status::Ok != status) {
+            return status;
+        }
+
+        auto const slab_size = BIT(order_) * PAGE_SIZE;
+        if (slab_size > BIT(16)) {
+            // Offsets in the off-slab list are of 16 bits.
+            ocflags_ &= ~OcFlags::OffSlab;
+        }
+        colour_off_ = ustl::algorithms::max(usize(object_align_), arch::kCacheSize);
+        nr_colours_ = (slab_size - objects_ * object_size_) / colour_off_ + 1;
+        colour_next_ = 0;
         gaf_ = kGafKernel;
 
         CXX11_CONSTEXPR
-        static auto const kMinPartialSlabs = 32;
-        min_partial_ = kMinPartialSlabs;
+        static auto const kMaxEmptySlabs = 4;
+        max_empty_ = kMaxEmptySlabs;
+
+        // Bootstrap caches and the magazine cache itself are made before the magazine
+        // cache is ready, they go straight to slabs.
+        has_magazines_ = s_magazine_cache != nullptr;
         return parse_ocflags(flags);
     }
 
@@ -214,32 +608,154 @@ namespace ours::mem {
         return Status::Ok;
     }
 
-    FORCE_INLINE
-    auto ObjectCache::get_slab(NodeId nid) -> Slab * {
+    auto ObjectCache::get_object(NodeId nid) -> Object * {
         // Firstly, try on target node.
-        if (nid != MAX_NODE && node_is_state(nid, NodeStates::Online)) {
-            if (cache_node_[nid]->has_slab()) {
-                if (auto slab = cache_node_[nid]->get_slab()) {
-                    return slab;
-                }
+        if (nid != MAX_NODE) {
+            if (auto object = cache_node_[nid]->get_object()) {
+                return object;
             }
         }
 
         // Try any nodes.
-        Slab *slab = nullptr;
         auto &nodes = node_online_mask();
         for (auto nid = 0; nid < nodes.size(); ++nid) {
             if (!nodes.test(nid)) {
                 continue; 
             }
 
-            slab = cache_node_[nid]->get_slab();
-            if (slab) {
-                break;
+            if (auto object = cache_node_[nid]->get_object()) {
+                return object;
             }
         }
 
-        return slab;
+        return nullptr;
+    }
+
+    auto ObjectCache::release_slabs(SlabList<> &slabs) -> usize {
+        if (slabs.empty()) {
+            return 0;
+        }
+        account(&ObjectCacheStats::nr_slabs_freed, slabs.size());
+
+        if (!is_type_safe_by_rcu()) {
+            return destroy_slabs(slabs);
+        }
+
+        defer_slabs(slabs);
+        return 0;
+    }
+
+    auto ObjectCache::defer_slabs(SlabList<> &slabs) -> void {
+        if (slabs.empty()) {
+            return;
+        }
+
+        {
+            ustl::sync::LockGuard<decltype(s_rcu_mutex)> guard(s_rcu_mutex);
+            s_rcu_next.splice(s_rcu_next.end(), slabs);
+        }
+        poll_deferred_slabs();
+    }
+
+    auto ObjectCache::poll_deferred_slabs() -> usize {
+        SlabList<> victims;
+        {
+            ustl::sync::LockGuard<decltype(s_rcu_mutex)> guard(s_rcu_mutex);
+            if (!s_rcu_waiting.empty()) {
+                if (!s_rcu_grace.has_elapsed()) {
+                    return 0;
+                }
+                victims.splice(victims.end(), s_rcu_waiting);
+            }
+
+            if (!s_rcu_next.empty()) {
+                s_rcu_waiting.splice(s_rcu_waiting.end(), s_rcu_next);
+                s_rcu_grace = task::GracePeriod::start();
+            }
+        }
+
+        return destroy_slabs(victims);
+    }
+
+    auto ObjectCache::destroy_slabs(SlabList<> &slabs) -> usize {
+        usize nr_freed = 0;
+        while (!slabs.empty()) {
+            auto slab = &slabs.front();
+            slabs.pop_front();
+            nr_freed += BIT(slab->order());
+            slab->destory();
+        }
+
+        return nr_freed;
+    }
+
+    auto ObjectCache::alloc_from_magazine() -> Object * {
+        arch::IntrDisableGuard guard;
+        return cache_cpu_.with_current([this] (CacheOnCpu &cache) -> Object * {
+            if (cache.loaded && !cache.loaded->is_empty()) {
+                return static_cast<Object *>(cache.loaded->pop());
+            }
+
+            if (cache.previous && cache.previous->is_full()) {
+                cache.swap();
+                return static_cast<Object *>(cache.loaded->pop());
+            }
+
+            // Both are empty, trade one of them for a full one in the depot.
+            auto node = cache_node_[current_node()];
+            auto full = node->get_full_magazine();
+            if (!full) {
+                return nullptr;
+            }
+
+            if (cache.previous) {
+                node->put_empty_magazine(cache.previous);
+            }
+            cache.previous = cache.loaded;
+            cache.loaded = full;
+            return static_cast<Object *>(cache.loaded->pop());
+        });
+    }
+
+    auto ObjectCache::free_to_magazine(void *object) -> bool {
+        arch::IntrDisableGuard guard;
+        return cache_cpu_.with_current([this, object] (CacheOnCpu &cache) -> bool {
+            if (cache.loaded && !cache.loaded->is_full()) {
+                cache.loaded->push(object);
+                return true;
+            }
+
+            if (cache.previous && cache.previous->is_empty()) {
+                cache.swap();
+                cache.loaded->push(object);
+                return true;
+            }
+
+            // Both are full, trade one of them for an empty one in the depot.
+            auto node = cache_node_[current_node()];
+            auto empty = node->get_empty_magazine();
+            if (!empty) {
+                return false;
+            }
+
+            if (cache.previous && !node->put_full_magazine(cache.previous)) {
+                // The depot has had enough, so the objects go back to their slabs and the
+                // magazine is reused.
+                flush_magazine(cache.previous);
+                node->put_empty_magazine(cache.previous);
+            }
+            cache.previous = cache.loaded;
+            cache.loaded = empty;
+            cache.loaded->push(object);
+            return true;
+        });
+    }
+
+    auto ObjectCache::flush_magazine(Magazine *magazine) -> void {
+        while (!magazine->is_empty()) {
+            auto const object = magazine->pop();
+            free_to_slab(role_cast<PfRole::Slab>(virt_to_folio(object)), object);
+        }
     }
 
     auto ObjectCache::do_allocate(Gaf gaf, NodeId nid) -> Object * {
@@ -248,58 +764,358 @@ namespace ours::mem {
             nid = MAX_NODE;
         }
 
-        // Alwasy look up the cache per cpu firstly.
-        auto *slab = cache_cpu_.with_current([] (CacheOnCpu &cache) {
-            return cache.slab;
-        });
-        if (slab) {
-            if (nid != slab->nid() && nid != MAX_NODE) {
-                // Mismatched node. We should forget it then try to get slab on target node 
-                // in another ways.
-                slab = nullptr;
+        // Magazines hold objects of the local node only.
+        Object *object = nullptr;
+        if (has_magazines_ && (nid == MAX_NODE || nid == current_node())) {
+            object = alloc_from_magazine();
+        }
+        if (!object) {
+            object = alloc_from_slab(gaf, nid);
+        }
+
+        account(object ? &ObjectCacheStats::nr_allocs : &ObjectCacheStats::nr_alloc_fails);
+        return object;
+    }
+
+    auto ObjectCache::drain_remote_frees(NodeId nid) -> usize {
+        SlabList<> victims;
+        auto const nr_drained = cache_node_[nid]->drain_remote(max_empty_, victims);
+        release_slabs(victims);
+        return nr_drained;
+    }
+
+    auto ObjectCache::alloc_from_slab(Gaf gaf, NodeId nid) -> Object * {
+        // Objects freed remotely come back to slabs here, before slabs are looked up.
+        auto const local = current_node();
+        drain_remote_frees(local);
+        if (nid != MAX_NODE && nid != local) {
+            drain_remote_frees(nid);
+        }
+
+        while (1) {
+            if (auto object = get_object(nid)) {
+                return object;
+            }
+
+            // All nodes have no free objects, to allocate a new slab. Others may take
+            // objects of it before us, then just try again.
+            if (!create_slab(nid, gaf)) {
+                return nullptr;
+            }
+        }
+    }
+
+    auto ObjectCache::do_deallocate(Slab *slab, void *object) -> void {
+        DEBUG_ASSERT(slab);
+        account(&ObjectCacheStats::nr_frees);
+
+        // Objects from remote nodes skip magazines, otherwise they would be handed out
+        // as local ones. Nor do they take the lock of their node, producers on one node
+        // and consumers on another would contend on it. The remote list is linked through
+        // objects, so type-stable ones go right to their slabs instead.
+        if (slab->nid() != current_node()) {
+            if (is_type_safe_by_rcu()) {
+                free_to_slab(slab, object);
+            } else {
+                cache_node_[slab->nid()]->push_remote(object);
             }
+            account(&ObjectCacheStats::nr_remote_frees);
+            return;
         }
 
-        if (!slab) {
-            // Traverse all online nodes to re-search a nid-matched slab as much as possible.
-            slab = get_slab(nid);
+        if (has_magazines_) {
+            if (free_to_magazine(object)) {
+                return;
+            }
+
+            // The depot runs out of empty magazines. This object goes to its slab, and a
+            // new magazine is left for the next time. The magazine cache may reclaim, so
+            // it is not done with interrupts disabled.
+            if (auto magazine = new (*s_magazine_cache, kGafKernel, slab->nid()) Magazine()) {
+                cache_node_[slab->nid()]->put_empty_magazine(magazine);
+            }
         }
 
-        if (!slab) {
-            // CPU and NODE cache have no available slabs, to allocate a new slab.
-            slab = create_slab(nid, gaf);
+        free_to_slab(slab, object);
+    }
+
+    auto ObjectCache::free_to_slab(Slab *slab, void *object) -> void {
+        auto node = cache_node_[slab->nid()];
+        if (auto victim = node->put_object(slab, static_cast<Object *>(object), max_empty_)) {
+            SlabList<> victims;
+            victims.push_back(*victim);
+            release_slabs(victims);
         }
+    }
 
-        if (!slab) {
-            return nullptr;
+    auto ObjectCache::allocate_bulk(usize n, Gaf gaf, NodeId nid, void **out) -> usize {
+        if (!node_is_state(nid, NodeStates::Online)) {
+            nid = MAX_NODE;
         }
 
-        auto object = slab->get_object();
+        usize nr_got = 0;
+        while (1) {
+            if (nid != MAX_NODE) {
+                nr_got += cache_node_[nid]->get_objects(n - nr_got, out + nr_got);
+            }
 
-        if (!slab->has_object()) {
-            cache_node_[slab->nid()]->put_slab(slab);
-            slab = nullptr;
+            auto &nodes = node_online_mask();
+            for (auto i = 0; i < nodes.size() && nr_got < n; ++i) {
+                if (nodes.test(i)) {
+                    nr_got += cache_node_[i]->get_objects(n - nr_got, out + nr_got);
+                }
+            }
+
+            if (nr_got == n) {
+                account(&ObjectCacheStats::nr_allocs, n);
+                return n;
+            }
+
+            if (!create_slab(nid, gaf)) {
+                free_bulk_to_slabs(nr_got, out);
+                account(&ObjectCacheStats::nr_alloc_fails);
+                return 0;
+            }
         }
+    }
+
+    auto ObjectCache::deallocate_bulk(usize n, void **objects) -> void {
+        account(&ObjectCacheStats::nr_frees, n);
+        free_bulk_to_slabs(n, objects);
+    }
+
+    auto ObjectCache::free_bulk_to_slabs(usize n, void **objects) -> void {
+        // Runs of objects on the same node are given back together.
+        SlabList<> victims;
+        for (usize i = 0; i < n;) {
+            auto const nid = virt_to_folio(objects[i])->nid();
+            auto j = i + 1;
+            while (j < n && virt_to_folio(objects[j])->nid() == nid) {
+                j += 1;
+            }
+
+            cache_node_[nid]->put_objects(j - i, objects + i, max_empty_, victims);
+            i = j;
+        }
+
+        release_slabs(victims);
+    }
+
+    auto ObjectCache::shrink(NodeId nid) -> usize {
+        if (has_magazines_) {
+            // Objects in magazines of this cpu go back first, they may make more slabs empty.
+            Magazine *magazines[2];
+            {
+                arch::IntrDisableGuard guard;
+                cache_cpu_.with_current([&magazines] (CacheOnCpu &cache) {
+                    magazines[0] = cache.loaded;
+                    magazines[1] = cache.previous;
+                    cache.loaded = nullptr;
+                    cache.previous = nullptr;
+                });
+            }
+
+            for (auto magazine : magazines) {
+                if (magazine) {
+                    flush_magazine(magazine);
+                    s_magazine_cache->deallocate(magazine);
+                }
+            }
+        }
+
+        usize nr_freed = 0;
+        for (auto i = 0; i < MAX_NODE; ++i) {
+            auto const node = cache_node_[i];
+            if (!node || (nid != MAX_NODE && nid != i)) {
+                continue;
+            }
+
+            if (has_magazines_) {
+                MagazineList magazines;
+                node->take_magazines(magazines);
+                while (!magazines.empty()) {
+                    auto magazine = &magazines.front();
+                    magazines.pop_front();
+                    flush_magazine(magazine);
+                    s_magazine_cache->deallocate(magazine);
+                }
+            }
+
+            drain_remote_frees(i);
+
+            SlabList<> slabs;
+            node->take_empty_slabs(slabs);
+            nr_freed += release_slabs(slabs);
+        }
+
+        return nr_freed;
+    }
+
+    auto ObjectCache::shrink_caches(NodeId nid, usize target) -> usize {
+        usize nr_freed = 0;
+        for (auto &cache : s_oclist_) {
+            if (nr_freed >= target) {
+                break;
+            }
+            if (&cache == s_magazine_cache) {
+                continue;
+            }
+            nr_freed += cache.shrink(nid);
+        }
+
+        // Magazines freed above are in slabs of their own cache now.
+        if (s_magazine_cache) {
+            nr_freed += s_magazine_cache->shrink(nid);
+        }
+
+        return nr_freed + poll_deferred_slabs();
+    }
 
-        cache_cpu_.with_current([slab] (CacheOnCpu &cache) {
-            cache.slab = slab;
+    auto ObjectCache::snapshot(ObjectCacheInfo &info, ObjectCacheNodeInfo *nodes, usize max_nodes) -> usize {
+        info = {};
+        for (usize i = 0; i + 1 < sizeof(info.name) && name_[i]; ++i) {
+            info.name[i] = name_[i];
+        }
+        info.object_size = object_size_;
+        info.object_align = object_align_;
+        info.order = order_;
+        info.objects_per_slab = objects_;
+        info.nr_colours = nr_colours_;
+
+        cache_cpu_.for_each([&info] (CacheOnCpu &cache, CpuNum) {
+            info.stats.nr_allocs += cache.stats.nr_allocs;
+            info.stats.nr_frees += cache.stats.nr_frees;
+            info.stats.nr_alloc_fails += cache.stats.nr_alloc_fails;
+            info.stats.nr_slabs_created += cache.stats.nr_slabs_created;
+            info.stats.nr_slabs_freed += cache.stats.nr_slabs_freed;
+            info.stats.nr_remote_frees += cache.stats.nr_remote_frees;
         });
-        return object;
+
+        usize nr_nodes = 0;
+        for (auto i = 0; i < MAX_NODE; ++i) {
+            auto const node = cache_node_[i];
+            if (!node) {
+                continue;
+            }
+
+            ObjectCacheNodeInfo local = {};
+            local.nid = i;
+            node->collect(local);
+            info.nr_slabs += local.nr_slabs;
+            info.nr_partial += local.nr_partial;
+            info.nr_full += local.nr_full;
+            info.nr_empty += local.nr_empty;
+            info.nr_inuse += local.nr_inuse;
+            info.nr_cached += local.nr_cached;
+
+            if (nr_nodes < max_nodes) {
+                nodes[nr_nodes] = local;
+            }
+            nr_nodes += 1;
+        }
+        info.nr_nodes = ustl::algorithms::min(nr_nodes, max_nodes);
+
+        info.nr_bytes = info.nr_slabs * (PAGE_SIZE << order_);
+        info.nr_wasted = info.nr_bytes - info.nr_inuse * object_size_;
+        return nr_nodes;
     }
 
-    auto ObjectCache::do_deallocate(Slab *slab, void *object) -> void {
-        DEBUG_ASSERT(slab);
+    auto ObjectCache::dump() -> void {
+        ObjectCacheInfo info;
+        ObjectCacheNodeInfo nodes[MAX_NODE];
+        snapshot(info, nodes, MAX_NODE);
 
-        slab->put_object(static_cast<Object *>(object));
-        slab->num_inuse -= 1;
-        if (slab->num_inuse != 0) {
+        log::info("{:<16} {:>8} {:>8} {:>6} {:>6} {:>5} {:>7} {:>7} {:>7} {:>7} {:>10} {:>10} {:>8} {:>6}",
+            name_, info.nr_inuse, info.nr_slabs * info.objects_per_slab, info.object_size,
+            info.objects_per_slab, info.order, info.nr_slabs, info.nr_partial, info.nr_full,
+            info.nr_cached, info.stats.nr_allocs, info.stats.nr_frees, info.stats.nr_remote_frees,
+            info.stats.nr_alloc_fails
+        );
+
+        // Slabs by node only matter if there are more than one.
+        if (info.nr_nodes < 2) {
             return;
         }
+        for (usize i = 0; i < info.nr_nodes; ++i) {
+            auto const &node = nodes[i];
+            log::info("  node {:<9} {:>8} {:>8} {:>6} {:>6} {:>5} {:>7} {:>7} {:>7} {:>7}",
+                node.nid, node.nr_inuse, node.nr_slabs * info.objects_per_slab, "", "", "",
+                node.nr_slabs, node.nr_partial, node.nr_full, node.nr_cached
+            );
+        }
+    }
+
+    auto ObjectCache::dump_caches() -> void {
+        log::info("{:<16} {:>8} {:>8} {:>6} {:>6} {:>5} {:>7} {:>7} {:>7} {:>7} {:>10} {:>10} {:>8} {:>6}",
+            "# name", "inuse", "total", "size", "objs", "order", "slabs", "partial", "full", "cached",
+            "allocs", "frees", "remote", "fails"
+        );
+
+        usize nr_bytes = 0;
+        usize nr_wasted = 0;
+        for (auto &cache : s_oclist_) {
+            cache.dump();
+
+            ObjectCacheInfo info;
+            cache.snapshot(info);
+            nr_bytes += info.nr_bytes;
+            nr_wasted += info.nr_wasted;
+        }
+        log::info("Slabs take {} KiB, {} KiB of them unused", nr_bytes >> 10, nr_wasted >> 10);
+    }
 
-        auto node = cache_node_[slab->nid()];
-        if (node->num_partial >= min_partial_) {
-            node->free_slab(slab);
+    auto ObjectCache::export_snapshot(void *buffer, usize size) -> usize {
+        // Caches and nodes are not locked as a whole, so the numbers of them may change
+        // between measuring and writing. The buffer is never overrun anyway.
+        usize needed = sizeof(ObjectCacheSnapshotHeader);
+        for (auto &cache : s_oclist_) {
+            needed += sizeof(ObjectCacheInfo);
+            for (auto node : cache.cache_node_) {
+                if (node) {
+                    needed += sizeof(ObjectCacheNodeInfo);
+                }
+            }
+        }
+        if (needed > size) {
+            return needed;
         }
+
+        auto const out = static_cast<u8 *>(buffer);
+        auto write = [out, size] (usize offset, void const *record, usize n) {
+            if (offset + n > size) {
+                return offset;
+            }
+            auto const bytes = static_cast<u8 const *>(record);
+            ustl::algorithms::copy_n(bytes, n, out + offset);
+            return offset + n;
+        };
+
+        usize offset = sizeof(ObjectCacheSnapshotHeader);
+        u32 nr_caches = 0;
+        for (auto &cache : s_oclist_) {
+            ObjectCacheInfo info;
+            ObjectCacheNodeInfo nodes[MAX_NODE];
+            cache.snapshot(info, nodes, MAX_NODE);
+
+            auto const record_size = sizeof(info) + info.nr_nodes * sizeof(nodes[0]);
+            if (offset + record_size > size) {
+                break;
+            }
+            offset = write(offset, &info, sizeof(info));
+            offset = write(offset, nodes, info.nr_nodes * sizeof(nodes[0]));
+            nr_caches += 1;
+        }
+
+        ObjectCacheSnapshotHeader header = {
+            .magic = ObjectCacheSnapshotHeader::kMagic,
+            .version = ObjectCacheSnapshotHeader::kVersion,
+            .header_size = sizeof(ObjectCacheSnapshotHeader),
+            .cache_size = sizeof(ObjectCacheInfo),
+            .node_size = sizeof(ObjectCacheNodeInfo),
+            .nr_caches = nr_caches,
+        };
+        write(0, &header, sizeof(header));
+        return offset;
     }
 
     /// Requires that PMM is available.
@@ -309,6 +1125,10 @@ namespace ours::mem {
         s_object_cache_node = s_bootstrap_object_cache_node.data();
         ObjectCache::create_boot(*s_object_cache_node, "node-cache", sizeof(ObjectCachePerNode), alignof(ObjectCachePerNode), {});
         ObjectCache::create_boot(*s_object_cache_self, "self-cache", sizeof(ObjectCache), alignof(ObjectCache), {});
+        s_magazine_cache = ObjectCache::create<Magazine>("magazine-cache", {});
+
+        static FrameReclaimer s_object_cache_reclaimer("object-cache", ObjectCache::shrink_caches);
+        register_frame_reclaimer(s_object_cache_reclaimer);
     }
 
 } // namespace ours::mem
\ No newline at end of file
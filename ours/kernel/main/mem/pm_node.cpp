@@ -2,14 +2,18 @@
 #include <ours/mem/pm_node.hpp>
 
 #include <ours/mem/pm_zone.hpp>
+#include <ours/mem/cma.hpp>
+#include <ours/mem/reclaim.hpp>
 #include <ours/mem/physmap.hpp>
 #include <ours/mem/memory_model.hpp>
 
 #include <ours/panic.hpp>
 #include <ours/assert.hpp>
 #include <ours/cpu-local.hpp>
+#include <ours/task/thread.hpp>
 
 #include <ustl/mem/object.hpp>
+#include <ustl/sync/atomic.hpp>
 #include <ustl/algorithms/minmax.hpp>
 #include <ustl/util/enum_sequence.hpp>
 #include <ustl/function/bind.hpp>
@@ -123,17 +127,18 @@ namespace ours::mem {
 
     auto ZoneIterator::move_next() -> ZoneRef {
         while (first != last) {
-            auto zref = (*first);
-            if (zref->zone_type() > upper_zone_type) {
-                ++first;
+            // Advance for next iteration.
+            auto zref = *(first++);
+            if (!zref || zref->zone_type() > upper_zone_type) {
+                continue;
             }
 
+            // Zones of nodes excluded by the memory policy are skipped.
             if (!nodes->test(zref->which_node())) {
-                ++first;
+                continue;
             }
 
-            // Advance for next iteration.
-            return *(first++);
+            return zref;
         }
 
         return ZoneRef();
@@ -162,12 +167,26 @@ namespace ours::mem {
         ZoneIterator ziter;
     };
 
-    static Gaf g_gaf_allowed = kGafBoot;
+    /// Policies which need the reclaim daemon, they are held back until it runs.
+    CXX11_CONSTEXPR
+    static auto const kGafReclaimMask = Gaf::Reclaim | Gaf::DirectlyReclaim | Gaf::NeverFail;
+
+    /// Only bits of `kGafReclaimMask` are ever cleared, the others (zones, `Gaf::Folio`,
+    /// migrate types, ...) describe the request itself and always pass.
+    ///
+    /// Read on every allocation while `start_reclaimd` may widen it on another CPU.
+    static ustl::sync::Atomic<Gaf> g_gaf_allowed{~kGafReclaimMask};
+
+    /// How many times the slow path retries before giving up, unless `Gaf::NeverFail`.
+    CXX11_CONSTEXPR
+    static usize const kMaxReclaimRetries = 16;
 
     PmNode::PmNode(NodeId nid)
         : id_(nid),
           page_queues_(),
-          zone_queues_(nid)
+          zone_queues_(nid),
+          deferred_frames_(),
+          cma_()
     {
         DEBUG_ASSERT(!s_node_list[nid]);
         s_node_list[id_] = this;
@@ -180,6 +199,7 @@ namespace ours::mem {
         start_pfn_ = start;
         spanned_frames_ = end - start;
         present_frames_ = 0;
+        deferred_frames_.init(id_, start, end);
 
         if (spanned_frames_ != 0) {
             set_node_state(id_, NodeStates::Memory, true);
@@ -232,6 +252,9 @@ namespace ours::mem {
             // penalty or reward to a node.
             frame = zref->alloc_frame(gaf, order);
             if (frame) {
+                if (zref->water_level() != PmZone::WaterMark::Sufficient) {
+                    PmNode::node(zref->which_node())->wakeup_reclaimd();
+                }
                 break;
             }
         }
@@ -247,7 +270,7 @@ namespace ours::mem {
         if (order > MAX_FRAME_ORDER) {
             return ustl::err(Status::InvalidArguments);
         }
-        gaf &= g_gaf_allowed;
+        gaf &= g_gaf_allowed.load(ustl::sync::MemoryOrder::Acquire);
 
         AllocationContext context;
         auto status = context.build(this, gaf, order, nodes);
@@ -255,17 +278,88 @@ namespace ours::mem {
             return ustl::err(status); 
         }
 
+        // A zeroed frame of order 0 is most likely demanded by a fault, the pool serves it
+        // without zeroing on the critical path.
+        PmFrame *result = nullptr;
+        if (ZeroedPool::can_serve(gaf, order) && nodes.test(id_)) {
+            result = zeroed_pool_.take();
+            if (result) {
+                PmZone::prepare_frames(result, gaf, order);
+            }
+        }
+
         // First attempt to allocate.
-        PmFrame *result = alloc_frame_core(gaf, order, context);
         if (!result) {
-            // Now no any way to reclaim frames, so directly panic().
-            panic("No enough frames for request");
+            result = alloc_frame_core(gaf, order, context);
+        }
+        if (!result && cma_ && CmaArea::can_lend(gaf)) {
+            // Idle frames of CMA are lent before bothering reclaimers.
+            result = cma_->lend(order);
+            if (result) {
+                if (!!(gaf & Gaf::Zero)) {
+                    zero_frames(result, order);
+                }
+                PmZone::prepare_frames(result, gaf, order);
+            }
+        }
+        if (!result) {
+            result = alloc_frame_slow(gaf, order, nodes);
+        }
+
+        if (!result) {
+            log::warn("Node[{}]: No enough frames for request(order: {})", id_, order);
+            return ustl::err(Status::OutOfMem);
         }
 
         finish_allocation(result, gaf, order, context);
         return ustl::ok(result);
     }
 
+    auto PmNode::alloc_frame_slow(Gaf gaf, usize order, NodeMask const &nodes) -> PmFrame * {
+        // Frames not initialized yet are far cheaper than reclaimed ones.
+        while (grow_deferred_frames(BIT(order))) {
+            AllocationContext context;
+            if (Status::Ok != context.build(this, gaf, order, nodes)) {
+                return nullptr;
+            }
+
+            if (auto frame = alloc_frame_core(gaf, order, context)) {
+                return frame;
+            }
+        }
+
+        auto const never_fail = !!(gaf & Gaf::NeverFail);
+        for (usize retries = 0; never_fail || retries < kMaxReclaimRetries; ++retries) {
+            // Taken before the wakeup, so a round finishing before we sleep is not missed.
+            auto const round = reclaim_rounds_.load(ustl::sync::MemoryOrder::Acquire);
+            wakeup_reclaimd();
+
+            if (!!(gaf & Gaf::DirectlyReclaim)) {
+                // Nothing reclaimed means retrying is in vain.
+                if (!reclaim(BIT(order)) && !never_fail) {
+                    return nullptr;
+                }
+            } else if (!!(gaf & Gaf::Reclaim) && reclaimd_running_.load(ustl::sync::MemoryOrder::Acquire)) {
+                reclaim_wait_.wait_until([this, round] {
+                    return reclaim_rounds_.load(ustl::sync::MemoryOrder::Acquire) != round;
+                }, false);
+            } else if (!never_fail) {
+                return nullptr;
+            }
+
+            AllocationContext context;
+            if (Status::Ok != context.build(this, gaf, order, nodes)) {
+                return nullptr;
+            }
+
+            if (auto frame = alloc_frame_core(gaf, order, context)) {
+                return frame;
+            }
+        }
+
+        return nullptr;
+    }
+
     auto PmNode::alloc_frames(Gaf flags, usize n, ai_out FrameList<> *list, NodeMask const &mask) -> Status {
         DEBUG_ASSERT(list != nullptr, "");
         for (usize order = 0; n > 0; order += 1) {
@@ -285,24 +379,46 @@ namespace ours::mem {
         return Status::Ok;
     }
 
-    auto PmNode::alloc_frames_bulk(Gaf flags, usize n, ai_out FrameList<> *list) -> Status {
+    auto PmNode::alloc_frames_bulk(Gaf gaf, usize n, ai_out FrameList<> *list, NodeMask const &nodes) -> Status {
         DEBUG_ASSERT(list != nullptr, "");
-        while (n--) {
-            if (auto frame = this->alloc_frame(flags, 0)) {
-                list->push_back(*frame.unwrap());
-                n >>= 1;
-            } else {
-                free_frames(list);
-                return frame.unwrap_err();
+        gaf &= g_gaf_allowed.load(ustl::sync::MemoryOrder::Acquire);
+
+        AllocationContext context;
+        auto status = context.build(this, gaf, 0, nodes);
+        if (Status::Ok != status) {
+            return status;
+        }
+
+        // Each zone serves as many as it can with taking its lock once.
+        FrameList<> frames;
+        auto remaining = n;
+        while (remaining) {
+            auto zref = context.ziter.move_next();
+            if (!zref) {
+                break;
             }
+            remaining -= zref->alloc_frames(gaf, 0, remaining, &frames);
+            if (zref->water_level() != PmZone::WaterMark::Sufficient) {
+                PmNode::node(zref->which_node())->wakeup_reclaimd();
+            }
+        }
+
+        if (remaining) {
+            free_frames(&frames);
+            return Status::OutOfMem;
         }
 
+        list->splice(list->end(), frames);
         return Status::Ok;
     }
 
     auto PmNode::free_frame(PmFrame *frame, usize order) -> void {
         DEBUG_ASSERT(frame, "");
         auto const node = PmNode::node(frame->nid());
+        if (node->cma_ && node->cma_->contains(frame)) {
+            return node->cma_->give_back(frame, order);
+        }
+
         auto const zone = node->zone_queues_.get_local_zone(frame->zone());
         DEBUG_ASSERT(zone, "");
 
@@ -311,10 +427,50 @@ namespace ours::mem {
 
     auto PmNode::free_frames(FrameList<> *list) -> void {
         list->clear_and_dispose([] (PmFrame *frame) {
-            free_frame(frame, frame->nid());
+            free_frame(frame, frame->order());
         });
     }
 
+    auto PmNode::reclaim(usize target) -> usize {
+        // Cached frames of all cpus go back first. They do not raise the number of free
+        // frames, but can be merged into blocks of higher orders.
+        for (auto zone : zone_queues_.get_queue(ZoneQueues::LocalContiguous)) {
+            zone->drain_pcpu_cache();
+        }
+
+        return reclaim_frames(id_, target);
+    }
+
+    auto PmNode::under_pressure() const -> bool {
+        for (auto zone : zone_queues_.get_queue(ZoneQueues::LocalContiguous)) {
+            if (zone->water_level() != PmZone::WaterMark::Sufficient) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    auto PmNode::start_reclaimd() -> Status {
+        auto const thread = task::Thread::spawn("reclaimd", 0, &Self::reclaimd_routine, this);
+        if (!thread) {
+            return Status::OutOfMem;
+        }
+        thread->detach();
+        thread->resume();
+
+        reclaimd_running_.store(true, ustl::sync::MemoryOrder::Release);
+
+        // From now on applicants are able to wait for or do reclaim. Other nodes may be
+        // starting their daemons at the same time.
+        auto allowed = g_gaf_allowed.load(ustl::sync::MemoryOrder::Relaxed);
+        while (!g_gaf_allowed.compare_exchange_weak(allowed, allowed | kGafReclaimMask,
+            ustl::sync::MemoryOrder::Release, 
+            ustl::sync::MemoryOrder::Relaxed
+        ));
+        return Status::Ok;
+    }
+
     auto PmNode::dump() const -> void {
         // TODO(SmallHuaZi) merge them to a log sentence.
         log::info("Node[{}]: ", id_);
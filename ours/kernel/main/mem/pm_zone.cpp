@@ -1,37 +1,51 @@
 #include <ours/mem/pm_zone.hpp>
 #include <ours/mem/memory_model.hpp>
+#include <ours/mem/zeroed_pool.hpp>
 
 #include <ours/init.hpp>
 #include <ours/assert.hpp>
 #include <ours/cpu-local.hpp>
 
 #include <logz4/log.hpp>
+#include <ustl/bit.hpp>
+#include <ustl/util/move.hpp>
+#include <ustl/mem/object.hpp>
+#include <ustl/algorithms/minmax.hpp>
 #include <ustl/algorithms/generation.hpp>
 
+#include <arch/intr_disable_guard.hpp>
+
+using ustl::algorithms::clamp;
+
 namespace ours::mem {
+    /// Check if |other| is managed by the same zone with |self|.
     FORCE_INLINE
-    static auto frame_is_buddy(PmFrame *self, PmFrame *buddy) -> bool {
+    static auto frame_is_buddy_zone(PmFrame *self, PmFrame *other) -> bool {
+        return self->zone() == other->zone() && self->nid() == other->nid();
+    }
+
+    /// Check if |buddy| is a free block of exactly |order| which |self| of the same order can merge with.
+    FORCE_INLINE
+    static auto frame_is_buddy(PmFrame *self, PmFrame *buddy, usize order) -> bool {
         if (!buddy->is_role(PfRole::Pmm)) {
             return false;
         }
-        if (self->zone() != buddy->zone()) {
-            return false;
-        }
-        if (self->nid() != buddy->nid()) {
+        if (!frame_is_buddy_zone(self, buddy)) {
             return false;
         }
-        if (self->order() != buddy->order()) {
+        if (buddy->order() != order) {
             return false;
         }
 
         return true;
     }
 
+    /// |pfn| must be aligned to |order|, the buddy is either right before or right after it.
     FORCE_INLINE
     static auto get_buddy(PmFrame *frame, Pfn pfn, usize order) -> PmFrame * {
-        auto const buddy_pfn = pfn + (1 << order);
+        auto const buddy_pfn = pfn ^ Pfn(BIT(order));
         if (auto buddy_frame = pfn_to_frame(buddy_pfn)) {
-            if (frame_is_buddy(frame, buddy_frame)) {
+            if (frame_is_buddy(frame, buddy_frame, order)) {
                 return buddy_frame;
             }
         }
@@ -44,73 +58,174 @@ namespace ours::mem {
         return &frame[BIT(order)];
     }
 
+    /// Types to steal from in turn if the free lists of a type run dry.
+    CXX11_CONSTEXPR
+    static MigrateType const kFallbackTypes[kNumMigrateTypes][kNumMigrateTypes - 1] = {
+        /* Movable */     { MigrateType::Reclaimable, MigrateType::Unmovable },
+        /* Unmovable */   { MigrateType::Reclaimable, MigrateType::Movable },
+        /* Reclaimable */ { MigrateType::Unmovable, MigrateType::Movable },
+    };
+
+    FORCE_INLINE
+    static auto pageblock_head_pfn(Pfn pfn) -> Pfn {
+        return pfn & ~Pfn(PAGEBLOCK_NR_FRAMES - 1);
+    }
+
+    auto FrameSet::pageblock_type(PmFrame *frame) -> MigrateType {
+        if (auto head = pfn_to_frame(pageblock_head_pfn(frame_to_pfn(frame)))) {
+            return head->migrate_type();
+        }
+        return frame->migrate_type();
+    }
+
+    auto FrameSet::set_pageblock_type(PmFrame *frame, usize order, MigrateType type) -> void {
+        auto const pfn = frame_to_pfn(frame);
+        auto const end_pfn = pfn + BIT(order);
+        for (auto i = pageblock_head_pfn(pfn); i < end_pfn; i += PAGEBLOCK_NR_FRAMES) {
+            if (auto head = pfn_to_frame(i)) {
+                head->set_migrate_type(type);
+            }
+        }
+        // Keep it consistent with `pageblock_type` even if the head is out of frame map.
+        frame->set_migrate_type(type);
+    }
+
     FORCE_INLINE
-    auto FrameSet::has_frame(usize order) const -> bool {
-        return !lists_[order].empty();
+    auto FrameSet::find_order(usize order, MigrateType type) const -> usize {
+        auto const mask = order_bitmap(type) >> order;
+        if (!mask) {
+            return kNumOrders;
+        }
+
+        return order + ustl::countr_zero(mask);
     }
 
     FORCE_INLINE
-    auto FrameSet::get_frame(usize order) -> PmFrame * {
-        return &lists_[order].front();
+    auto FrameSet::get_frame(usize order, MigrateType type) -> PmFrame * {
+        return &lists_[order][usize(type)].front();
     }
 
     FORCE_INLINE
-    auto FrameSet::remove_frame(PmFrame *frame, usize order) -> void {
-        auto const to_erase = lists_[order].iterator_to(*frame);
-        lists_[order].erase(to_erase);
+    auto FrameSet::remove_frame(PmFrame *frame, usize order, MigrateType type) -> void {
+        auto &list = lists_[order][usize(type)];
+        list.erase(list.iterator_to(*frame));
+        if (list.empty()) {
+            order_bitmaps_[usize(type)].fetch_and(~u32(BIT(order)), ustl::sync::MemoryOrder::Relaxed);
+        }
         frame->set_role(PfRole::None);
     }
 
     FORCE_INLINE
-    auto FrameSet::insert_frame(PmFrame *frame, usize order) -> void {
-        lists_[order].push_back(*frame);
+    auto FrameSet::insert_frame(PmFrame *frame, usize order, MigrateType type) -> void {
+        // A block not smaller than a pageblock decides the type of pageblocks it covers.
+        if (order >= kPageblockOrder) {
+            set_pageblock_type(frame, order, type);
+        }
+
+        lists_[order][usize(type)].push_back(*frame);
+        order_bitmaps_[usize(type)].fetch_or(u32(BIT(order)), ustl::sync::MemoryOrder::Relaxed);
         frame->set_role(PfRole::Pmm);
         frame->set_order(order);
     }
 
-    auto FrameSet::acquire_frame_inner(PmFrame *frame, usize lower_order, usize upper_order) -> PmFrame * {
+    auto FrameSet::acquire_frame_inner(PmFrame *frame, usize lower_order, usize upper_order, MigrateType type) -> PmFrame * {
         auto const pfn = frame_to_pfn(frame);
         while (upper_order > lower_order) {
             upper_order -= 1;
 
             // In split process, directly taking a buddy frame is absolutely safe.
             auto buddy = get_buddy_unchecked(frame, pfn, upper_order);
-            insert_frame(buddy, upper_order);
+            insert_frame(buddy, upper_order, type);
         }
         frame->set_order(lower_order);
 
         return frame;
     }
 
-    auto FrameSet::acquire_frame_locked(usize target_order) -> PmFrame * {
-        for (auto order = target_order; order < kNumOrders; ++order) {
-            if (!has_frame(order)) {
+    auto FrameSet::claim_pageblock(PmFrame *frame, MigrateType from, MigrateType to) -> void {
+        auto const start_pfn = pageblock_head_pfn(frame_to_pfn(frame));
+        auto const end_pfn = start_pfn + PAGEBLOCK_NR_FRAMES;
+        for (auto pfn = start_pfn; pfn < end_pfn; ) {
+            auto block = pfn_to_frame(pfn);
+            // Only heads of free blocks belonging to this set have the role `Pmm`.
+            if (!block || !block->is_role(PfRole::Pmm) || !frame_is_buddy_zone(frame, block)) {
+                pfn += 1;
                 continue;
             }
-            
-            auto frame = get_frame(order);
-            remove_frame(frame, order);
-            acquire_frame_inner(frame, target_order, order);
-            return frame;
+
+            auto const order = block->order();
+            remove_frame(block, order, from);
+            insert_frame(block, order, to);
+            pfn += BIT(order);
+        }
+
+        set_pageblock_type(frame, 0, to);
+    }
+
+    auto FrameSet::steal_frame_locked(usize target_order, MigrateType type) -> PmFrame * {
+        for (auto fallback : kFallbackTypes[usize(type)]) {
+            // Steal the largest block, so the stolen ones gather in a few pageblocks
+            // instead of many pageblocks of |fallback| being polluted.
+            for (auto order = kMaxFrameOrder + 1; order > target_order; --order) {
+                if (!has_order(order - 1, fallback)) {
+                    continue;
+                }
+
+                auto const found = order - 1;
+                auto frame = get_frame(found, fallback);
+                remove_frame(frame, found, fallback);
+
+                auto split_type = fallback;
+                if (found >= kPageblockOrder) {
+                    set_pageblock_type(frame, found, type);
+                    split_type = type;
+                } else if (found >= kPageblockOrder / 2 || type != MigrateType::Movable) {
+                    claim_pageblock(frame, fallback, type);
+                    split_type = type;
+                }
+
+                return acquire_frame_inner(frame, target_order, found, split_type);
+            }
         }
 
         return nullptr;
     }
 
+    auto FrameSet::acquire_frame_locked(usize target_order, MigrateType type) -> PmFrame * {
+        auto const order = find_order(target_order, type);
+        if (order >= kNumOrders) {
+            return steal_frame_locked(target_order, type);
+        }
+
+        auto frame = get_frame(order, type);
+        remove_frame(frame, order, type);
+        acquire_frame_inner(frame, target_order, order, type);
+        return frame;
+    }
+
 
     auto FrameSet::release_frame_inner(PmFrame *frame, Pfn pfn, usize order) -> void {
+        auto const type = pageblock_type(frame);
+
         // Do fold
-        for (auto i = order; i < kMaxFrameOrder; ++i) {
+        while (order < kMaxFrameOrder) {
             auto buddy_frame = get_buddy(frame, pfn, order);
             if (!buddy_frame) {
                 break;
             }
 
-            remove_frame(buddy_frame, order);
+            // The buddy may lie in another pageblock of a different type.
+            remove_frame(buddy_frame, order, pageblock_type(buddy_frame));
+
+            // The merged block starts at the lower one of the two.
+            if (buddy_frame < frame) {
+                frame = buddy_frame;
+                pfn ^= Pfn(BIT(order));
+            }
             order += 1;
         }
 
-        insert_frame(frame, order);
+        insert_frame(frame, order, type);
     }
 
     auto FrameSet::release_frame_locked(PmFrame *frame, usize order) -> void {
@@ -125,6 +240,53 @@ namespace ours::mem {
         }
     }
 
+    auto FrameSet::acquire_frames(usize order, MigrateType type, usize n, FrameList<> &list) -> usize {
+        ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+
+        usize i = 0;
+        for (; i < n; ++i) {
+            auto frame = acquire_frame_locked(order, type);
+            if (!frame) {
+                break;
+            }
+            list.push_back(*frame);
+        }
+
+        return i;
+    }
+
+    auto FrameSet::release_frames(FrameList<> &list) -> void {
+        ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+        while (!list.empty()) {
+            auto &frame = list.front();
+            list.pop_front();
+            release_frame_locked(&frame, frame.order());
+        }
+    }
+
+    auto FrameSet::isolate_range(Pfn start, Pfn end, FrameList<> &list) -> usize {
+        DEBUG_ASSERT(!(start & (BIT(kMaxFrameOrder) - 1)) && !(end & (BIT(kMaxFrameOrder) - 1)));
+        ustl::sync::LockGuard<decltype(mutex_)> guard(mutex_);
+
+        // Only the head of a free block plays the role of PMM.
+        usize nr_isolated = 0;
+        for (auto pfn = start; pfn < end; ) {
+            auto const frame = pfn_to_frame(pfn);
+            if (!frame || !frame->is_role(PfRole::Pmm)) {
+                pfn += 1;
+                continue;
+            }
+
+            auto const order = frame->order();
+            remove_frame(frame, order, pageblock_type(frame));
+            list.push_back(*frame);
+            nr_isolated += BIT(order);
+            pfn += BIT(order);
+        }
+
+        return nr_isolated;
+    }
+
     PmZone::PmZone()
         : canary_(),
           name_("Anonymous"),
@@ -150,24 +312,146 @@ namespace ours::mem {
         start_pfn_ = start_pfn;
         spanned_frames_ = end_pfn - start_pfn;
         present_frames_ = present_frames;
+    }
+
+    auto PmZone::init_pcpu_cache() -> void {
+        auto const batch = clamp(managed_frames_ >> 10, kMinPcpuBatch, kMaxPcpuBatch);
+        auto const high = batch * kPcpuHighRatio;
+
+        auto cache = CpuLocal::allocate<PcpuCache>();
+        if (!cache) {
+            log::error("Failed to allocate frame cache per cpu for Zone[{}]", name_);
+            return;
+        }
+
+        cache.for_each([high, batch] (PcpuCache &local, CpuNum) {
+            ustl::mem::construct_at(&local, high, batch);
+        });
+        frame_cache_ = ustl::move(cache);
+
+        log::trace("Zone[{}] frame cache per cpu: batch={}, high={}", name_, batch, high);
+    }
+
+    auto PmZone::set_pcpu_marks(usize high, usize batch) -> void {
+        if (!frame_cache_) {
+            return;
+        }
+
+        frame_cache_.for_each([high, batch] (PcpuCache &local, CpuNum) {
+            arch::IntrDisableGuard guard;
+            ustl::sync::LockGuard<ustl::sync::Mutex> cache_guard(local.mutex());
+            local.set_marks(high, batch);
+        });
+    }
+
+    auto PmZone::drain_pcpu_cache() -> usize {
+        if (!frame_cache_) {
+            return 0;
+        }
+
+        // Frames cached by other cpus count as much as ours, they are otherwise out of
+        // reach until their owners free enough to go over the high mark.
+        usize nr_drained = 0;
+        frame_cache_.for_each([this, &nr_drained] (PcpuCache &cache, CpuNum) {
+            arch::IntrDisableGuard guard;
+            ustl::sync::LockGuard<ustl::sync::Mutex> cache_guard(cache.mutex());
+
+            FrameList<> victims;
+            nr_drained += cache.drain(victims, 0);
+            fset_.release_frames(victims);
+        });
+
+        return nr_drained;
+    }
+
+    auto PmZone::init_watermarks() -> void {
+        usize const total = managed_frames_;
+        watermark_[usize(WaterMark::Critical)] = total / 10;
+        watermark_[usize(WaterMark::Moderate)] = total * 3 / 10;
+        watermark_[usize(WaterMark::Sufficient)] = total / 2;
+
+        log::trace("Zone[{}] water marks: critical={}, moderate={}, high={}", 
+            name_,
+            watermark(WaterMark::Critical),
+            watermark(WaterMark::Moderate),
+            watermark(WaterMark::Sufficient)
+        );
+    }
+
+    auto PmZone::water_level() const -> WaterMark {
+        usize const nr_free = managed_frames_;
+        if (nr_free < watermark(WaterMark::Critical)) {
+            return WaterMark::Critical;
+        } else if (nr_free < watermark(WaterMark::Moderate)) {
+            return WaterMark::Moderate;
+        }
 
-        frame_cache_ = CpuLocal::allocate<PcpuCache>();
+        return WaterMark::Sufficient;
+    }
+
+    auto PmZone::alloc_frame_pcpu(usize order, MigrateType type) -> PmFrame * {
+        arch::IntrDisableGuard guard;
+        return frame_cache_.with_current([this, order, type] (PcpuCache &cache) -> PmFrame * {
+            ustl::sync::LockGuard<ustl::sync::Mutex> cache_guard(cache.mutex());
+            if (auto frame = cache.pop(order, type)) {
+                return frame;
+            }
+
+            FrameList<> list;
+            auto const n = fset_.acquire_frames(order, type, cache.refill_count(order), list);
+            if (!n) {
+                return nullptr;
+            }
+            cache.refill(list, n, order, type);
+            return cache.pop(order, type);
+        });
+    }
+
+    auto PmZone::free_frame_pcpu(PmFrame *frame, usize order) -> void {
+        auto const type = FrameSet::pageblock_type(frame);
+
+        arch::IntrDisableGuard guard;
+        frame_cache_.with_current([this, frame, order, type] (PcpuCache &cache) {
+            ustl::sync::LockGuard<ustl::sync::Mutex> cache_guard(cache.mutex());
+            cache.push(frame, order, type);
+            if (!cache.should_drain()) {
+                return;
+            }
+
+            FrameList<> victims;
+            cache.drain(victims);
+            fset_.release_frames(victims);
+        });
     }
 
     auto PmZone::finish_allocation(PmFrame *frame, Gaf gaf, usize order) -> void {
         managed_frames_ -= BIT(order);
+        prepare_frames(frame, gaf, order);
+    }
+
+    auto PmZone::prepare_frames(PmFrame *frame, Gaf gaf, usize order) -> void {
+        // Each frame of a folio records its position, so `frame_to_folio` finds the head
+        // from it. Frames may have been in a folio before, so the rest are always reset
+        // to stand on their own.
+        auto const is_folio = !!(Gaf::Folio & gaf);
+        if (is_folio && order) {
+            frame->mark_folio();
+        }
+        for (usize i = 0; i < BIT(order); ++i) {
+            frame[i].index_compouned_.store(is_folio ? u32(i) : 0, ustl::sync::MemoryOrder::Relaxed);
+        }
     }
 
     auto PmZone::alloc_frame(Gaf gaf, usize order) -> PmFrame * {
+        auto const type = gaf_migrate_type(gaf);
+
         PmFrame *frame = nullptr;
-        if (is_order_within_pcpu_cache_limit(order)) {
-            frame = frame_cache_.with_current([order] (PcpuCache &cache) {
-                return nullptr;
-            });
+        if (is_order_within_pcpu_cache_limit(order) && frame_cache_) {
+            frame = alloc_frame_pcpu(order, type);
         }
 
         if (!frame) {
-            frame = fset_.acquire_frame(order);
+            frame = fset_.acquire_frame(order, type);
         }
 
         if (!frame) {
@@ -175,18 +459,37 @@ namespace ours::mem {
         }
 
         if (!!(Gaf::Zero & gaf)) {
-            ustl::algorithms::fill_n(frame_to_virt<isize>(frame), BIT(order) * PAGE_SIZE / sizeof(usize), 0);
+            zero_frames(frame, order);
         }
 
         finish_allocation(frame, gaf, order);
         return frame;
     }
 
+    auto PmZone::alloc_frames(Gaf gaf, usize order, usize n, ai_out FrameList<> *list) -> usize {
+        DEBUG_ASSERT(list, "");
+
+        FrameList<> frames;
+        auto const nr_acquired = fset_.acquire_frames(order, gaf_migrate_type(gaf), n, frames);
+        if (!nr_acquired) {
+            return 0;
+        }
+
+        auto const zero = !!(Gaf::Zero & gaf);
+        for (auto &frame : frames) {
+            if (zero) {
+                zero_frames(&frame, order);
+            }
+            finish_allocation(&frame, gaf, order);
+        }
+
+        list->splice(list->end(), frames);
+        return nr_acquired;
+    }
+
     auto PmZone::free_frame(PmFrame *frame, usize order) -> void {
-        if (is_order_within_pcpu_cache_limit(order)) {
-            frame_cache_.with_current([frame] (PcpuCache &cache) {
-                // Here no pcpu cache.
-            });
+        if (is_order_within_pcpu_cache_limit(order) && frame_cache_) {
+            free_frame_pcpu(frame, order);
         } else {
             fset_.release_frame(frame, order);
         }
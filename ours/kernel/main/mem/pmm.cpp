@@ -27,7 +27,8 @@ namespace ours::mem {
 
         auto result = prefered_node->alloc_frame(gaf, order, nodes);
         if (!result) {
-            panic("Failed to allocate page with request(node: {}, order: {})", prefered_node->nid(), order);
+            log::warn("Failed to allocate page with request(node: {}, order: {})", prefered_node->nid(), order);
+            return nullptr;
         }
 
         return result.unwrap();
@@ -40,10 +41,10 @@ namespace ours::mem {
 
         auto status = prefered_node->alloc_frames(gaf, n, list, nodes);
         if (status != Status::Ok) {
-            panic("Failed to allocate page with request(node: {}, order: {})", prefered_node->nid(), n);
+            log::warn("Failed to allocate page with request(node: {}, n: {})", prefered_node->nid(), n);
         }
 
-        return Status::Ok;
+        return status;
     }
 
     auto alloc_frame(Gaf gaf, usize order, NodeMask const &nodes) -> PmFrame * {
@@ -77,4 +78,8 @@ namespace ours::mem {
         PmNode::free_frames(list);
     }
 
+    auto alloc_frames_bulk(Gaf gaf, ai_out FrameList<> *list, usize n) -> Status {
+        return CpuLocal::access<PmNode>()->alloc_frames_bulk(gaf, n, list);
+    }
+
 } // namespace ours::mem
\ No newline at end of file
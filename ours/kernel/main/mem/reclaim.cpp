@@ -0,0 +1,90 @@
+#include <ours/mem/reclaim.hpp>
+#include <ours/mem/pm_node.hpp>
+#include <ours/mem/pm_zone.hpp>
+
+#include <ours/mutex.hpp>
+#include <ours/task/thread.hpp>
+
+#include <ustl/sync/lockguard.hpp>
+
+#include <logz4/log.hpp>
+#include <gktl/init_hook.hpp>
+
+namespace ours::mem {
+    static Mutex s_reclaimer_mutex;
+    static FrameReclaimerList s_reclaimer_list;
+
+    auto register_frame_reclaimer(FrameReclaimer &reclaimer) -> void {
+        ustl::sync::LockGuard guard(s_reclaimer_mutex);
+        s_reclaimer_list.push_back(reclaimer);
+        log::trace("Frame reclaimer[{}] registered", reclaimer.name());
+    }
+
+    auto unregister_frame_reclaimer(FrameReclaimer &reclaimer) -> void {
+        ustl::sync::LockGuard guard(s_reclaimer_mutex);
+        s_reclaimer_list.erase(s_reclaimer_list.iterator_to(reclaimer));
+    }
+
+    auto reclaim_frames(NodeId nid, usize target) -> usize {
+        ustl::sync::LockGuard guard(s_reclaimer_mutex);
+
+        usize nr_freed = 0;
+        for (auto &reclaimer : s_reclaimer_list) {
+            if (nr_freed >= target) {
+                break;
+            }
+            nr_freed += reclaimer.reclaim(nid, target - nr_freed);
+        }
+
+        return nr_freed;
+    }
+
+    auto PmNode::balance_zones() -> void {
+        while (1) {
+            // Bring every zone up to the high mark rather than just out of `Moderate`, 
+            // otherwise the next few allocations would wake the daemon again.
+            usize target = 0;
+            for (auto zone : zone_queues_.get_queue(ZoneQueues::LocalContiguous)) {
+                auto const goal = zone->watermark(PmZone::WaterMark::Sufficient);
+                auto const nr_free = zone->managed_frames();
+                if (nr_free < goal) {
+                    target += goal - nr_free;
+                }
+            }
+
+            if (!target || !reclaim(target)) {
+                log::warn("Node[{}]: reclaimd made no progress, {} frames are in demand", id_, target);
+                break;
+            }
+        }
+    }
+
+    auto PmNode::reclaimd_routine() -> i32 {
+        log::trace("Node[{}]: reclaimd is running", id_);
+        while (1) {
+            reclaimd_wait_.wait_until([this] {
+                return reclaim_pending_.exchange(false, ustl::sync::MemoryOrder::AcqRel);
+            }, true);
+            balance_zones();
+
+            // Applicants retry after every round, they give up by themselves once their
+            // retries run out.
+            reclaim_rounds_.fetch_add(1, ustl::sync::MemoryOrder::Release);
+            reclaim_wait_.wake_all();
+        }
+
+        return 0;
+    }
+
+    INIT_CODE
+    static auto init_reclaimd() -> void {
+        global_node_states().for_each_state(NodeStates::Memory, [] (NodeId nid) {
+            auto const status = PmNode::node(nid)->start_reclaimd();
+            if (Status::Ok != status) {
+                log::error("Node[{}]: Failed to start reclaimd, reason: {}", nid, to_string(status));
+            }
+        });
+    }
+    GKTL_INIT_HOOK(ReclaimdInit, init_reclaimd, gktl::InitLevel::Arch);
+
+} // namespace ours::mem
\ No newline at end of file
@@ -0,0 +1,134 @@
+#include "pmm-sim.hpp"
+
+#include <gtest/gtest.h>
+
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace ours;
+using namespace ours::mem;
+
+struct FrameSetTestFixture
+    : public testing::Test {
+
+    /// Small enough for checking all invariants after every operation.
+    static constexpr usize kNumNodes = 2;
+    static constexpr usize kFramesPerNode = BIT(MAX_FRAME_ORDER) * 8;
+
+    /// Fixed, so a failure can be replayed.
+    static constexpr u64 kSeed = 0x5EED'0F'B0DD7;
+
+    static auto SetUpTestSuite() -> void {
+        sim = new sim::PmmSim(kNumNodes, kFramesPerNode);
+    }
+
+    auto TearDown() -> void override {
+        // Tests share the simulator, each leaves it as it was.
+        for (auto frame : live) {
+            sim->free(frame);
+        }
+        live.clear();
+    }
+
+    /// Lower orders are far more common, as on a real machine.
+    auto random_order() -> usize {
+        auto const order = usize(std::countr_zero(rng() | BIT(MAX_FRAME_ORDER)));
+        return order;
+    }
+
+    auto random_type() -> MigrateType {
+        return MigrateType(rng() % kNumMigrateTypes);
+    }
+
+    /// Allocate with probability |alloc_percent|, or free a random live block.
+    auto random_op(usize alloc_percent) -> void {
+        if (live.empty() || rng() % 100 < alloc_percent) {
+            auto const nid = NodeId(rng() % kNumNodes);
+            if (auto frame = sim->alloc(nid, random_order(), random_type())) {
+                live.push_back(frame);
+            }
+        } else {
+            auto const i = rng() % live.size();
+            std::swap(live[i], live.back());
+            sim->free(live.back());
+            live.pop_back();
+        }
+    }
+
+    auto dump_frag_stats(char const *when) -> void {
+        for (NodeId nid = 0; nid < kNumNodes; ++nid) {
+            auto const stats = sim->frag_stats(nid);
+            std::printf("[%s] Node[%u]: free=%zu, max order=%zu, unusable(pageblock)=%.3f, unusable(max)=%.3f\n",
+                when, unsigned(nid), stats.nr_free, stats.max_order,
+                stats.unusable_index(PAGEBLOCK_ORDER),
+                stats.unusable_index(MAX_FRAME_ORDER)
+            );
+        }
+    }
+
+    static inline sim::PmmSim *sim;
+    std::mt19937_64 rng{kSeed};
+    std::vector<PmFrame *> live;
+};
+
+TEST_F(FrameSetTestFixture, RandomizedWorkload) {
+    std::string error;
+    for (usize i = 0; i < 20'000; ++i) {
+        random_op(55);
+        ASSERT_TRUE(sim->check(error)) << "after operation " << i << ": " << error;
+    }
+    dump_frag_stats("churn");
+}
+
+TEST_F(FrameSetTestFixture, CoalescesFully) {
+    for (usize i = 0; i < 5'000; ++i) {
+        random_op(70);
+    }
+    for (auto frame : live) {
+        sim->free(frame);
+    }
+    live.clear();
+
+    std::string error;
+    ASSERT_TRUE(sim->check(error)) << error;
+
+    // Nothing allocated, so everything must be back in blocks of the largest order.
+    for (NodeId nid = 0; nid < kNumNodes; ++nid) {
+        auto const stats = sim->frag_stats(nid);
+        EXPECT_EQ(stats.nr_free, kFramesPerNode);
+        EXPECT_EQ(stats.nr_blocks[MAX_FRAME_ORDER], kFramesPerNode >> MAX_FRAME_ORDER);
+    }
+}
+
+TEST_F(FrameSetTestFixture, Exhaustion) {
+    std::string error;
+    for (NodeId nid = 0; nid < kNumNodes; ++nid) {
+        while (auto frame = sim->alloc(nid, 0, random_type())) {
+            live.push_back(frame);
+        }
+        EXPECT_EQ(sim->frag_stats(nid).nr_free, 0);
+    }
+    ASSERT_EQ(live.size(), kNumNodes * kFramesPerNode);
+    ASSERT_TRUE(sim->check(error)) << error;
+}
+
+TEST_F(FrameSetTestFixture, Throughput) {
+    // Checks are left out, they would dominate the time.
+    usize const kNumOps = 1'000'000;
+    auto const start = std::chrono::steady_clock::now();
+    for (usize i = 0; i < kNumOps; ++i) {
+        random_op(50);
+    }
+    auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    auto const ops_per_sec = usize(kNumOps / elapsed);
+    std::printf("%zu operations in %.3fs, %zu ops/sec\n", kNumOps, elapsed, ops_per_sec);
+    RecordProperty("ops_per_sec", std::to_string(ops_per_sec));
+    dump_frag_stats("throughput");
+
+    std::string error;
+    ASSERT_TRUE(sim->check(error)) << error;
+}
@@ -0,0 +1,213 @@
+#include "pmm-sim.hpp"
+
+#include <ours/mem/early-mem.hpp>
+#include <ours/mem/pmm.hpp>
+
+#include <ktl/new.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <format>
+
+// What the kernel would provide to `MemoryModel`. The simulator starts right in the state
+// that PMM is enabled, so frame maps come from the host heap.
+namespace ours::mem {
+    bool g_pmm_enabled = true;
+
+} // namespace ours::mem
+
+static auto sim_allocate(usize size) -> void * {
+    size = (size + PAGE_SIZE - 1) & ~usize(PAGE_SIZE - 1);
+    auto const ptr = std::aligned_alloc(PAGE_SIZE, size);
+    if (!ptr) {
+        std::abort();
+    }
+    // Frame descriptors are expected to be zeroed as on the real machine.
+    std::memset(ptr, 0, size);
+    return ptr;
+}
+
+auto operator new(usize size, ktl::Gaf) -> void * {
+    return sim_allocate(size);
+}
+
+auto operator new[](usize size, ktl::Gaf) -> void * {
+    return sim_allocate(size);
+}
+
+auto operator new(usize size, ktl::Gaf, ktl::NodeId) -> void * {
+    return sim_allocate(size);
+}
+
+auto operator new[](usize size, ktl::Gaf, ktl::NodeId) -> void * {
+    return sim_allocate(size);
+}
+
+namespace ours::mem::sim {
+    auto FragStats::unusable_index(usize order) const -> double {
+        if (!nr_free) {
+            return 0.0;
+        }
+
+        usize usable = 0;
+        for (auto i = order; i < NR_FRAME_ORDERS; ++i) {
+            usable += nr_blocks[i] << i;
+        }
+        return 1.0 - double(usable) / double(nr_free);
+    }
+
+    /// No region is reported, ranges are added by the simulator itself.
+    static phys::EarlyMem s_sim_bootmem = {
+        .iterate = [] (phys::BootMem::IterationContext &) -> ustl::Option<bootmem::Region> {
+            return ustl::NONE;
+        },
+    };
+
+    PmmSim::PmmSim(usize nr_nodes, usize frames_per_node)
+        : frames_per_node_(frames_per_node),
+          sets_(),
+          allocated_()
+    {
+        // Each node has a section, and whole blocks of the largest order.
+        if (frames_per_node > MemoryModel::kFramesPerLevel[0] || frames_per_node % BIT(MAX_FRAME_ORDER)) {
+            std::abort();
+        }
+
+        EarlyMem::s_bootmem = &s_sim_bootmem;
+        global_memory_model().init(false);
+
+        for (NodeId nid = 0; nid < nr_nodes; ++nid) {
+            auto const start = base_pfn(nid);
+            auto const end = start + frames_per_node;
+            if (Status::Ok != global_memory_model().add_range(pfn_to_phys(start), pfn_to_phys(end), nid)) {
+                std::abort();
+            }
+
+            for (auto pfn = start; pfn < end; ++pfn) {
+                pfn_to_frame(pfn)->init(ZoneType::Normal, pfn_to_secnum(pfn), nid);
+            }
+
+            auto set = std::make_unique<FrameSet>();
+            for (auto pfn = start; pfn < end; pfn += BIT(MAX_FRAME_ORDER)) {
+                set->release_frame(pfn_to_frame(pfn), MAX_FRAME_ORDER);
+            }
+            sets_.push_back(std::move(set));
+        }
+    }
+
+    auto PmmSim::alloc(NodeId nid, usize order, MigrateType type) -> PmFrame * {
+        auto const frame = sets_[nid]->acquire_frame(order, type);
+        if (frame) {
+            allocated_[frame_to_pfn(frame)] = order;
+        }
+        return frame;
+    }
+
+    auto PmmSim::free(PmFrame *frame) -> void {
+        auto const it = allocated_.find(frame_to_pfn(frame));
+        if (it == allocated_.end()) {
+            std::abort();
+        }
+        auto const order = it->second;
+        allocated_.erase(it);
+        sets_[frame->nid()]->release_frame(frame, order);
+    }
+
+    auto PmmSim::check_node(NodeId nid, std::string &error) -> bool {
+        auto const start = base_pfn(nid);
+        auto const end = start + frames_per_node_;
+
+        // 0: untouched, 1: free, 2: allocated.
+        std::vector<u8> owner(frames_per_node_);
+        std::map<Pfn, usize> free_blocks;
+
+        auto cover = [&] (Pfn pfn, usize order, u8 who) {
+            if (pfn < start || pfn + BIT(order) > end) {
+                error = std::format("Node[{}]: block 0x{:X}/{} is out of [0x{:X}, 0x{:X})", nid, pfn, order, start, end);
+                return false;
+            }
+            for (auto i = pfn; i < pfn + BIT(order); ++i) {
+                if (owner[i - start]) {
+                    error = std::format("Node[{}]: frame 0x{:X} of block 0x{:X}/{} overlaps", nid, i, pfn, order);
+                    return false;
+                }
+                owner[i - start] = who;
+            }
+            return true;
+        };
+
+        auto ok = true;
+        sets_[nid]->for_each_free_block([&] (PmFrame *frame, usize order) {
+            auto const pfn = frame_to_pfn(frame);
+            if (!ok) {
+                return;
+            }
+            if (pfn & (BIT(order) - 1)) {
+                error = std::format("Node[{}]: free block 0x{:X}/{} is misaligned", nid, pfn, order);
+                ok = false;
+            } else if (!frame->is_role(PfRole::Pmm) || frame->order() != order) {
+                error = std::format("Node[{}]: head of free block 0x{:X}/{} is corrupted", nid, pfn, order);
+                ok = false;
+            } else {
+                ok = cover(pfn, order, 1);
+                free_blocks[pfn] = order;
+            }
+        });
+        if (!ok) {
+            return false;
+        }
+
+        for (auto [pfn, order] : allocated_) {
+            if (pfn >= start && pfn < end && !cover(pfn, order, 2)) {
+                return false;
+            }
+        }
+
+        for (auto pfn = start; pfn < end; ++pfn) {
+            if (!owner[pfn - start]) {
+                error = std::format("Node[{}]: frame 0x{:X} is neither free nor allocated", nid, pfn);
+                return false;
+            }
+        }
+
+        // Every free block must have been merged with its buddy if the latter is free too.
+        for (auto [pfn, order] : free_blocks) {
+            if (order >= MAX_FRAME_ORDER) {
+                continue;
+            }
+            auto const buddy = free_blocks.find(pfn ^ Pfn(BIT(order)));
+            if (buddy != free_blocks.end() && buddy->second == order) {
+                error = std::format("Node[{}]: free buddies 0x{:X} and 0x{:X} of order {} are not merged",
+                    nid, pfn, buddy->first, order);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    auto PmmSim::check(std::string &error) -> bool {
+        for (NodeId nid = 0; nid < sets_.size(); ++nid) {
+            if (!check_node(nid, error)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    auto PmmSim::frag_stats(NodeId nid) -> FragStats {
+        FragStats stats = {};
+        stats.max_order = NR_FRAME_ORDERS;
+        sets_[nid]->for_each_free_block([&] (PmFrame *, usize order) {
+            stats.nr_free += BIT(order);
+            stats.nr_blocks[order] += 1;
+            if (stats.max_order == NR_FRAME_ORDERS || order > stats.max_order) {
+                stats.max_order = order;
+            }
+        });
+
+        return stats;
+    }
+
+} // namespace ours::mem::sim
@@ -0,0 +1,88 @@
+/// Copyright(C) 2024 smallhuazi
+///
+/// This program is free software; you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published
+/// by the Free Software Foundation; either version 2 of the License, or
+/// (at your option) any later version.
+///
+/// For additional information, please refer to the following website:
+/// https://opensource.org/license/gpl-2-0
+///
+#ifndef OURS_MEM_TESTS_PMM_SIM_HPP
+#define OURS_MEM_TESTS_PMM_SIM_HPP 1
+
+#include <ours/mem/pm_zone.hpp>
+#include <ours/mem/memory_model.hpp>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ours::mem::sim {
+    /// Free frames of a node broken down by order.
+    struct FragStats {
+        usize nr_free;
+        usize nr_blocks[NR_FRAME_ORDERS];
+
+        /// The highest order with a free block, `NR_FRAME_ORDERS` if nothing is free.
+        usize max_order;
+
+        /// How much of free memory can not serve a request of |order|, in [0, 1].
+        auto unusable_index(usize order) const -> double;
+    };
+
+    /// `PmmSim` runs the buddy allocator on the host. `MemoryModel` is backed by frame maps
+    /// on the host heap over a fake physical range, each simulated node owns a section of
+    /// it and a `FrameSet` managing the section.
+    ///
+    /// Frames are never touched through the physical map, so the fake range needs no
+    /// backing memory.
+    ///
+    /// `MemoryModel` is a singleton, so there is at most one simulator per process.
+    class PmmSim {
+        typedef PmmSim  Self;
+    public:
+        PmmSim(usize nr_nodes, usize frames_per_node);
+
+        auto alloc(NodeId nid, usize order, MigrateType type) -> PmFrame *;
+
+        auto free(PmFrame *frame) -> void;
+
+        /// Verify that free blocks are well formed, no frame is both free and allocated or
+        /// free twice, no frame is lost, and no two free buddies are left unmerged.
+        ///
+        /// Return false with |error| describing the first violation.
+        auto check(std::string &error) -> bool;
+
+        auto frag_stats(NodeId nid) -> FragStats;
+
+        auto nr_allocated() const -> usize {
+            return allocated_.size();
+        }
+
+        auto nr_nodes() const -> usize {
+            return sets_.size();
+        }
+
+        auto frames_per_node() const -> usize {
+            return frames_per_node_;
+        }
+
+        auto base_pfn(NodeId nid) const -> Pfn {
+            return Pfn(nid + 1) * MemoryModel::kFramesPerLevel[0];
+        }
+
+    private:
+        auto check_node(NodeId nid, std::string &error) -> bool;
+
+        usize frames_per_node_;
+        std::vector<std::unique_ptr<FrameSet>> sets_;
+
+        /// Allocated blocks, from their first pfn to their order.
+        std::map<Pfn, usize> allocated_;
+    };
+
+} // namespace ours::mem::sim
+
+#endif // #ifndef OURS_MEM_TESTS_PMM_SIM_HPP
@@ -2,13 +2,14 @@
 #include <ours/mem/vm_area.hpp>
 
 #include <ustl/mem/align.hpp>
+#include <ustl/algorithms/minmax.hpp>
 #include <logz4/log.hpp>
 
 namespace ours::mem {
     VmAreaOrMapping::VmAreaOrMapping(VirtAddr base, usize size, VmaFlags vmaf, 
                                      VmArea *parent, VmAspace *aspace, char const *name)
         : canary_(), base_(base), size_(size), vmaf_(vmaf), parent_(parent), 
-          aspace_(aspace), name_(name), children_hook_()
+          aspace_(aspace), name_(name), children_hook_(), gap_(0), subtree_gap_(0)
     {}
 
     auto VmAreaOrMapping::validate_mmuflags(MmuFlags mmuf) const -> bool {
@@ -69,7 +70,159 @@ namespace ours::mem {
         return false;
     }
 
-    auto VmaSet::find_spot(usize size, AlignVal align, VirtAddr low_limit, VirtAddr high_limit)
+    auto VmaSet::erase(Iter pos) -> IterMut {
+        auto const node = pos.pointed_node();
+        pos.unconst()->dec_strong_ref();
+
+        // The deepest place the tree changes at. A VMA with two children is replaced by its
+        // successor, which leaves its own place.
+        auto deepest = NodeTraits::get_parent(node);
+        if (NodeTraits::get_left(node) && NodeTraits::get_right(node)) {
+            auto successor = pos;
+            ++successor;
+            deepest = NodeTraits::get_parent(successor.pointed_node());
+            if (deepest == node) {
+                deepest = successor.pointed_node();
+            }
+        }
+
+        auto next = Base::erase(pos);
+        if (deepest != header()) {
+            propagate_gaps(deepest);
+        }
+        if (next != end()) {
+            update_gap(next);
+        }
+        return next;
+    }
+
+    auto VmaSet::link_gaps(IterMut iter) -> void {
+        update_gap(iter);
+        if (++iter != end()) {
+            update_gap(iter);
+        }
+    }
+
+    auto VmaSet::update_gap(IterMut iter) -> void {
+        // The first one counts from zero, bounds of a search are applied by the search.
+        VirtAddr prev_end = 0;
+        if (iter != begin()) {
+            auto prev = iter;
+            --prev;
+            prev_end = prev->base_ + prev->size_;
+        }
+        iter->gap_ = iter->base_ - prev_end;
+        propagate_gaps(iter.pointed_node());
+    }
+
+    auto VmaSet::propagate_gaps(NodePtr node) -> void {
+        auto update = [] (NodePtr node) {
+            auto const vma = to_vma(node);
+            auto gap = vma->gap_;
+            if (auto left = NodeTraits::get_left(node)) {
+                gap = ustl::algorithms::max(gap, to_vma(left)->subtree_gap_);
+            }
+            if (auto right = NodeTraits::get_right(node)) {
+                gap = ustl::algorithms::max(gap, to_vma(right)->subtree_gap_);
+            }
+            vma->subtree_gap_ = gap;
+        };
+
+        for (auto const head = header(); node != head; node = NodeTraits::get_parent(node)) {
+            if (auto left = NodeTraits::get_left(node)) {
+                update(left);
+            }
+            if (auto right = NodeTraits::get_right(node)) {
+                update(right);
+            }
+            update(node);
+        }
+    }
+
+    /// Place |size| bytes aligned to |align| in the gap [start, end) clipped by [lower, upper),
+    /// at the lowest address or the highest one if |top_down|.
+    FORCE_INLINE
+    static auto fit_in_gap(VirtAddr start, VirtAddr end, usize size, usize align,
+                           VirtAddr lower, VirtAddr upper, bool top_down) -> ustl::Option<VirtAddr> {
+        start = ustl::algorithms::max(start, lower);
+        end = ustl::algorithms::min(end, upper);
+        if (end <= start || end - start < size) {
+            return ustl::none();
+        }
+
+        if (top_down) {
+            auto const addr = ustl::mem::align_down(end - size, align);
+            if (addr < start) {
+                return ustl::none();
+            }
+            return ustl::some(addr);
+        }
+
+        auto const addr = ustl::mem::align_up(start, align);
+        if (addr < start || addr > end - size) {
+            return ustl::none();
+        }
+        return ustl::some(addr);
+    }
+
+    auto VmaSet::find_lowest(NodePtr node, usize length, usize size, usize align, VirtAddr lower, VirtAddr upper)
+        const -> ustl::Option<VirtAddr> {
+        if (!node || to_vma(node)->subtree_gap_ < length) {
+            return ustl::none();
+        }
+
+        auto const vma = to_vma(node);
+        // VMAs on the left all end before this one, their gaps are below lower if this one
+        // starts too close to it.
+        if (vma->base_ >= lower && vma->base_ - lower >= length) {
+            if (auto addr = find_lowest(NodeTraits::get_left(node), length, size, align, lower, upper)) {
+                return addr;
+            }
+        }
+
+        auto const gap_start = vma->base_ - vma->gap_;
+        if (gap_start >= upper || upper - gap_start < length) {
+            // Gaps on the right start even higher.
+            return ustl::none();
+        }
+        if (vma->gap_ >= length) {
+            if (auto addr = fit_in_gap(gap_start, vma->base_, size, align, lower, upper, false)) {
+                return addr;
+            }
+        }
+
+        return find_lowest(NodeTraits::get_right(node), length, size, align, lower, upper);
+    }
+
+    auto VmaSet::find_highest(NodePtr node, usize length, usize size, usize align, VirtAddr lower, VirtAddr upper)
+        const -> ustl::Option<VirtAddr> {
+        if (!node || to_vma(node)->subtree_gap_ < length) {
+            return ustl::none();
+        }
+
+        auto const vma = to_vma(node);
+        // VMAs on the right all start after this one ends.
+        auto const end = vma->base_ + vma->size_;
+        if (end < upper && upper - end >= length) {
+            if (auto addr = find_highest(NodeTraits::get_right(node), length, size, align, lower, upper)) {
+                return addr;
+            }
+        }
+
+        if (vma->base_ < lower || vma->base_ - lower < length) {
+            // Gaps on the left end even lower.
+            return ustl::none();
+        }
+        if (vma->gap_ >= length) {
+            if (auto addr = fit_in_gap(vma->base_ - vma->gap_, vma->base_, size, align, lower, upper, true)) {
+                return addr;
+            }
+        }
+
+        return find_highest(NodeTraits::get_left(node), length, size, align, lower, upper);
+    }
+
+    auto VmaSet::find_spot(usize size, AlignVal align, VirtAddr lower, VirtAddr upper, bool top_down)
         const -> ustl::Result<VirtAddr, Status> {
         if (!size) {
             return ustl::err(Status::InvalidArguments);
@@ -78,24 +231,51 @@ namespace ours::mem {
             align = PAGE_SIZE;
         }
 
-        // The core logic is to find a gap between two existing areas, if the gap has enough size
-        // then we return the base address of it. Range [low_limit, high_limit) must be a available
-        // address interval to avoid doing additional bound check.
-        auto requested_size = ustl::mem::align_up(size, align);
-        VirtAddr addr = ustl::mem::align_up(low_limit, PAGE_SIZE);
-        for (auto i = upper_bound(addr), last = end(); i != last; ++i) {
-            if (addr > high_limit) {
-                return ustl::err(Status::NotFound);
+        size = ustl::mem::align_up(size, PAGE_SIZE);
+        lower = ustl::mem::align_up(lower, PAGE_SIZE);
+        if (upper <= lower || upper - lower < size) {
+            return ustl::err(Status::NotFound);
+        }
+
+        // Any gap of |length| holds |size| at |align|. Smaller gaps might still hold it if
+        // they happen to be aligned, they are checked one by one only if no gap of |length|
+        // is found.
+        auto const length = size + align - PAGE_SIZE;
+        auto const check_exactly = length != size;
+        auto const root = NodeTraits::get_parent(header());
+
+        // The gap after the last VMA is not in the tree.
+        VirtAddr last_end = 0;
+        if (!empty()) {
+            auto const &last = *rbegin();
+            last_end = last.base_ + last.size_;
+        }
+
+        if (top_down) {
+            if (auto addr = fit_in_gap(last_end, upper, size, align, lower, upper, true)) {
+                return ustl::ok(*addr);
             }
-            if (i->base_ >= addr + requested_size) {
-                return ustl::ok(addr);
+            if (auto addr = find_highest(root, length, size, align, lower, upper)) {
+                return ustl::ok(*addr);
             }
-
-            addr = ustl::mem::align_up(i->base_ + i->size_, align);
+            if (check_exactly) {
+                if (auto addr = find_highest(root, size, size, align, lower, upper)) {
+                    return ustl::ok(*addr);
+                }
+            }
+            return ustl::err(Status::NotFound);
         }
 
-        if (addr + requested_size <= high_limit) {
-            return ustl::ok(addr);
+        if (auto addr = find_lowest(root, length, size, align, lower, upper)) {
+            return ustl::ok(*addr);
+        }
+        if (auto addr = fit_in_gap(last_end, upper, size, align, lower, upper, false)) {
+            return ustl::ok(*addr);
+        }
+        if (check_exactly) {
+            if (auto addr = find_lowest(root, size, size, align, lower, upper)) {
+                return ustl::ok(*addr);
+            }
         }
         return ustl::err(Status::NotFound);
     }
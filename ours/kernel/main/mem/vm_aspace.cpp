@@ -1,16 +1,19 @@
 #include <ours/mem/vm_aspace.hpp>
 #include <ours/mem/vm_area.hpp>
 #include <ours/mem/vm_mapping.hpp>
+#include <ours/mem/vm_object_paged.hpp>
 #include <ours/mem/object-cache.hpp>
 
 #include <ours/arch/aspace_layout.hpp>
 
 #include <ustl/lazy_init.hpp>
 #include <ustl/sync/lockguard.hpp>
+#include <ustl/algorithms/search.hpp>
 
 #include <logz4/log.hpp>
 #include <gktl/init_hook.hpp>
 #include <ktl/new.hpp>
+#include <ktl/vec.hpp>
 
 namespace ours::mem {
     /// Manage the lifetime manually.
@@ -91,7 +94,125 @@ namespace ours::mem {
     }
 
     auto VmAspace::clone(VmasFlags flags, ustl::Rc<VmAspace> *out) -> Status {
-        return Status::Unimplemented;
+        canary_.verify();
+        if (!is_user() || !(flags & VmasFlags::User)) {
+            // The kernel address space is the only one.
+            return Status::Unsupported;
+        }
+
+        ustl::Rc<VmAspace> aspace;
+        auto status = Self::create(base_, size_, flags, "U:Clone", &aspace);
+        if (Status::Ok != status) {
+            return status;
+        }
+
+        {
+            VmoCloneMap clones;
+            ustl::sync::LockGuard guard(mutex_);
+            status = clone_area_locked(root_vma_.as_ptr_mut(), aspace->root_vma_.as_ptr_mut(), clones);
+        }
+        if (Status::Ok != status) {
+            aspace->root_vma_->destroy();
+            return status;
+        }
+
+        *out = ustl::move(aspace);
+        return Status::Ok;
+    }
+
+    /// Sorted by the source VMO. An address space rarely has many VMOs, a sorted array is
+    /// cheaper than a tree for them.
+    class VmAspace::VmoCloneMap {
+      public:
+        struct Entry {
+            VmObject *source;
+            ustl::Rc<VmObject> clone;
+        };
+
+        auto find(VmObject *source) -> ustl::Rc<VmObject> * {
+            auto const it = lower_bound(source);
+            if (it == entries_.end() || it->source != source) {
+                return nullptr;
+            }
+            return &it->clone;
+        }
+
+        auto insert(VmObject *source, ustl::Rc<VmObject> clone) -> void {
+            entries_.insert(lower_bound(source), Entry{source, ustl::move(clone)});
+        }
+
+      private:
+        auto lower_bound(VmObject *source) -> ktl::Vec<Entry>::iterator {
+            return ustl::algorithms::lower_bound(entries_.begin(), entries_.end(), source,
+                [] (Entry const &entry, VmObject *source) {
+                    return entry.source < source;
+                }
+            );
+        }
+
+        ktl::Vec<Entry> entries_;
+    };
+
+    auto VmAspace::clone_vmo_locked(VmMapping &mapping, VmoCloneMap &clones, ustl::Rc<VmObject> *out) -> Status {
+        // Writes through a shared mapping are seen by both spaces, so is its VMO. Only paged
+        // VMOs have pages of their own to copy on write.
+        auto const paged = downcast<VmObjectPaged>(mapping.vmo_.as_ptr_mut());
+        if (!paged || !!(mapping.vmaf_ & VmaFlags::Share)) {
+            *out = mapping.vmo_;
+            return Status::Ok;
+        }
+
+        // Private mappings of the same VMO keep sharing pages with each other in the clone.
+        if (auto clone = clones.find(paged)) {
+            *out = *clone;
+            return Status::Ok;
+        }
+
+        ustl::Rc<VmObjectPaged> clone;
+        auto status = paged->create_clone(this, &clone);
+        if (Status::Ok != status) {
+            return status;
+        }
+
+        *out = ustl::move(clone);
+        clones.insert(paged, *out);
+        return Status::Ok;
+    }
+
+    auto VmAspace::clone_area_locked(VmArea *src, VmArea *dst, VmoCloneMap &clones) -> Status {
+        for (auto &child : src->subvmas_) {
+            if (child.is_mapping()) {
+                auto &source = static_cast<VmMapping &>(child);
+                ustl::Rc<VmObject> vmo;
+                auto status = clone_vmo_locked(source, clones, &vmo);
+                if (Status::Ok != status) {
+                    return status;
+                }
+
+                ustl::Rc<VmMapping> mapping;
+                status = source.clone_locked(dst, ustl::move(vmo), &mapping);
+                if (Status::Ok != status) {
+                    return status;
+                }
+                dst->num_mappings_ += 1;
+                continue;
+            }
+
+            auto &area = static_cast<VmArea &>(child);
+            ustl::Rc<VmArea> vma;
+            auto status = VmArea::create(area.base_, area.size_, area.vmaf_ & ~VmaFlags::Active, dst, 
+                                         dst->aspace_.as_ptr_mut(), area.name_, &vma);
+            if (Status::Ok != status) {
+                return status;
+            }
+
+            status = clone_area_locked(&area, vma.as_ptr_mut(), clones);
+            if (Status::Ok != status) {
+                return status;
+            }
+        }
+
+        return Status::Ok;
     }
 
     auto VmAspace::init() -> Status {
@@ -114,7 +235,7 @@ namespace ours::mem {
         return root_vma_;
     }
 
-    auto VmAspace::fault(VirtAddr virt_addr, VmfCause cause) -> void {
+    auto VmAspace::fault(VirtAddr virt_addr, VmfCause cause) -> Status {
         if (!fault_cache_) [[likely]] {
             // if (fault_cache_->contains(virt_addr)) {
             // }
@@ -123,9 +244,11 @@ namespace ours::mem {
             //     fault_cache_ = ustl::move(fault);
             // }
         }
-        if (fault_cache_) {
-            VmFault vmf;
-            fault_cache_->fault(&vmf);
+        if (!fault_cache_) {
+            return Status::NotFound;
         }
+
+        VmFault vmf{virt_addr, 1, cause};
+        return fault_cache_->fault(&vmf);
     }
 }
\ No newline at end of file
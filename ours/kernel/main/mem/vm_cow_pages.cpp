@@ -4,15 +4,40 @@
 
 #include <gktl/init_hook.hpp>
 #include <ktl/new.hpp>
+#include <ustl/mem/align.hpp>
+#include <ustl/algorithms/minmax.hpp>
+#include <ustl/algorithms/copy.hpp>
 
 namespace ours::mem {
     static ObjectCache *s_vm_cow_pages_cache;
 
     VmCowPages::VmCowPages(Gaf gaf, usize nr_pages)
         : gaf_(gaf),
+          policy_(),
           size_(nr_pages)
     {}
 
+    VmCowPages::~VmCowPages() {
+        pagemap_.for_each([] (PgOff, VmPage *head, usize order) {
+            release_folio(head, order);
+        });
+        pagemap_.clear();
+    }
+
+    auto VmCowPages::release_folio(VmPage *head, usize order) -> void {
+        // Clones drop their references without any common lock, so whoever drops the last
+        // one frees it.
+        if (head->num_users.fetch_sub(1, ustl::sync::MemoryOrder::AcqRel) != 1) {
+            return;
+        }
+
+        auto const frame = head->to_pmm();
+        for (usize i = 0; i < BIT(order); ++i) {
+            frame[i].clear_pinned();
+        }
+        free_frame(frame, order);
+    }
+
     auto VmCowPages::create(Gaf gaf, usize size, ustl::Rc<VmCowPages> *out) -> Status {
         auto cow_pages = new (*s_vm_cow_pages_cache, kGafKernel) Self(gaf, size);
         if (!cow_pages) {
@@ -27,8 +52,99 @@ namespace ours::mem {
         return ustl::ok(Cursor(this, offset, size));
     }
 
-    auto VmCowPages::alloc_pages(usize order, VmPage **page, PageRequest *page_request) -> Status {
-        auto frame = alloc_frame(gaf_, order);
+    auto VmCowPages::copy_folio_locked(PgOff first, VmPage *head, usize order) -> PmFrame * {
+        auto const gaf = order ? gaf_ | Gaf::Folio : gaf_;
+        auto const frame = alloc_frame(mem_policy_locked(), first, gaf, order);
+        if (!frame) {
+            return nullptr;
+        }
+
+        auto const src = frame_to_virt<u64>(head->to_pmm());
+        auto const dst = frame_to_virt<u64>(frame);
+        ustl::algorithms::copy_n(src, (PAGE_SIZE / sizeof(u64)) << order, dst);
+        return frame;
+    }
+
+    auto VmCowPages::clone_locked(ustl::Rc<VmCowPages> *out) -> Status {
+        ustl::Rc<VmCowPages> child;
+        auto status = VmCowPages::create(gaf_, size_, &child);
+        if (Status::Ok != status) {
+            return status;
+        }
+        child->policy_ = policy_;
+
+        // Only the page map is walked, no page is touched except pinned ones, so it takes
+        // time in the number of entries rather than of pages.
+        pagemap_.for_each([&] (PgOff first, VmPage *head, usize order) {
+            if (Status::Ok != status) {
+                return;
+            }
+
+            if (pagemap_.test_mark(first, VmPageMap::Mark::Pinned)) {
+                // Someone may be writing to it behind the MMU, so the clone takes a copy.
+                auto const frame = copy_folio_locked(first, head, order);
+                if (!frame || !child->insert_owned_page_locked(first, frame, order)) {
+                    status = Status::OutOfMem;
+                }
+                return;
+            }
+
+            status = child->pagemap_.insert_folio(first, head, order);
+            if (Status::Ok != status) {
+                return;
+            }
+            head->num_users.fetch_add(1, ustl::sync::MemoryOrder::Relaxed);
+            pagemap_.set_mark(first, VmPageMap::Mark::Shared);
+            child->pagemap_.set_mark(first, VmPageMap::Mark::Shared);
+        });
+
+        // Pages shared so far are released by the child on destruction. Those left marked
+        // shared here are taken back by the last-reference path of `break_cow_locked`.
+        if (Status::Ok != status) {
+            return status;
+        }
+
+        *out = ustl::move(child);
+        return Status::Ok;
+    }
+
+    auto VmCowPages::break_cow_locked(PgOff index, PgOff *first, usize *order) -> ustl::Result<bool, Status> {
+        auto const head = pagemap_.get_folio(index, first, order);
+        if (!head) {
+            *first = index;
+            *order = 0;
+            return ustl::ok(false);
+        }
+        if (!pagemap_.test_mark(*first, VmPageMap::Mark::Shared)) {
+            return ustl::ok(false);
+        }
+
+        // The others have copied their own or gone, so no copy is needed. Nobody else
+        // can take a new reference, that is done only by cloning this object.
+        if (head->num_users.load(ustl::sync::MemoryOrder::Acquire) == 1) {
+            pagemap_.clear_mark(*first, VmPageMap::Mark::Shared);
+            return ustl::ok(false);
+        }
+
+        auto const frame = copy_folio_locked(*first, head, *order);
+        if (!frame) {
+            return ustl::err(Status::OutOfMem);
+        }
+        for (usize i = 0; i < BIT(*order); ++i) {
+            role_cast<PfRole::Vmm>(frame[i])->vmo_index = *first + i;
+        }
+
+        auto const copy = role_cast<PfRole::Vmm>(frame);
+        copy->num_users.store(1, ustl::sync::MemoryOrder::Relaxed);
+        pagemap_.replace_folio(*first, copy, *order);
+        pagemap_.clear_mark(*first, VmPageMap::Mark::Shared);
+        release_folio(head, *order);
+
+        return ustl::ok(true);
+    }
+
+    auto VmCowPages::alloc_pages(PgOff index, usize order, VmPage **page, PageRequest *page_request) -> Status {
+        auto frame = alloc_frame(mem_policy_locked(), index, gaf_, order);
         if (!frame) {
             return Status::OutOfMem;
         }
@@ -36,6 +152,137 @@ namespace ours::mem {
         return Status::Ok;
     }
 
+    auto VmCowPages::insert_owned_page_locked(PgOff first, PmFrame *frame, usize order) -> VmPage * {
+        for (usize i = 0; i < BIT(order); ++i) {
+            role_cast<PfRole::Vmm>(frame[i])->vmo_index = first + i;
+        }
+
+        auto const head = role_cast<PfRole::Vmm>(frame);
+        head->num_users.store(1, ustl::sync::MemoryOrder::Relaxed);
+        auto status = pagemap_.insert_folio(first, head, order);
+        if (Status::Ok != status) {
+            // Callers look up before allocating, so only a node allocation fails here.
+            free_frame(frame, order);
+            return nullptr;
+        }
+        return head;
+    }
+
+    template <typename F>
+    auto VmCowPages::for_each_entry_locked(VirtAddr offset, usize size, F &&f) -> Status {
+        auto const last = (offset + size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+        for (auto i = offset >> PAGE_SHIFT; i < last; ) {
+            PgOff first;
+            usize order;
+            auto const head = pagemap_.get_folio(i, &first, &order);
+            if (!head) {
+                return Status::NotFound;
+            }
+
+            f(first, head, order);
+            i = first + BIT(order);
+        }
+
+        return Status::Ok;
+    }
+
+    auto VmCowPages::pin_range_locked(VirtAddr offset, usize size) -> Status {
+        if (!size || offset + size > size_) {
+            return Status::InvalidArguments;
+        }
+
+        // Nothing is pinned unless the whole range is present.
+        auto status = for_each_entry_locked(offset, size, [] (PgOff, VmPage *, usize) {});
+        if (Status::Ok != status) {
+            return status;
+        }
+
+        return for_each_entry_locked(offset, size, [this] (PgOff first, VmPage *head, usize order) {
+            if (pagemap_.test_mark(first, VmPageMap::Mark::Pinned)) {
+                return;
+            }
+            pagemap_.set_mark(first, VmPageMap::Mark::Pinned);
+
+            // Frames tell PMM users like hotplug that they can not be taken away.
+            auto const frame = head->to_pmm();
+            for (usize i = 0; i < BIT(order); ++i) {
+                frame[i].mark_pinned();
+            }
+        });
+    }
+
+    auto VmCowPages::unpin_range_locked(VirtAddr offset, usize size) -> void {
+        if (offset + size > size_) {
+            return;
+        }
+
+        // Absent pages were never pinned, so they are skipped rather than stopping at them.
+        auto const last = (offset + size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+        for (auto i = offset >> PAGE_SHIFT; i < last; ) {
+            auto const next = pagemap_.find_mark(i, VmPageMap::Mark::Pinned);
+            if (!next || *next >= last) {
+                break;
+            }
+
+            PgOff first;
+            usize order;
+            auto const head = pagemap_.get_folio(*next, &first, &order);
+            pagemap_.clear_mark(first, VmPageMap::Mark::Pinned);
+
+            auto const frame = head->to_pmm();
+            for (usize j = 0; j < BIT(order); ++j) {
+                frame[j].clear_pinned();
+            }
+            i = first + BIT(order);
+        }
+    }
+
+    auto VmCowPages::mark_dirty_locked(VirtAddr offset, usize size) -> void {
+        auto const last = (offset + size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+        for (auto i = offset >> PAGE_SHIFT; i < last; ) {
+            PgOff first;
+            usize order;
+            if (!pagemap_.get_folio(i, &first, &order)) {
+                i += 1;
+                continue;
+            }
+
+            pagemap_.set_mark(first, VmPageMap::Mark::Dirty);
+            i = first + BIT(order);
+        }
+    }
+
+    auto VmCowPages::commit_folio_locked(MemPolicy const &policy, PgOff index) -> usize {
+        if (!VMO_FOLIO_ORDER) {
+            return 0;
+        }
+
+        auto const first = ustl::mem::align_down(index, VMO_FOLIO_NR_FRAMES);
+        auto const last = first + VMO_FOLIO_NR_FRAMES;
+        if ((last << PAGE_SHIFT) > size_) {
+            return 0;
+        }
+        for (auto i = first; i < last; ++i) {
+            if (pagemap_.get_page(i)) {
+                return 0;
+            }
+        }
+
+        // Small pages are always the fallback, so it is not worth reclaiming for a folio.
+        auto const gaf = (gaf_ | Gaf::Folio) & ~(Gaf::NeverFail | Gaf::Reclaim | Gaf::DirectlyReclaim);
+        auto const frame = alloc_frame(policy, first, gaf, VMO_FOLIO_ORDER);
+        if (!frame) {
+            return 0;
+        }
+
+        // A single entry covers the folio, so any page of it is found in one walk.
+        if (!insert_owned_page_locked(first, frame, VMO_FOLIO_ORDER)) {
+            return 0;
+        }
+
+        return VMO_FOLIO_NR_FRAMES;
+    }
+
     auto VmCowPages::commit_range_locked(VirtAddr offset, usize size, ai_out usize *nr_commited) -> Status {
         if (!size) {
             return Status::InvalidArguments;
@@ -45,42 +292,125 @@ namespace ours::mem {
             return Status::InvalidArguments;
         }
 
-        auto cursor = make_cursor(offset, size);
-        if (!cursor) {
-            return Status::InternalError;
-        }
+        auto const first = offset >> PAGE_SHIFT;
+        auto const last = (offset + size + PAGE_SIZE - 1) >> PAGE_SHIFT;
 
-        auto status = Status::Ok;
-        auto commited = 0;
-        PageRequest page_request;
-        for (auto i = 0; i < size; i += PAGE_SIZE) {
-            auto result = cursor->require_owned_page(1, &page_request);
-            if (!result) {
-                status = result.unwrap_err();
-                DEBUG_ASSERT(status != Status::ShouldWait);
-                break;
+        usize nr_absent = 0;
+        for (auto i = first; i < last; ++i) {
+            if (!pagemap_.get_page(i)) {
+                nr_absent += 1;
             }
-            commited += 1;
         }
 
         if (nr_commited) {
-            *nr_commited = commited;
+            *nr_commited = 0;
+        }
+        if (!nr_absent) {
+            return Status::Ok;
+        }
+
+        // Aligned ranges covered entirely by the request go to folios first.
+        auto const policy = mem_policy_locked();
+        if (VMO_FOLIO_ORDER) {
+            auto i = ustl::mem::align_up(first, VMO_FOLIO_NR_FRAMES);
+            for (; i + VMO_FOLIO_NR_FRAMES <= last; i += VMO_FOLIO_NR_FRAMES) {
+                auto const n = commit_folio_locked(policy, i);
+                nr_absent -= n;
+                if (nr_commited) {
+                    *nr_commited += n;
+                }
+            }
+            if (!nr_absent) {
+                return Status::Ok;
+            }
+        }
+
+        if (MemPolicyMode::Interleave == policy.mode()) {
+            return commit_interleaved_locked(policy, first, last, nr_commited);
+        }
+
+        // Request all absent pages at once instead of page by page, so the zone
+        // lock is taken only a few times for a large range.
+        FrameList<> frames;
+        auto status = alloc_frames_bulk(policy, gaf_, &frames, nr_absent);
+        if (Status::Ok != status) {
+            return status;
+        }
+
+        for (auto i = first; i < last; ++i) {
+            if (pagemap_.get_page(i)) {
+                continue;
+            }
+
+            auto &frame = frames.front();
+            frames.pop_front();
+            if (!insert_owned_page_locked(i, &frame)) {
+                free_frames(&frames);
+                return Status::OutOfMem;
+            }
+            if (nr_commited) {
+                *nr_commited += 1;
+            }
         }
+        DEBUG_ASSERT(frames.empty());
 
-        return status;
+        return Status::Ok;
+    }
+
+    auto VmCowPages::commit_interleaved_locked(MemPolicy const &policy, PgOff first, PgOff last, ai_out usize *nr_commited) 
+        -> Status {
+        // Each page goes to the node chosen by its index, so they are allocated one by one.
+        for (auto i = first; i < last; ++i) {
+            if (pagemap_.get_page(i)) {
+                continue;
+            }
+
+            auto frame = alloc_frame(policy, i, gaf_, 0);
+            if (!frame) {
+                return Status::OutOfMem;
+            }
+            if (!insert_owned_page_locked(i, frame)) {
+                return Status::OutOfMem;
+            }
+            if (nr_commited) {
+                *nr_commited += 1;
+            }
+        }
+
+        return Status::Ok;
     }
 
     /// The followings are in class VmCowPages::Cursor.
 
-    VmCowPages::Cursor::Cursor(VmCowPages *cow_pages, VirtAddr offset, usize sizer_pages)
-        : owner_(cow_pages) 
+    VmCowPages::Cursor::Cursor(VmCowPages *cow_pages, VirtAddr offset, usize size)
+        : owner_(cow_pages),
+          offset_(offset),
+          end_(offset + size)
     {}
 
-    auto VmCowPages::Cursor::require_owned_page(usize nr_pages, PageRequest *page_request)
+    auto VmCowPages::Cursor::require_page(usize nr_pages, PageRequest *page_request, bool *shared)
         -> ustl::Result<VmPage *, Status> {
+        auto const index = offset_ >> PAGE_SHIFT;
+        *shared = false;
+        if (auto page = owner_->pagemap_.get_page(index)) {
+            *shared = owner_->pagemap_.test_mark(index, VmPageMap::Mark::Shared);
+            offset_ += PAGE_SIZE;
+            return ustl::ok(page);
+        }
+
+        if (owner_->commit_folio_locked(owner_->mem_policy_locked(), index)) {
+            offset_ += PAGE_SIZE;
+            return ustl::ok(owner_->pagemap_.get_page(index));
+        }
+
         VmPage *page = nullptr;
-        auto status = owner_->alloc_pages(0, &page, page_request);
+        auto status = owner_->alloc_pages(index, 0, &page, page_request);
         if (Status::Ok == status) {
+            page = owner_->insert_owned_page_locked(index, page->to_pmm());
+            if (!page) {
+                return ustl::err(Status::OutOfMem);
+            }
+            offset_ += PAGE_SIZE;
             return ustl::ok(page);
         }
 
@@ -88,6 +418,42 @@ namespace ours::mem {
         return ustl::err(create_read_request(nr_pages, page_request));
     }
 
+    auto VmCowPages::Cursor::break_cow(VirtAddr *offset, usize *size) -> ustl::Result<bool, Status> {
+        PgOff first;
+        usize order;
+        auto result = owner_->break_cow_locked(offset_ >> PAGE_SHIFT, &first, &order);
+        if (result && result.unwrap()) {
+            *offset = first << PAGE_SHIFT;
+            *size = usize(BIT(order)) << PAGE_SHIFT;
+        }
+        return result;
+    }
+
+    auto VmCowPages::Cursor::commit_pages(usize nr_pages) -> Status {
+        auto const size = ustl::algorithms::min(nr_pages << PAGE_SHIFT, end_ - offset_);
+        if (!size) {
+            return Status::Ok;
+        }
+
+        return owner_->commit_range_locked(offset_, size, nullptr);
+    }
+
+    auto VmCowPages::Cursor::lookup_page(bool *shared) -> VmPage * {
+        if (offset_ >= end_) {
+            return nullptr;
+        }
+
+        auto const index = offset_ >> PAGE_SHIFT;
+        auto page = owner_->pagemap_.get_page(index);
+        if (page) {
+            if (shared) {
+                *shared = owner_->pagemap_.test_mark(index, VmPageMap::Mark::Shared);
+            }
+            offset_ += PAGE_SIZE;
+        }
+        return page;
+    }
+
     auto VmCowPages::Cursor::create_read_request(usize nr_pages, PageRequest *page_request) -> Status {
         return Status::Unimplemented;
     }
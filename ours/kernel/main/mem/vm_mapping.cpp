@@ -43,8 +43,9 @@ namespace ours::mem {
 
     auto MappingRegionSet::make_enumerator(VirtAddr base, usize size) -> Enumerator {
         using namespace ustl::algorithms;
+        // Ends are exclusive, a region ending at |base| does not cover it.
         auto first = lower_bound(regions_.begin(), regions_.end(), base, [] (auto const &x, auto y) {
-            return x.end < y;
+            return x.end <= y;
         });
 
         auto last = upper_bound(regions_.begin(), regions_.end(), base, [] (auto const &x, auto y) {
@@ -58,6 +59,21 @@ namespace ours::mem {
         return Enumerator(base, first, last, base, base + size);
     }
 
+    auto MappingRegionSet::copy_from(MappingRegionSet const &other) -> Status {
+        DEBUG_ASSERT(regions_.empty());
+        for (auto const &region : other.regions_) {
+            auto copy = alloc_region(region.end, region.mmuf);
+            if (!copy) {
+                regions_.clear_and_dispose(free_region);
+                return Status::OutOfMem;
+            }
+            // Already in order, so each goes to the end.
+            regions_.insert(regions_.end(), *copy);
+        }
+
+        return Status::Ok;
+    }
+
     auto MappingRegionSet::update(VirtAddr base, usize size, MmuFlags mmuf,
                                   VirtAddr lower_limit, VirtAddr upper_limit) -> Status {
         using namespace ustl::algorithms;
@@ -115,13 +131,14 @@ namespace ours::mem {
         // We have to allocate remaining regions.
         ustl::collections::StaticVec<Region *, 2> reuse;
         if (nr_reclaimable < new_regions_needed) {
+            // All or nothing, so none is leaked on failure. They are constructed below.
             auto const n = new_regions_needed - nr_reclaimable;
-            while (reuse.size() != n) {
-                auto new_region = alloc_region();
-                if (!new_region) {
-                    return Status::OutOfMem;
-                }
-                reuse.push_back(new_region);
+            void *new_regions[2];
+            if (!s_vm_mapping_region_cache->allocate_bulk(n, kGafKernel, current_node(), new_regions)) {
+                return Status::OutOfMem;
+            }
+            for (auto i = 0; i < n; ++i) {
+                reuse.push_back(static_cast<Region *>(new_regions[i]));
             }
         }
 
@@ -149,6 +166,12 @@ namespace ours::mem {
     }
 
     /// This helper class was used to batch mapping requests.
+    ///
+    /// Physically contiguous pages are gathered into a run instead of the batch, a run too
+    /// long for the batch is mapped as a whole, so large pages can be used for it.
+    ///
+    /// Pages are mapped as `append` goes, so a failure may come from either `append` or
+    /// `commit`. Nothing is mapped after a failure.
     template <usize MaxNumPages>
     class MappingCoalescer {
     public:
@@ -157,6 +180,8 @@ namespace ours::mem {
               va_(base),
               mmuf_(mmuf),
               nr_pages_(0),
+              run_base_(0),
+              nr_run_pages_(0),
               map_ctrl_(ctrl),
               total_mapped_(0)
         {}
@@ -165,10 +190,15 @@ namespace ours::mem {
         auto commit() -> Status;
 
     private:
+        auto commit_run() -> Status;
+        auto commit_batch() -> Status;
+
         VmMapping *mapping_;
         VirtAddr va_;
         PhysAddr pa_[MaxNumPages];
         usize nr_pages_;
+        PhysAddr run_base_;
+        usize nr_run_pages_;
         usize total_mapped_;
         MmuFlags mmuf_;
         MapControl map_ctrl_;
@@ -177,16 +207,74 @@ namespace ours::mem {
     template <usize MaxNumPages>
     FORCE_INLINE
     auto MappingCoalescer<MaxNumPages>::append(PhysAddr phys) -> Status {
-        pa_[nr_pages_++] = phys;
-        if (nr_pages_ == MaxNumPages) {
-            return commit();
+        if (nr_run_pages_ && phys == run_base_ + nr_run_pages_ * PAGE_SIZE) {
+            nr_run_pages_ += 1;
+            return Status::Ok;
         }
-        return Status::Ok;
+
+        auto status = commit_run();
+        run_base_ = phys;
+        nr_run_pages_ = 1;
+        return status;
+    }
+
+    template <usize MaxNumPages>
+    FORCE_INLINE
+    auto MappingCoalescer<MaxNumPages>::commit_run() -> Status {
+        if (!nr_run_pages_) {
+            return Status::Ok;
+        }
+
+        auto status = Status::Ok;
+        if (nr_run_pages_ < MaxNumPages) {
+            // Short runs are not worth a walk of page table of their own.
+            for (usize i = 0; i < nr_run_pages_; ++i) {
+                pa_[nr_pages_++] = run_base_ + i * PAGE_SIZE;
+                if (nr_pages_ == MaxNumPages) {
+                    status = commit_batch();
+                    if (Status::Ok != status) {
+                        break;
+                    }
+                }
+            }
+            nr_run_pages_ = 0;
+            return status;
+        }
+
+        // Pages in batch precede the run.
+        status = commit_batch();
+        if (Status::Ok != status) {
+            nr_run_pages_ = 0;
+            return status;
+        }
+
+        usize nr_mapped = 0;
+        status = mapping_->aspace()
+                         ->arch_aspace()
+                         .map(va_, run_base_, nr_run_pages_, mmuf_, map_ctrl_ | MapControl::TryLargePage, &nr_mapped);
+        if (Status::Ok != status) {
+            log::error("Failed to map {} contiguous pages at {}", nr_run_pages_, va_);
+        }
+
+        va_ += nr_run_pages_ * PAGE_SIZE;
+        nr_run_pages_ = 0;
+        total_mapped_ += nr_mapped;
+        return status;
     }
 
     template <usize MaxNumPages>
     FORCE_INLINE
     auto MappingCoalescer<MaxNumPages>::commit() -> Status {
+        auto status = commit_run();
+        if (Status::Ok != status) {
+            return status;
+        }
+        return commit_batch();
+    }
+
+    template <usize MaxNumPages>
+    FORCE_INLINE
+    auto MappingCoalescer<MaxNumPages>::commit_batch() -> Status {
         if (!nr_pages_) {
             return Status::Ok;
         }
@@ -194,7 +282,7 @@ namespace ours::mem {
         usize nr_mapped = 0;
         auto status = mapping_->aspace()
                               ->arch_aspace()
-                              .map_bulk(va_, pa_, nr_pages_, mmuf_, MapControl::TryLargePage, &nr_mapped);
+                              .map_bulk(va_, pa_, nr_pages_, mmuf_, map_ctrl_ | MapControl::TryLargePage, &nr_mapped);
         if (Status::Ok != status) {
             log::error("Failed to map {} pages at {}", nr_pages_, va_);
         }
@@ -202,13 +290,13 @@ namespace ours::mem {
         va_ += nr_pages_ * PAGE_SIZE;
         nr_pages_ = 0;
         total_mapped_ += nr_mapped;
-        return Status::Ok;
+        return status;
     }
 
     VmMapping::VmMapping(VmArea *parent, VirtAddr base, usize size, VmaFlags vmaf,
                          ustl::Rc<VmObject> vmo, usize vmo_off, const char *name)
         : Base(base, size, vmaf | VmaFlags::Mapping, parent, parent->aspace().as_ptr_mut(), name),
-          vmo_off_(vmo_off), vmo_(ustl::move(vmo)), regions_()
+          vmo_off_(vmo_off), vmo_(ustl::move(vmo)), regions_(), fault_next_(0), fault_window_(1)
     {}
 
     auto VmMapping::create(VmArea *parent, VirtAddr base, usize size, VmaFlags vmaf,
@@ -270,7 +358,7 @@ namespace ours::mem {
         CXX11_CONSTEXPR
         static auto const kMaxBatchPages = 32;
 
-        auto cursor = vmo->make_cursor(base, size);
+        auto cursor = vmo->make_cursor(base - base_ + vmo_off_, size);
         if (!cursor) {
             return cursor.unwrap_err();
         }
@@ -280,17 +368,44 @@ namespace ours::mem {
             auto [base, size, mmuf] = *region;
             MappingCoalescer<kMaxBatchPages> coalescer(this, base, mmuf, control);
 
+            // Populate the whole region in batch, then the loop below just looks pages up.
+            auto status = cursor->commit_pages(size >> PAGE_SHIFT);
+            if (Status::Ok != status) {
+                return status;
+            }
+
+            // Pages shared with a clone are copied before they are mapped writable.
+            auto const writable = !!(mmuf & MmuFlags::Writable);
             PageRequest page_request;
             for (auto i = 0; i < size; i += PAGE_SIZE) {
-                auto result = cursor->require_owned_page(1, &page_request);
+                if (writable) {
+                    VirtAddr offset;
+                    usize moved_size;
+                    auto moved = cursor->break_cow(&offset, &moved_size);
+                    if (!moved) {
+                        return moved.unwrap_err();
+                    }
+                    if (moved.unwrap()) {
+                        vmo->unmap_mappings(offset, moved_size);
+                    }
+                }
+
+                bool shared;
+                auto result = cursor->require_page(1, &page_request, &shared);
                 if (!result) {
                     return result.unwrap_err();
                 }
 
-                coalescer.append(frame_to_phys(*result));
+                status = coalescer.append(frame_to_phys(*result));
+                if (Status::Ok != status) {
+                    return status;
+                }
             }
             // Commit those uncovered units in for loop above.
-            coalescer.commit();
+            status = coalescer.commit();
+            if (Status::Ok != status) {
+                return status;
+            }
         }
 
         return Status::Ok;
@@ -313,10 +428,16 @@ namespace ours::mem {
             auto [base, size, mmuf] = *region;
             MappingCoalescer<kMaxBatchPages> coalescer(this, base, mmuf, control);
             for (auto offset = 0; offset < size; offset += PAGE_SIZE) {
-                coalescer.append(phys_base + offset);
+                status = coalescer.append(phys_base + offset);
+                if (Status::Ok != status) {
+                    return status;
+                }
             }
 
-            coalescer.commit();
+            status = coalescer.commit();
+            if (Status::Ok != status) {
+                return status;
+            }
         }
 
         return Status::Ok;
@@ -421,7 +542,177 @@ namespace ours::mem {
         return Status::Ok;
     }
 
-    auto VmMapping::fault(VmFault *vmf) -> void {
+    auto VmMapping::fault_paged(VmObjectPaged *vmo, VirtAddr base, usize nr_pages, MmuFlags mmuf, bool write,
+                                usize *nr_mapped) -> Status {
+        auto cursor = vmo->make_cursor(base - base_ + vmo_off_, nr_pages << PAGE_SHIFT);
+        if (!cursor) {
+            return cursor.unwrap_err();
+        }
+
+        // Neighbours are allocated in one batch with the faulting page. If it fails, only
+        // those already present are mapped.
+        if (nr_pages > 1) {
+            cursor->commit_pages(nr_pages);
+        }
+
+        // A write to a page shared with a clone takes a copy of its own. The old page may be
+        // mapped by any mapping of the VMO, even as a part of a large page, so all of them
+        // drop it first.
+        if (write) {
+            VirtAddr offset;
+            usize size;
+            auto moved = cursor->break_cow(&offset, &size);
+            if (!moved) {
+                return moved.unwrap_err();
+            }
+            if (moved.unwrap()) {
+                vmo->unmap_mappings(offset, size);
+            }
+        }
+
+        PageRequest page_request;
+        bool shared;
+        auto result = cursor->require_page(1, &page_request, &shared);
+        if (!result) {
+            return result.unwrap_err();
+        }
+
+        // A shared page is mapped read-only until written. A write replaces the read-only
+        // entry left by an earlier read, otherwise pages mapped already are skipped.
+        if (shared) {
+            mmuf &= ~MmuFlags::Writable;
+        }
+        auto const control = write ? MapControl::OverwriteIfExisting : MapControl::SkipIfExisting;
+        MappingCoalescer<kMaxFaultAround> coalescer(this, base, mmuf, control);
+        auto status = coalescer.append(frame_to_phys(*result));
+        if (Status::Ok != status) {
+            return status;
+        }
+
+        // Neighbours go with the same MMU flags, so they are mapped while they are shared
+        // or not as the faulting page is.
+        usize nr_appended = 1;
+        for (; nr_appended < nr_pages; ++nr_appended) {
+            bool neighbour_shared = false;
+            auto page = cursor->lookup_page(&neighbour_shared);
+            if (!page || neighbour_shared != shared) {
+                break;
+            }
+
+            status = coalescer.append(frame_to_phys(page));
+            if (Status::Ok != status) {
+                return status;
+            }
+        }
+
+        status = coalescer.commit();
+        if (Status::Ok != status) {
+            return status;
+        }
+
+        *nr_mapped = nr_appended;
+        return Status::Ok;
+    }
+
+    auto VmMapping::fault(VmFault *vmf) -> Status {
+        canary_.verify();
+
+        if (!is_active()) {
+            return Status::BadState;
+        }
+
+        ustl::sync::LockGuard guard(*lock());
+        VirtAddr const va = ustl::mem::align_down(vmf->va, PAGE_SIZE);
+        if (!check_range(va, PAGE_SIZE)) {
+            return Status::InvalidArguments;
+        }
+
+        // A fault right after the pages mapped by the last one means a sequential scan, so
+        // more pages are worth mapping ahead. Otherwise the window backs off, and random
+        // access ends up faulting page by page without wasting memory.
+        if (va == fault_next_) {
+            fault_window_ = ustl::algorithms::min(fault_window_ * 2, kMaxFaultAround);
+        } else {
+            fault_window_ = ustl::algorithms::max(fault_window_ / 2, usize(1));
+        }
+        auto const nr_pages = ustl::algorithms::min(fault_window_, (base_ + size_ - va) >> PAGE_SHIFT);
+
+        // Neighbours are mapped as long as they share the MMU flags of the faulting page.
+        auto enumerator = regions_.make_enumerator(va, nr_pages << PAGE_SHIFT);
+        auto region = enumerator.next();
+        if (!region) {
+            return Status::NotFound;
+        }
+
+        auto [base, size, mmuf] = *region;
+        if (!(mmuf & MmuFlags::PermMask)) {
+            return Status::NoCapability;
+        }
+        if (!!(vmf->cause & VmfCause::Write) && !(mmuf & MmuFlags::Writable)) {
+            return Status::NoCapability;
+        }
+
+        // Only a fault fully served moves the window on, a failed one must not make the
+        // next fault look sequential.
+        auto status = Status::Unsupported;
+        usize nr_mapped = 0;
+        if (auto paged = downcast<VmObjectPaged>(vmo_.as_ptr_mut())) {
+            status = fault_paged(paged, base, size >> PAGE_SHIFT, mmuf, !!(vmf->cause & VmfCause::Write), &nr_mapped);
+        } else if (auto physical = downcast<VmObjectPhysical>(vmo_.as_ptr_mut())) {
+            status = map_physical(physical, base, size, MapControl::SkipIfExisting);
+            nr_mapped = size >> PAGE_SHIFT;
+        }
+
+        if (Status::Ok == status) {
+            fault_next_ = va + (nr_mapped << PAGE_SHIFT);
+        }
+        return status;
+    }
+
+    auto VmMapping::write_protect_locked() -> void {
+        auto &arch_aspace = aspace_->arch_aspace();
+        auto enumerator = regions_.make_enumerator(base_, size_);
+        while (auto region = enumerator.next()) {
+            auto [base, size, mmuf] = *region;
+            if (!(mmuf & MmuFlags::Writable)) {
+                continue;
+            }
+
+            arch_aspace.protect(base, size >> PAGE_SHIFT, mmuf & ~MmuFlags::Writable);
+        }
+    }
+
+    auto VmMapping::unmap_vmo_range(VirtAddr offset, usize size) -> void {
+        auto const first = ustl::algorithms::max(offset, vmo_off_);
+        auto const last = ustl::algorithms::min(offset + size, vmo_off_ + size_);
+        if (first >= last) {
+            return;
+        }
+
+        aspace_->arch_aspace().unmap(base_ + first - vmo_off_, (last - first) >> PAGE_SHIFT, UnmapControl::None, 0);
+    }
+
+    auto VmMapping::clone_locked(VmArea *parent, ustl::Rc<VmObject> vmo, ustl::Rc<VmMapping> *out) -> Status {
+        canary_.verify();
+
+        // The flags of state and type are given back by the constructor and `activate`.
+        auto const vmaf = vmaf_ & ~(VmaFlags::Active | VmaFlags::Mapping);
+        auto mapping = new (*s_vm_mapping_cache, kGafKernel) VmMapping(
+            parent, base_, size_, vmaf, ustl::move(vmo), vmo_off_, name_);
+        if (!mapping) {
+            return Status::OutOfMem;
+        }
+
+        auto status = mapping->regions_.copy_from(regions_);
+        if (Status::Ok != status) {
+            s_vm_mapping_cache->deallocate(mapping);
+            return status;
+        }
+        mapping->activate();
+
+        // Nothing is mapped in the clone yet, its pages come by faults.
+        *out = ustl::make_rc<Self>(mapping);
+        return Status::Ok;
     }
 
     INIT_CODE
@@ -9,4 +9,10 @@ namespace ours::mem {
           children_(),
           children_hook_()
     {}
+
+    auto VmObject::unmap_mappings(VirtAddr offset, usize size) -> void {
+        for (auto &mapping : mappings_) {
+            mapping.unmap_vmo_range(offset, size);
+        }
+    }
 }
\ No newline at end of file
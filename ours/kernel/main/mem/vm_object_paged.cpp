@@ -18,13 +18,18 @@ namespace ours::mem {
           cow_pages_(ustl::move(cowpages))
     {}
 
-    auto VmObjectPaged::create(Gaf gaf, usize size, VmoFLags vmof, ustl::Rc<VmObjectPaged> *out) -> Status {
+    auto VmObjectPaged::create(Gaf gaf, usize size, VmoFLags vmof, ustl::Rc<VmObjectPaged> *out, 
+                               ustl::Option<MemPolicy> const &policy) -> Status {
         // Check vmof
         ustl::Rc<VmCowPages> cow_pages;
         auto status = VmCowPages::create(gaf, size, &cow_pages);
         if (Status::Ok != status) {
             return status;
         }
+        // Must be settled before the first commit below.
+        if (policy) {
+            cow_pages->set_mem_policy_locked(*policy);
+        }
 
         auto vmo = new (*s_vmo_paged_cache, kGafKernel) VmObjectPaged(vmof, ustl::move(cow_pages));
         if (!vmo) {
@@ -62,18 +67,95 @@ namespace ours::mem {
             return Status::OutOfRange;
         }
 
-        for (auto i = 0; i < size; i += PAGE_SIZE) {
-            usize nr_commited = 0;
-            auto status = cow_pages_->commit_range_locked(offset, size, &nr_commited);
+        // The whole range is committed in batch.
+        usize nr_commited = 0;
+        auto status = cow_pages_->commit_range_locked(offset, size, &nr_commited);
+        if (status != Status::Ok && status != Status::ShouldWait) {
+            return status;
+        }
+
+        // Pages to be written, by CPU or devices behind the MMU, can not be shared.
+        if (!!(option & (CommitOptions::Write | CommitOptions::Pin))) {
+            status = break_cow_range_locked(offset, size);
+            if (Status::Ok != status) {
+                return status;
+            }
+        }
+
+        if (!!(option & CommitOptions::Write)) {
+            cow_pages_->mark_dirty_locked(offset, size);
+        }
+        if (!!(option & CommitOptions::Pin)) {
+            return cow_pages_->pin_range_locked(offset, size);
+        }
+
+        return Status::Ok;
+    }
+
+    auto VmObjectPaged::break_cow_range_locked(VirtAddr offset, usize size) -> Status {
+        auto const last = (offset + size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+        for (auto i = offset >> PAGE_SHIFT; i < last; ) {
+            PgOff first;
+            usize order;
+            auto moved = cow_pages_->break_cow_locked(i, &first, &order);
+            if (!moved) {
+                return moved.unwrap_err();
+            }
+            if (moved.unwrap()) {
+                unmap_mappings(first << PAGE_SHIFT, usize(BIT(order)) << PAGE_SHIFT);
+            }
+
+            // A folio is done as a whole.
+            i = first + BIT(order);
+        }
+
+        return Status::Ok;
+    }
+
+    auto VmObjectPaged::create_clone(VmAspace *aspace, ustl::Rc<VmObjectPaged> *out) -> Status {
+        canary_.verify();
+
+        // Writes through the mappings must fault before any page is shared. If the clone
+        // fails, they just fault once more to get the permission back. The lock of |aspace|
+        // is held by the caller, mappings elsewhere are protected under their own.
+        for (auto &mapping : mappings_) {
+            if (mapping.aspace().as_ptr_mut() == aspace) {
+                mapping.write_protect_locked();
+                continue;
+            }
+
+            ustl::sync::LockGuard guard(*mapping.lock());
+            mapping.write_protect_locked();
+        }
 
-            if (status != Status::Ok && status != Status::ShouldWait) {
+        ustl::Rc<VmCowPages> cow_pages;
+        {
+            ustl::sync::LockGuard guard(mutex_);
+            auto status = cow_pages_->clone_locked(&cow_pages);
+            if (Status::Ok != status) {
                 return status;
             }
         }
 
+        auto vmo = new (*s_vmo_paged_cache, kGafKernel) VmObjectPaged(vmof_, ustl::move(cow_pages));
+        if (!vmo) {
+            return Status::OutOfMem;
+        }
+
+        *out = ustl::make_rc<Self>(vmo);
         return Status::Ok;
     }
 
+    auto VmObjectPaged::set_mem_policy(MemPolicy const &policy) -> void {
+        ustl::sync::LockGuard guard(mutex_);
+        cow_pages_->set_mem_policy_locked(policy);
+    }
+
+    auto VmObjectPaged::mem_policy() -> MemPolicy {
+        ustl::sync::LockGuard guard(mutex_);
+        return cow_pages_->mem_policy_locked();
+    }
+
     auto VmObjectPaged::commit_range(VirtAddr offset, usize size, CommitOptions option) -> Status {
         canary_.verify();
         log::trace("VMO Commit Action: [ofs: {:X}, size: {:X}]", offset, size);
@@ -0,0 +1,62 @@
+#include <ours/mem/vm_area.hpp>
+#include <ours/mem/vm_aspace.hpp>
+#include <ours/tests/test.hpp>
+#include <ours/assert.hpp>
+
+#include <gktl/init_hook.hpp>
+
+namespace ours::test {
+    /// Gaps cached by `VmaSet` must follow insertions and removals, and `find_spot` must
+    /// find a gap which fits exactly. VMAs are standalone and never mapped, so any range
+    /// serves.
+    OTEST_ABI
+    static auto check_vma_set_gaps() -> void {
+        CXX11_CONSTEXPR
+        static VirtAddr const kBase = VirtAddr(1) << 32;
+
+        auto aspace = mem::VmAspace::kernel_aspace();
+        auto create = [&aspace] (usize first, usize nr_pages) {
+            ustl::Rc<mem::VmArea> vma;
+            auto const status = mem::VmArea::create_root(kBase + first * PAGE_SIZE, nr_pages * PAGE_SIZE,
+                                                         mem::VmaFlags::Read, aspace.as_ptr_mut(), "gap-test", &vma);
+            DEBUG_ASSERT(Status::Ok == status, "Failed to create VMA");
+            return vma;
+        };
+
+        mem::VmaSet set;
+        auto expect = [&set] (usize nr_pages, usize align_pages, usize upper_page, bool top_down, usize expected) {
+            auto const result = set.find_spot(nr_pages * PAGE_SIZE, align_pages * PAGE_SIZE, kBase,
+                                              kBase + upper_page * PAGE_SIZE, top_down);
+            DEBUG_ASSERT(result, "No spot found");
+            DEBUG_ASSERT(result.unwrap() == kBase + expected * PAGE_SIZE, "Wrong spot");
+        };
+
+        // [0, 16) and [32, 48) leave a gap of 16 pages aligned to 16 pages, it is smaller
+        // than the gap fitting at any alignment.
+        auto a = create(0, 16);
+        auto b = create(32, 16);
+        set.insert(*a);
+        set.insert(*b);
+        expect(16, 16, 48, false, 16);
+        expect(16, 16, 48, true, 16);
+
+        // Split the gap into [16, 20) and [24, 32).
+        auto c = create(20, 4);
+        set.insert(*c);
+        expect(8, 1, 48, false, 24);
+        expect(4, 1, 48, false, 16);
+
+        // Merge them back, the gap before `b` grows to 16 pages.
+        set.erase(set.iterator_to(*c));
+        expect(16, 1, 48, false, 16);
+
+        // The gap before `b` starts from zero, bounds of the search clip it.
+        set.erase(set.iterator_to(*a));
+        expect(32, 1, 48, false, 0);
+
+        set.erase(set.iterator_to(*b));
+        DEBUG_ASSERT(set.empty());
+    }
+    GKTL_INIT_HOOK(VmaSetGapTest, check_vma_set_gaps, gktl::InitLevel::Platform);
+
+} // namespace ours::test
@@ -0,0 +1,84 @@
+#include <ours/mem/zeroed_pool.hpp>
+#include <ours/mem/pm_node.hpp>
+#include <ours/mem/reclaim.hpp>
+#include <ours/mem/pmm.hpp>
+
+#include <ours/task/thread.hpp>
+
+#include <logz4/log.hpp>
+#include <gktl/init_hook.hpp>
+#include <ustl/algorithms/minmax.hpp>
+
+namespace ours::mem {
+    /// The worker runs at the lowest priority, so it mostly consumes idle time.
+    CXX11_CONSTEXPR
+    static auto const kZeroedInterval = ustl::chrono::Milliseconds(50);
+
+    auto PmNode::refill_zeroed_pool() -> void {
+        while (zeroed_pool_.count() < ZeroedPool::kHighMark && !under_pressure()) {
+            auto const n = ustl::algorithms::min<usize>(ZeroedPool::kHighMark - zeroed_pool_.count(), 32);
+
+            FrameList<> frames;
+            auto const status = alloc_frames_bulk(ZeroedPool::kGaf, n, &frames);
+            if (Status::Ok != status) {
+                break;
+            }
+
+            for (auto &frame : frames) {
+                zero_frames(&frame, 0);
+            }
+            zeroed_pool_.put(frames, n);
+        }
+    }
+
+    auto PmNode::zeroed_routine() -> i32 {
+        while (1) {
+            if (zeroed_pool_.needs_refill()) {
+                refill_zeroed_pool();
+            }
+
+            task::Thread::Current::sleep_for(kZeroedInterval, true);
+        }
+
+        return 0;
+    }
+
+    auto PmNode::start_zeroed() -> Status {
+        auto const thread = task::Thread::spawn("zeroed", 0, &Self::zeroed_routine, this);
+        if (!thread) {
+            return Status::OutOfMem;
+        }
+        thread->detach();
+        thread->resume();
+
+        return Status::Ok;
+    }
+
+    /// Under memory pressure, pre-zeroed frames are the cheapest ones to give back.
+    static auto reclaim_zeroed_pool(NodeId nid, usize target) -> usize {
+        auto const node = PmNode::node(nid);
+        if (!node) {
+            return 0;
+        }
+
+        FrameList<> frames;
+        auto const nr_drained = node->zeroed_pool().drain(target, frames);
+        free_frames(&frames);
+        return nr_drained;
+    }
+
+    INIT_CODE
+    static auto init_zeroed_pool() -> void {
+        static FrameReclaimer s_zeroed_reclaimer("zeroed-pool", reclaim_zeroed_pool);
+        register_frame_reclaimer(s_zeroed_reclaimer);
+
+        global_node_states().for_each_state(NodeStates::Memory, [] (NodeId nid) {
+            auto const status = PmNode::node(nid)->start_zeroed();
+            if (Status::Ok != status) {
+                log::error("Node[{}]: Failed to start zeroed, reason: {}", nid, to_string(status));
+            }
+        });
+    }
+    GKTL_INIT_HOOK(ZeroedPoolInit, init_zeroed_pool, gktl::InitLevel::Arch);
+
+} // namespace ours::mem
\ No newline at end of file
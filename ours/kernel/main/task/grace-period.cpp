@@ -0,0 +1,41 @@
+#include <ours/task/grace-period.hpp>
+#include <ours/task/scheduler.hpp>
+
+#include <ours/cpu-states.hpp>
+#include <ours/irq/mod.hpp>
+
+namespace ours::task {
+    auto GracePeriod::start() -> Self {
+        Self self;
+        self.cpus_ = cpu_online_mask();
+        for_each_cpu(self.cpus_, [&self] (CpuNum cpu) {
+            self.switches_[cpu] = MainScheduler::Current::get(cpu)->num_switches();
+        });
+
+        return self;
+    }
+
+    auto GracePeriod::has_elapsed() const -> bool {
+        auto const this_cpu = CpuLocal::cpunum();
+
+        bool elapsed = true;
+        for_each_cpu(cpus_, [this, this_cpu, &elapsed] (CpuNum cpu) {
+            auto const scheduler = MainScheduler::Current::get(cpu);
+            if (scheduler->num_switches() != switches_[cpu]) {
+                return Status::ShouldRetry;
+            }
+
+            // An idle cpu may still be reading from an interrupt handler. The calling cpu
+            // is never taken as idle, the caller itself may be a reader.
+            if (cpu != this_cpu && scheduler->is_idling() && !irq::irq_nesting(cpu)) {
+                return Status::ShouldRetry;
+            }
+
+            elapsed = false;
+            return Status::Ok;
+        });
+
+        return elapsed;
+    }
+
+} // namespace ours::task
@@ -0,0 +1,42 @@
+/// Copyright(C) 2024 smallhuazi
+///
+/// This program is free software; you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published
+/// by the Free Software Foundation; either version 2 of the License, or
+/// (at your option) any later version.
+///
+/// For additional information, please refer to the following website:
+/// https://opensource.org/license/gpl-2-0
+///
+#ifndef OURS_TASK_GRACE_PERIOD_HPP
+#define OURS_TASK_GRACE_PERIOD_HPP 1
+
+#include <ours/types.hpp>
+#include <ours/cpu-cfg.hpp>
+#include <ours/cpu-mask.hpp>
+
+#include <ustl/array.hpp>
+
+namespace ours::task {
+    /// `GracePeriod` is a snapshot of context switches of all online cpus.
+    ///
+    /// Lock-free readers hold pointers only with preemption disabled, so they can not live
+    /// through a context switch. Once every cpu has switched since the snapshot, or sits
+    /// idle outside of interrupt handlers, no reader which may have seen the state before
+    /// it is left.
+    class GracePeriod {
+        typedef GracePeriod     Self;
+      public:
+        static auto start() -> Self;
+
+        /// Safe to call within a reader, the calling cpu counts only once it has switched.
+        auto has_elapsed() const -> bool;
+
+      private:
+        CpuMask cpus_;
+        ustl::Array<usize, MAX_CPU> switches_;
+    };
+
+} // namespace ours::task
+
+#endif // #ifndef OURS_TASK_GRACE_PERIOD_HPP
@@ -147,6 +147,18 @@ namespace ours::task {
         auto is_active() const -> bool {
             return s_active_schedulers.load().test(this_cpu_);
         }
+
+        /// A context switch is a quiescent state of the cpu, see `GracePeriod`.
+        FORCE_INLINE
+        auto num_switches() const -> usize {
+            return num_switches_.load(ustl::sync::MemoryOrder::Acquire);
+        }
+
+        /// Whether the cpu is running its idle thread.
+        FORCE_INLINE
+        auto is_idling() const -> bool {
+            return idling_.load(ustl::sync::MemoryOrder::Acquire);
+        }
       private:
         static auto assign_target_cpu(Thread *) -> CpuNum;
 
@@ -175,7 +187,8 @@ namespace ours::task {
         Mutex mutex_;
         CpuNum this_cpu_;
         usize num_runnable_;
-        usize num_switches_;
+        ustl::sync::AtomicUsize num_switches_;
+        ustl::sync::Atomic<bool> idling_;
         SchedCommonData common_data_;
         ustl::views::Span<IScheduler *> schedulers_;
 
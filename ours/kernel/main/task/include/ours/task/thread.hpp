@@ -22,6 +22,7 @@
 #include <ours/task/sched-entity.hpp>
 #include <ours/mem/types.hpp>
 #include <ours/mem/stack.hpp>
+#include <ours/mem/mempolicy.hpp>
 #include <ours/syscall/time.hpp>
 
 /// ours::object::ThreadDispatcher (PS: It is so-called user-thread)
@@ -150,6 +151,17 @@ namespace ours::task {
 
         auto bind_user_thread(ustl::Rc<object::ThreadDispatcher> user_thread) -> void;
 
+        /// The policy applies to pages committed by this thread into VMOs without one.
+        FORCE_INLINE
+        auto mem_policy() const -> mem::MemPolicy const & {
+            return mem_policy_;
+        }
+
+        FORCE_INLINE
+        auto set_mem_policy(mem::MemPolicy const &policy) -> void {
+            mem_policy_ = policy;
+        }
+
         FORCE_INLINE
         auto kernel_stack() -> mem::Stack & {
             return kernel_stack_;
@@ -198,7 +210,7 @@ namespace ours::task {
 
         FORCE_INLINE
         auto clear_interruptible() -> Self & {
-            flags_ |= ThreadFlags::Interruptible;
+            flags_ &= ~ThreadFlags::Interruptible;
             return *this;
         }
 
@@ -212,6 +224,11 @@ namespace ours::task {
             return name_.data();
         }
 
+        FORCE_INLINE
+        auto waiter_state() -> WaiterState & {
+            return waiter_state_;
+        }
+
         FORCE_INLINE
         auto mutex() -> Mutex & {
             return mutex_;
@@ -234,6 +251,7 @@ namespace ours::task {
         ustl::Weak<mem::VmAspace> aspace_;
         ustl::Rc<object::ThreadDispatcher> user_thread_;
         mem::Stack kernel_stack_;
+        mem::MemPolicy mem_policy_;
 
         Mutex mutex_;
         Signals signals_;
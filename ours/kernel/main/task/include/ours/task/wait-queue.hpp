@@ -13,7 +13,10 @@
 
 #include <ours/types.hpp>
 #include <ours/status.hpp>
-#include <ustl/collections/intrusive/set.hpp>
+#include <ours/mutex.hpp>
+
+#include <ustl/sync/lockguard.hpp>
+#include <ustl/collections/intrusive/list.hpp>
 
 namespace ours::task {
     class WaiterState {
@@ -21,25 +24,74 @@ namespace ours::task {
       public:
         auto wait(bool interruptible, Status status) -> void;
 
+        /// Block until notified. It returns at once if a notification has come since the
+        /// waiter was armed with `Status::ShouldWait`.
+        auto wait(bool interruptible) -> void;
+
         auto notify(Status status) -> void;
 
+        FORCE_INLINE
+        auto arm(Status status) -> void {
+            status_ = status;
+        }
+
         FORCE_INLINE
         auto status() const -> Status {
             return status_;
         }
       private:
+        friend class WaitQueue;
+
         Status status_;
-        ustl::collections::intrusive::SetMemberHook<> managed_hook_;
+        ustl::collections::intrusive::ListMemberHook<> managed_hook_;
       public:
         USTL_DECLARE_HOOK_OPTION(Self, managed_hook_, ManagedOption);
     };
 
+    /// `WaitQueue` is a FIFO of threads blocked until an event. Wakers pass a status to
+    /// tell the waiters how the event went.
     class WaitQueue {
+        typedef WaitQueue   Self;
       public:
+        /// Block the current thread until it is woken up, return the status of the waker.
+        auto wait(bool interruptible) -> Status;
+
+        /// Block the current thread until |cond| holds. |cond| is checked with the queue
+        /// locked, so a wakeup right after a failed check is not lost.
+        template <typename Cond>
+        auto wait_until(Cond &&cond, bool interruptible) -> Status {
+            while (1) {
+                WaiterState *waiter;
+                {
+                    ustl::sync::LockGuard guard(mutex_);
+                    if (cond()) {
+                        return Status::Ok;
+                    }
+                    waiter = enqueue_current_locked();
+                }
+
+                auto const status = block(waiter, interruptible);
+                if (Status::Ok != status) {
+                    return status;
+                }
+            }
+        }
+
+        /// Wake up the longest waiter, return whether there was one.
+        auto wake_one(Status status = Status::Ok) -> bool;
+
+        /// Wake up all waiters, return how many there were.
+        auto wake_all(Status status = Status::Ok) -> usize;
 
       private:
-        USTL_DECLARE_MULTISET(WaiterState, WaiterStateSet, WaiterState::ManagedOption);
-        WaiterStateSet waiters_;
+        auto enqueue_current_locked() -> WaiterState *;
+
+        /// Wait on |waiter| queued before, and take it off the queue if it was not woken.
+        auto block(WaiterState *waiter, bool interruptible) -> Status;
+
+        USTL_DECLARE_LIST(WaiterState, WaiterStateList, WaiterState::ManagedOption);
+        Mutex mutex_;
+        WaiterStateList waiters_;
     };
 
 } // namespace ours::task
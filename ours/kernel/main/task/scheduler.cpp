@@ -101,7 +101,8 @@ namespace ours::task {
 
         // Everything be ok. Let us do the final and actual switch to context.
         if (next != curr) [[likely]] {
-            num_switches_ += 1;
+            idling_.store(next == idler_, ustl::sync::MemoryOrder::Release);
+            num_switches_.fetch_add(1, ustl::sync::MemoryOrder::Release);
 
             curr->sched_entity().preemption_state().clear_pending();
             switch_context(curr, next);
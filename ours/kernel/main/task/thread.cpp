@@ -29,7 +29,9 @@ namespace ours::task {
           signals_(),
           arch_thread_(),
           user_thread_(),
-          aspace_()
+          aspace_(),
+          // Inherited from the creator, as most of threads work on the data of it.
+          mem_policy_(mem::MemPolicy::current())
     {}
 
     auto Thread::trampoline() -> void {
@@ -112,12 +114,11 @@ namespace ours::task {
     }
 
     auto Thread::wakeup_self() -> void {
-        ustl::sync::LockGuard guard(mutex_);
         if (thread_state_ != ThreadState::Sleeping) {
             return;
         }
         // Positively sleep is always given successful status.
-        waiter_.notify(Status::Ok);
+        waiter_state_.notify(Status::Ok);
     }
 
     auto Thread::Current::preempt() -> void {
@@ -138,15 +139,15 @@ namespace ours::task {
     auto Thread::Current::sleep_for(Milliseconds ms, bool interruptible) -> Status {
         auto thread = get();
 
-        ustl::sync::LockGuard guard(thread->mutex_);
+        // Arm before the timer may fire, the waiter lock is taken inside `wait`.
+        thread->waiter_state_.arm(Status::ShouldWait);
+        thread->set_sleeping();
+
         Timer timer;
-        {
-            timer.activate(Deadline(ms), &Thread::wakeup_self, thread);
-            thread->set_sleeping();
-            thread->waiter_.wait(interruptible, Status::ShouldWait);
-        }
+        timer.activate(Deadline(ms), &Thread::wakeup_self, thread);
+        thread->waiter_state_.wait(interruptible);
         timer.cancel();
-        return thread->waiter_.status();
+        return thread->waiter_state_.status();
     }
 
     auto Thread::Current::exit(i32 retcode) -> void {
@@ -163,7 +164,7 @@ namespace ours::task {
 
     INIT_CODE
     static auto init_thread_cache() -> void {
-        s_thread_cache = mem::ObjectCache::create<Thread>("thread-cache", mem::OcFlags::Folio);
+        s_thread_cache = mem::ObjectCache::create<Thread>("thread-cache", mem::OcFlags::Folio | mem::OcFlags::HwCacheAlign);
         if (!s_thread_cache) {
             panic("Failed to create object cache for Thread");
         }
@@ -3,20 +3,111 @@
 #include <ours/task/thread.hpp>
 #include <ours/task/scheduler.hpp>
 
+#include <arch/intr_disable_guard.hpp>
+
 namespace ours::task {
     auto WaiterState::wait(bool interruptible, Status status) -> void {
+        arm(status);
+        wait(interruptible);
+    }
+
+    auto WaiterState::wait(bool interruptible) -> void {
         auto thread = Thread::of(this);
+        DEBUG_ASSERT(thread == Thread::Current::get(), "Only the owner can wait on its waiter");
+
+        arch::IntrDisableGuard intr_guard;
+        thread->mutex().lock();
+        if (interruptible) {
+            thread->set_interruptible();
+        }
+
+        // The notification may have come between arming and here, both sides check
+        // and change `status_` under the thread lock so no wakeup gets lost.
+        while (status_ == Status::ShouldWait) {
+            // A sleeper keeps its state so that `Thread::wakeup_self` can recognize it.
+            if (thread->state() != ThreadState::Sleeping) {
+                thread->set_blocking();
+            }
+            thread->mutex().unlock();
+
+            // Off the run queue until `notify` activates it again.
+            MainScheduler::Current::get()->deactivate_thread(thread);
+            thread->mutex().lock();
+        }
 
-        status_ = status;
-        thread->set_interruptible();
-        // MainScheduler::Current::deactivate_thread(thread);
         thread->clear_interruptible();
+        thread->mutex().unlock();
     }
 
     auto WaiterState::notify(Status status) -> void {
         auto thread = Thread::of(this);
+
+        arch::IntrDisableGuard intr_guard;
+        thread->mutex().lock();
         status_ = status;
-        // MainScheduler::deactivate_thread(thread);
+
+        auto const state = thread->state();
+        if (state != ThreadState::Blocking && state != ThreadState::Sleeping) {
+            // Not descheduled yet, it will see the new status before blocking.
+            thread->mutex().unlock();
+            return;
+        }
+
+        thread->set_ready();
+        // Put it back onto a run queue, this drops the thread lock.
+        MainScheduler::Current::get()->activate_thread(thread);
+    }
+
+    auto WaitQueue::enqueue_current_locked() -> WaiterState * {
+        auto const waiter = &Thread::Current::get()->waiter_state();
+        waiter->arm(Status::ShouldWait);
+        waiters_.push_back(*waiter);
+        return waiter;
+    }
+
+    auto WaitQueue::block(WaiterState *waiter, bool interruptible) -> Status {
+        waiter->wait(interruptible);
+
+        // Interrupted or timed out, nobody has taken it off.
+        ustl::sync::LockGuard guard(mutex_);
+        if (waiter->managed_hook_.is_linked()) {
+            waiters_.erase(waiters_.iterator_to(*waiter));
+        }
+        return waiter->status();
+    }
+
+    auto WaitQueue::wait(bool interruptible) -> Status {
+        WaiterState *waiter;
+        {
+            ustl::sync::LockGuard guard(mutex_);
+            waiter = enqueue_current_locked();
+        }
+        return block(waiter, interruptible);
+    }
+
+    auto WaitQueue::wake_one(Status status) -> bool {
+        ustl::sync::LockGuard guard(mutex_);
+        if (waiters_.empty()) {
+            return false;
+        }
+
+        auto &waiter = waiters_.front();
+        waiters_.pop_front();
+        waiter.notify(status);
+        return true;
+    }
+
+    auto WaitQueue::wake_all(Status status) -> usize {
+        ustl::sync::LockGuard guard(mutex_);
+
+        usize n = 0;
+        while (!waiters_.empty()) {
+            auto &waiter = waiters_.front();
+            waiters_.pop_front();
+            waiter.notify(status);
+            n += 1;
+        }
+        return n;
     }
 
 } // namespace ours::task
\ No newline at end of file
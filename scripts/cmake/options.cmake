@@ -12,4 +12,5 @@ ours_option(ACPI "Enable/Disable ACPI" ON)
 ours_option(NUMA "Enable/Disable NUMA support" ON)
 ours_option(ZONE_DMA "Enable/Disable NUMA support" ON)
 ours_option(ZONE_DMA32 "Enable/Disable NUMA support" ON)
-ours_option(PLATFORM_PC "Enable PC platform support" ON)
\ No newline at end of file
+ours_option(PLATFORM_PC "Enable PC platform support" ON)
+ours_option(HOST_TESTS "Build the host-side unit tests, requires GTest" OFF)
\ No newline at end of file